@@ -0,0 +1,213 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lc3.h"
+
+/***************************************************************/
+/*                                                             */
+/* lc3bench : simulator speed per kernel and engine            */
+/*                                                             */
+/*   Runs each kernel to HALT on each engine, best of a few    */
+/*   repeats, and writes one tab-separated line per pair:      */
+/*                                                             */
+/*     kernel engine intructions host_ns ns_per_intruction     */
+/*     intructions_per_sec                                     */
+/*                                                             */
+/*   Every engine must finish a kernel in the same state;      */
+/*   a mismatch is an error. Given an earlier output with -c,  */
+/*   pairs that got slower by more than the tolerance are      */
+/*   reported and make the exit status 1.                      */
+/*                                                             */
+/***************************************************************/
+
+static const struct {
+  const char *name;
+  int engine;
+} ENGINES[] = {
+  { "switch",    LC3_ENGINE_SWITCH },
+  { "threaded",  LC3_ENGINE_THREADED },
+  { "inplace",   LC3_ENGINE_INPLACE },
+  { "jit",       LC3_ENGINE_JIT },
+  { "jit-check", LC3_ENGINE_JIT_CHECK },
+  { "profile",   LC3_ENGINE_PROFILE },
+};
+#define NUM_ENGINES ((int) (sizeof(ENGINES) / sizeof(ENGINES[0])))
+
+/* What a run must agree on across engines. */
+typedef struct Bench_Result_Struct {
+  long long count;
+  System_Latches latches;
+  unsigned long long digest;
+} Bench_Result;
+
+static long long now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int find_engine(const char *name) {
+  int i;
+
+  for (i = 0; i < NUM_ENGINES; i++)
+    if (strcmp(ENGINES[i].name, name) == 0)
+      return i;
+  return -1;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : bench_one                                       */
+/*                                                             */
+/* Purpose   : Time the best of repeats runs of one kernel on  */
+/*             one engine. Loading is not timed. Returns the   */
+/*             host nanoseconds, or -1 if the kernel fails to  */
+/*             load or to halt within budget.                  */
+/*                                                             */
+/***************************************************************/
+static long long bench_one(const char *kernel, int engine, int repeats,
+                           int budget, Bench_Result *result) {
+  lc3_machine *m = lc3_create(engine);
+  long long best = -1, start, elapsed;
+  int r, left;
+
+  if (m == NULL)
+    return -1;
+  for (r = 0; r < repeats; r++) {
+    lc3_reset(m);
+    if (lc3_load(m, kernel) < 0)
+      break;
+    start = now_ns();
+    for (left = budget; !lc3_halted(m) && left > 0; )
+      left -= lc3_run(m, left);
+    elapsed = now_ns() - start;
+    if (!lc3_halted(m))
+      break;
+    if (best < 0 || elapsed < best)
+      best = elapsed;
+  }
+
+  if (best >= 0) {
+    result->count = lc3_count(m);
+    lc3_get_regs(m, &result->latches);
+    result->digest = lc3_mem_digest(m);
+  }
+  lc3_destroy(m);
+  return best;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : check_baseline                                  */
+/*                                                             */
+/* Purpose   : Compare one line against an earlier output.     */
+/*             Returns TRUE if it is slower than tolerance     */
+/*             percent over the baseline.                      */
+/*                                                             */
+/***************************************************************/
+static int check_baseline(FILE *baseline, const char *kernel, const char *engine,
+                          double ns_per, double tolerance) {
+  char line[1024], old_kernel[512], old_engine[32];
+  double old_ns_per;
+
+  if (baseline == NULL)
+    return FALSE;
+  rewind(baseline);
+  while (fgets(line, sizeof(line), baseline) != NULL) {
+    if (line[0] == '#' ||
+        sscanf(line, "%511s %31s %*d %*d %lf", old_kernel, old_engine, &old_ns_per) != 3)
+      continue;
+    if (strcmp(old_kernel, kernel) != 0 || strcmp(old_engine, engine) != 0)
+      continue;
+    if (ns_per > old_ns_per * (1.0 + tolerance / 100.0)) {
+      fprintf(stderr, "regression: %s on %s %.3f ns/intruction, was %.3f\n",
+              kernel, engine, ns_per, old_ns_per);
+      return TRUE;
+    }
+    return FALSE;
+  }
+  return FALSE;
+}
+
+int main(int argc, char *argv[]) {
+  int engines[NUM_ENGINES], num_engines = 0, repeats = 3, budget = INT_MAX;
+  int first = 1, i, k, status = 0;
+  double tolerance = 10.0, ns_per;
+  FILE *baseline = NULL;
+  Bench_Result result, expected;
+  long long ns;
+
+  /* Options */
+  while (first + 1 < argc && argv[first][0] == '-') {
+    if (strcmp(argv[first], "-e") == 0) {
+      if ((k = find_engine(argv[first + 1])) < 0) {
+        fprintf(stderr, "Error: unknown engine %s\n", argv[first + 1]);
+        exit(1);
+      }
+      if (num_engines < NUM_ENGINES)
+        engines[num_engines++] = k;
+    } else if (strcmp(argv[first], "-r") == 0) {
+      repeats = atoi(argv[first + 1]);
+    } else if (strcmp(argv[first], "-n") == 0) {
+      budget = atoi(argv[first + 1]);
+    } else if (strcmp(argv[first], "-c") == 0) {
+      if ((baseline = fopen(argv[first + 1], "r")) == NULL) {
+        fprintf(stderr, "Error: Can't open baseline %s\n", argv[first + 1]);
+        exit(1);
+      }
+    } else if (strcmp(argv[first], "-t") == 0) {
+      tolerance = atof(argv[first + 1]);
+    } else {
+      break;
+    }
+    first += 2;
+  }
+
+  if (argc <= first || repeats < 1) {
+    fprintf(stderr, "Error: usage: %s [-e engine]... [-r repeats] [-n budget] "
+            "[-c baseline [-t percent]] <kernel> ...\n", argv[0]);
+    exit(1);
+  }
+  if (num_engines == 0) {
+    /* jit-check is a correctness tool; ask for it with -e. */
+    for (k = 0; k < NUM_ENGINES; k++)
+      if (ENGINES[k].engine != LC3_ENGINE_JIT_CHECK)
+        engines[num_engines++] = k;
+  }
+
+  printf("# kernel\tengine\tintructions\thost_ns\tns_per_intruction\tintructions_per_sec\n");
+  for (i = first; i < argc; i++) {
+    for (k = 0; k < num_engines; k++) {
+      ns = bench_one(argv[i], ENGINES[engines[k]].engine, repeats, budget, &result);
+      if (ns < 0) {
+        fprintf(stderr, "Error: %s did not halt on %s\n", argv[i], ENGINES[engines[k]].name);
+        status = 2;
+        break;
+      }
+      if (k == 0)
+        expected = result;
+      else if (result.count != expected.count || result.digest != expected.digest ||
+               memcmp(&result.latches, &expected.latches, sizeof(System_Latches)) != 0) {
+        fprintf(stderr, "Error: %s ends differently on %s than on %s\n",
+                argv[i], ENGINES[engines[k]].name, ENGINES[engines[0]].name);
+        status = 2;
+      }
+
+      ns_per = result.count ? (double) ns / result.count : 0.0;
+      printf("%s\t%s\t%lld\t%lld\t%.3f\t%.0f\n", argv[i], ENGINES[engines[k]].name,
+             result.count, ns, ns_per, ns ? result.count * 1e9 / ns : 0.0);
+      fflush(stdout);
+      if (check_baseline(baseline, argv[i], ENGINES[engines[k]].name, ns_per, tolerance) &&
+          status == 0)
+        status = 1;
+    }
+  }
+
+  if (baseline != NULL)
+    fclose(baseline);
+  return status;
+}
@@ -0,0 +1,610 @@
+#ifndef LC3_H
+#define LC3_H
+
+#include <stdio.h>
+
+/***************************************************************/
+/*                                                             */
+/* LC-3 simulator library                                      */
+/*                                                             */
+/*   All machine state lives in an lc3_machine handle, so any  */
+/*   number of machines can run in one process, each on its    */
+/*   own thread. A single machine is not thread-safe.          */
+/*                                                             */
+/***************************************************************/
+
+/***************************************************************/
+/* A couple of useful definitions.                             */
+/***************************************************************/
+#define FALSE 0
+#define TRUE  1
+
+/***************************************************************/
+/* Use this to avoid overflowing 16 bits on the bus.           */
+/***************************************************************/
+#define Low16bits(x) ((x) & 0xFFFF)
+
+#define WORDS_IN_MEM    0x10000
+#define LC_3_REGS 8
+
+/* Memory is tracked in pages of this many words for reset/mdump. */
+#define LC3_PAGE_WORDS  0x100
+
+typedef struct System_Latches_Struct{
+
+  int PC,		/* program counter */
+    N,		/* n condition bit */
+    Z,		/* z condition bit */
+    P;		/* p condition bit */
+  int REGS[LC_3_REGS]; /* register file. */
+} System_Latches;
+
+/***************************************************************/
+/* Execution engines.                                          */
+/***************************************************************/
+#define LC3_ENGINE_SWITCH    0	/* process_intruction() per cycle */
+#define LC3_ENGINE_THREADED  1	/* threaded dispatch, state in locals */
+#define LC3_ENGINE_JIT       2	/* x86-64 basic-block translation */
+#define LC3_ENGINE_JIT_CHECK 3	/* JIT checked against the interpreter */
+#define LC3_ENGINE_INPLACE   4	/* in-place latches, lazy condition codes */
+#define LC3_ENGINE_PROFILE   5	/* switch with per-PC counters, see below */
+
+/***************************************************************/
+/* lc3_load() and snapshot errors.                             */
+/***************************************************************/
+#define LC3_ERR_OPEN     -1	/* can't open the program file */
+#define LC3_ERR_EMPTY    -2	/* program file has no origin */
+#define LC3_ERR_TOO_LONG -3	/* program runs past the end of memory */
+#define LC3_ERR_NOMEM    -4	/* out of memory */
+#define LC3_ERR_FORMAT   -5	/* bad or truncated snapshot/image file */
+
+typedef struct lc3_machine lc3_machine;
+
+/*
+ * Create a machine with zeroed memory and registers, Z set and the
+ * run bit on. If the JIT engines are asked for but unavailable on
+ * this host the machine uses LC3_ENGINE_THREADED; lc3_engine() says
+ * which engine was picked. Returns NULL when out of memory.
+ */
+lc3_machine *lc3_create(int engine);
+void lc3_destroy(lc3_machine *m);
+int lc3_engine(lc3_machine *m);
+
+/*
+ * Put a machine back in its lc3_create() state: registers cleared,
+ * run bit on, count zero and memory all zero. Only pages written
+ * since the last reset are touched, so clearing a machine between
+ * runs costs as much as the previous run dirtied.
+ */
+void lc3_reset(lc3_machine *m);
+
+/*
+ * Load a hex program file, or a binary image from
+ * lc3_image_convert(). The first program loaded sets the PC to its
+ * origin. Returns the number of words read, or an LC3_ERR_ code.
+ */
+int lc3_load(lc3_machine *m, const char *program_filename);
+
+/*
+ * Write hex program files out as one binary image, which
+ * lc3_load() maps and copies instead of parsing text. Returns 0 or
+ * an LC3_ERR_ code.
+ */
+int lc3_image_convert(char *const hex_files[], int count, const char *image_filename);
+
+/*
+ * Execute up to budget intructions, stopping early when the machine
+ * halts: at HALT, or when a store clears the clock-enable bit of the
+ * MCR (xFFFE), and without halting when it waits for queued input
+ * (lc3_console_queue()). Returns the number of intructions executed.
+ */
+int lc3_run(lc3_machine *m, int budget);
+int lc3_step(lc3_machine *m);
+int lc3_halted(lc3_machine *m);
+
+int lc3_read_mem(lc3_machine *m, int address);
+void lc3_write_mem(lc3_machine *m, int address, int value);
+void lc3_get_regs(lc3_machine *m, System_Latches *latches);
+void lc3_set_regs(lc3_machine *m, const System_Latches *latches);
+long long lc3_count(lc3_machine *m);	/* intructions executed so far */
+
+/*
+ * The processor status register: [15] user mode, [10:8] priority,
+ * [2:0] N/Z/P. A machine starts in user mode at priority 0; the
+ * first interrupt or exception puts R6 on the supervisor stack at
+ * x3000.
+ */
+int lc3_psr(lc3_machine *m);
+
+/* FALSE if the page holding address is untouched, hence all zero. */
+int lc3_mem_touched(lc3_machine *m, int address);
+
+/* FNV-1a hash over all of memory. */
+unsigned long long lc3_mem_digest(lc3_machine *m);
+
+/***************************************************************/
+/* Console (lc3_trap.c, lc3_device.c).                         */
+/***************************************************************/
+/*
+ * While trap vectors x20-x25 are 0 (no OS image loaded over them),
+ * GETC, OUT, PUTS, IN, PUTSP and HALT run as native routines in one
+ * intruction. A machine starts with stdin/stdout as its console;
+ * NULL input reads as end of input (R0 = 0) and NULL output is
+ * discarded. Output is buffered, and written out when the buffer
+ * fills, before input is read, at HALT and by lc3_console_flush().
+ * The same console backs KBSR/KBDR/DSR/DDR at xFE00-xFE06; keyboard
+ * input then comes through an I/O thread, which lc3_console() with
+ * a new input stream stops.
+ */
+void lc3_console(lc3_machine *m, FILE *input, FILE *output);
+void lc3_console_flush(lc3_machine *m);
+
+/*
+ * Give the machine a queued input in place of its input stream, for a
+ * host running it without blocking: the host hands over bytes with
+ * lc3_console_feed(), which returns how many fit, and marks the end
+ * with lc3_console_end(). A GETC or IN the queue can't serve yet, or a
+ * KBSR read finding it empty, makes lc3_run() return early with the
+ * machine running and lc3_waiting() TRUE; the GETC or IN is left to
+ * the next lc3_run(), the KBSR read has happened. Past the end input
+ * reads as 0 again. lc3_console() goes back to a stream. Returns 0 or
+ * LC3_ERR_NOMEM.
+ */
+int lc3_console_queue(lc3_machine *m);
+int lc3_console_feed(lc3_machine *m, const char *data, int length);
+void lc3_console_end(lc3_machine *m);
+
+/* Whether the queue is empty and not ended, and no key is latched. */
+int lc3_console_starved(lc3_machine *m);
+
+/* Whether the last lc3_run() stopped to wait for queued input. */
+int lc3_waiting(lc3_machine *m);
+
+/***************************************************************/
+/* Breakpoints and watchpoints (lc3_debug.c).                  */
+/***************************************************************/
+/*
+ * lc3_run() returns early, with the machine still running, before it
+ * executes a breakpoint whose condition holds, or just after a
+ * ST/STI/STR writes a watched word; lc3_stopped() says which. A run
+ * that starts on the breakpoint it last stopped at executes it, so
+ * calling lc3_run() again continues. Armed addresses are marked in
+ * the predecoded table, so nothing is checked while none are armed.
+ */
+#define LC3_COND_NONE -1	/* reg: stop every time */
+#define LC3_COND_CC    8	/* reg: stop if N/Z/P matches value as an nzp mask */
+
+#define LC3_EQ 0
+#define LC3_NE 1
+#define LC3_LT 2
+#define LC3_LE 3
+#define LC3_GT 4
+#define LC3_GE 5
+
+typedef struct lc3_condition {
+  int reg;		/* R0-R7, LC3_COND_CC or LC3_COND_NONE */
+  int op;		/* LC3_EQ..LC3_GE, as signed 16-bit values */
+  int value;
+} lc3_condition;
+
+#define LC3_STOP_NONE  0	/* halted, or the budget ran out */
+#define LC3_STOP_BREAK 1	/* at a breakpoint, not yet executed */
+#define LC3_STOP_WATCH 2	/* just after a store to a watched word */
+
+typedef struct lc3_stop {
+  int reason;		/* LC3_STOP_ code */
+  int address;		/* the breakpoint, or the watched word */
+  int old_value, new_value;	/* watched word before and after */
+} lc3_stop;
+
+/* cond NULL stops every time. Both return 0 or LC3_ERR_NOMEM. */
+int lc3_break(lc3_machine *m, int address, const lc3_condition *cond);
+int lc3_watch(lc3_machine *m, int address);
+
+/* Remove any breakpoint and watchpoint at address. */
+void lc3_clear(lc3_machine *m, int address);
+
+/* Why the last lc3_run() stopped. */
+void lc3_stopped(lc3_machine *m, lc3_stop *stop);
+
+/***************************************************************/
+/* Record and replay (lc3_record.c).                           */
+/***************************************************************/
+/*
+ * While recording, lc3_run() logs what each intruction overwrites to
+ * filename, whatever the engine, and lc3_rstep() can take the machine
+ * back n intructions, or lc3_rcontinue() back to the last breakpoint
+ * that holds (or where recording began). Both return how many
+ * intructions were undone; running on after them replaces the
+ * history from there. Console I/O is not undone. lc3_load(),
+ * lc3_write_mem(), lc3_set_regs() and lc3_snapshot_restore() are not
+ * logged, so stop recording before using them; lc3_reset() stops it.
+ * lc3_record() returns 0 or an LC3_ERR_ code; lc3_record_stop()
+ * returns LC3_ERR_OPEN if the log could not be written in full.
+ */
+int lc3_record(lc3_machine *m, const char *filename);
+int lc3_record_stop(lc3_machine *m);
+int lc3_recording(lc3_machine *m);
+int lc3_rstep(lc3_machine *m, int n);
+int lc3_rcontinue(lc3_machine *m);
+
+/***************************************************************/
+/* Execution traces (lc3_trace.c).                             */
+/***************************************************************/
+/*
+ * While tracing, lc3_run() appends an entry per intruction to
+ * filename, whatever the engine: its PC and word, what it wrote and
+ * the condition codes after it. A writer thread does the file I/O.
+ * LC3_TRACE_PACKED stores each entry in 1-9 bytes instead of 10.
+ * lc3_trace() returns 0 or an LC3_ERR_ code; lc3_trace_stop()
+ * returns LC3_ERR_OPEN if the trace could not be written in full.
+ * lc3_reset() stops it.
+ */
+#define LC3_TRACE_PACKED 1
+
+int lc3_trace(lc3_machine *m, const char *filename, int flags);
+int lc3_trace_stop(lc3_machine *m);
+int lc3_tracing(lc3_machine *m);
+
+#define LC3_TRACE_NONE      0	/* wrote no register or memory */
+#define LC3_TRACE_REG       1	/* where is a register */
+#define LC3_TRACE_MEM       2	/* where is a memory address */
+#define LC3_TRACE_INTERRUPT 3	/* not an intruction: where is the vector, value the handler */
+#define LC3_TRACE_KIND      0x03
+#define LC3_TRACE_MORE      0x04	/* the next entry is the same intruction */
+
+typedef struct lc3_trace_entry {
+  int pc, intruction;
+  int kind;		/* LC3_TRACE_ kind, LC3_TRACE_MORE */
+  int where, value;	/* what was written, and where */
+  int cc;		/* N/Z/P after it ran, as nzp */
+} lc3_trace_entry;
+
+typedef struct lc3_trace_reader lc3_trace_reader;
+
+/* NULL if the file can't be read or isn't a trace. */
+lc3_trace_reader *lc3_trace_open(const char *filename);
+long long lc3_trace_start(lc3_trace_reader *r);	/* intruction count it began at */
+
+/* 1 with the next entry, 0 at the end, -1 if the file is cut short. */
+int lc3_trace_next(lc3_trace_reader *r, lc3_trace_entry *entry);
+void lc3_trace_close(lc3_trace_reader *r);
+
+/***************************************************************/
+/* Timing model (lc3_timing.c).                                */
+/***************************************************************/
+/*
+ * intruction_COUNT treats every intruction as one cycle. With a
+ * timing model on, lc3_run() also charges each intruction to an
+ * in-order pipeline with separate I and D caches in front of
+ * memory: a cycle to issue, plus branch_penalty for every taken
+ * BR, JMP, JSR, RTI, interrupt or TRAP into a guest routine,
+ * load_use_penalty when an intruction reads what the load right
+ * before it loaded (a BR reads the load's condition codes), the
+ * miss_penalty of each cache miss and device_penalty for each
+ * access to the device page, which is never cached. The caches
+ * are write-allocate with LRU replacement; a cache with 0 sets
+ * hits on every access. Native TRAPs cost their one cycle.
+ *
+ * lc3_timing() replaces the model with a fresh one, or with NULL
+ * turns it off; it returns 0 or an LC3_ERR_ code (LC3_ERR_FORMAT
+ * for a configuration it can't model). lc3_reset() clears the
+ * counts and the caches. Off, it costs the engines nothing.
+ */
+typedef struct lc3_cache_config {
+  int sets, ways;
+  int line_words;	/* words per line */
+  int miss_penalty;	/* cycles a miss adds */
+} lc3_cache_config;
+
+typedef struct lc3_timing_config {
+  int branch_penalty;
+  int load_use_penalty;
+  int device_penalty;
+  lc3_cache_config icache, dcache;
+} lc3_timing_config;
+
+typedef struct lc3_timing_stats {
+  long long cycles, intructions;
+  long long taken;	/* control transfers paying branch_penalty */
+  long long branch_stalls, load_use_stalls;	/* cycles, by cause */
+  long long icache_stalls, dcache_stalls, device_stalls;
+  long long icache_accesses, icache_misses;
+  long long dcache_accesses, dcache_misses;
+  long long device_accesses;
+} lc3_timing_stats;
+
+/* 2-cycle branches, 1-cycle load-use, 512-word I and 1K-word D caches. */
+void lc3_timing_default(lc3_timing_config *config);
+int lc3_timing(lc3_machine *m, const lc3_timing_config *config);
+
+/* The counts so far. Returns 0, or -1 if the model is off. */
+int lc3_timing_report(lc3_machine *m, lc3_timing_stats *stats);
+
+/***************************************************************/
+/* Subroutine memoization (lc3_memo.c).                        */
+/***************************************************************/
+/*
+ * With memoization on, lc3_run() remembers calls through JSR and
+ * JSRR that come back through JMP R7 without storing, trapping or
+ * touching the device page: the registers, condition codes and
+ * words each one read, and what it left in the registers and
+ * condition codes. A later call to the same routine that would
+ * read the same values gets that outcome, and its intruction count,
+ * without running the body. Results are exact; a routine that
+ * writes memory or rarely repeats is given up on. Off by default;
+ * lc3_reset() forgets every call. lc3_memo() returns 0 or
+ * LC3_ERR_NOMEM.
+ */
+typedef struct lc3_memo_stats {
+  long long calls;	/* to routines not given up */
+  long long hits, misses;
+  long long remembered;	/* misses that made an entry */
+  long long skipped;	/* intructions the hits did not run */
+  long long given_up;	/* routines */
+} lc3_memo_stats;
+
+int lc3_memo(lc3_machine *m, int on);
+
+/* The counts so far. Returns 0, or -1 if memoization is off. */
+int lc3_memo_report(lc3_machine *m, lc3_memo_stats *stats);
+
+/***************************************************************/
+/* Host counters (lc3_hostperf.c).                             */
+/***************************************************************/
+/*
+ * What running the machine costs the host. lc3_run() adds its host
+ * counts and intruction count to the totals, and every period
+ * intructions one intruction is run alone between two readings and
+ * charged to its opcode. Counters come from perf_event_open() where
+ * the kernel allows it; otherwise only the cycles slot is filled,
+ * with time stamp counter ticks, or CLOCK_MONOTONIC nanoseconds where
+ * there is no TSC. A sample the host interrupted costs far more than
+ * the rest; the least sample shows what an intruction costs without.
+ * The guest runs exactly as without. lc3_hostperf()
+ * starts afresh, or stops for a period of 0, and returns 0 or an
+ * LC3_ERR_ code.
+ */
+#define LC3_HOST_PERF  1	/* perf_event_open() counters */
+#define LC3_HOST_TSC   2	/* the time stamp counter, cycles only */
+#define LC3_HOST_CLOCK 3	/* nanoseconds, in the cycles slot */
+
+#define LC3_HOST_CYCLES        0
+#define LC3_HOST_INSTRUCTIONS  1
+#define LC3_HOST_BRANCH_MISSES 2
+#define LC3_HOST_CACHE_MISSES  3
+#define LC3_HOST_COUNTERS      4
+
+typedef struct lc3_hostperf_stats {
+  int source;			/* LC3_HOST_PERF, _TSC or _CLOCK */
+  int have;			/* bit per LC3_HOST_ counter counted */
+  long long intructions;	/* guest intructions the totals cover */
+  unsigned long long total[LC3_HOST_COUNTERS];
+  long long samples[16];	/* per opcode */
+  unsigned long long sampled[16][LC3_HOST_COUNTERS];	/* summed over them */
+  unsigned long long least[16][LC3_HOST_COUNTERS];	/* the least of them */
+} lc3_hostperf_stats;
+
+int lc3_hostperf(lc3_machine *m, int period);
+void lc3_hostperf_clear(lc3_machine *m);
+
+/* The counts so far. Returns 0, or -1 if not measuring. */
+int lc3_hostperf_report(lc3_machine *m, lc3_hostperf_stats *stats);
+
+/***************************************************************/
+/* Superintructions (lc3_fuse.c).                              */
+/***************************************************************/
+/*
+ * With fusing on, lc3_load() walks the control flow of what it
+ * loaded from the PC and the trap and interrupt vectors, and the
+ * switch engine runs these runs of reachable words in one dispatch
+ * each. Counts, condition codes and the intruction count come out
+ * as if each word ran alone, and a store into any word of one puts
+ * its words back to running alone. lc3_fuse() walks what is loaded
+ * now, or stops for on FALSE, and returns 0 or LC3_ERR_NOMEM. Off
+ * by default; lc3_reset() forgets the walk until the next load.
+ */
+#define LC3_FUSE_ADD_BR     1	/* ADD, BR: a countdown */
+#define LC3_FUSE_LDR_ADD    2	/* LDR, ADD */
+#define LC3_FUSE_CONST      3	/* AND R, Rx, #0, ADD R, R, #imm */
+#define LC3_FUSE_LDR_ADD_BR 4	/* LDR, ADD, BR */
+#define LC3_FUSE_KINDS      5
+
+#define LC3_FUSE_TOP 3	/* pairs and triples reported */
+
+typedef struct lc3_fuse_stats {
+  int code_words;		/* reached by the walk */
+  int blocks;			/* basic blocks among them */
+  int sites[LC3_FUSE_KINDS];	/* per kind, fused when walked */
+  long long runs[LC3_FUSE_KINDS];	/* times each kind ran fused */
+  int pairs[LC3_FUSE_TOP][4];	/* count, then opcodes, most frequent first */
+  int triples[LC3_FUSE_TOP][4];
+} lc3_fuse_stats;
+
+int lc3_fuse(lc3_machine *m, int on);
+
+/* The counts so far. Returns 0, or -1 if fusing is off. */
+int lc3_fuse_report(lc3_machine *m, lc3_fuse_stats *stats);
+
+/***************************************************************/
+/* Profiling (lc3_profile.c).                                  */
+/***************************************************************/
+/*
+ * A machine created with LC3_ENGINE_PROFILE counts executions per PC
+ * and per opcode, BR taken/not taken, memory reads and writes per
+ * address and calls per JSR/JSRR target. lc3_reset() clears the
+ * counts. It runs on the switch engine's handlers, with loops still
+ * skipped and their iterations counted.
+ *
+ * Write the hottest blocks, loops, branches, call targets and memory
+ * words so far. Returns 0, or -1 if the machine isn't profiling.
+ */
+int lc3_profile_report(lc3_machine *m, FILE *report);
+
+/***************************************************************/
+/* Snapshots (lc3_snapshot.c).                                 */
+/***************************************************************/
+/*
+ * A snapshot is a frozen copy of a machine between runs: latches,
+ * intruction count, run bit, device registers and memory; the timer
+ * and keyboard events are scheduled again from the devices when it
+ * is restored. Restoring one maps its memory copy-on-write, so it
+ * costs the pages the program later writes, not a copy of memory,
+ * and one snapshot can seed any number of machines.
+ * The machine's engine is not part of the snapshot.
+ */
+typedef struct lc3_snapshot lc3_snapshot;
+
+/* NULL when out of memory. */
+lc3_snapshot *lc3_snapshot_take(lc3_machine *m);
+void lc3_snapshot_free(lc3_snapshot *s);
+
+/* Returns 0, or LC3_ERR_NOMEM if the image can't be mapped. */
+int lc3_snapshot_restore(lc3_machine *m, const lc3_snapshot *s);
+
+/*
+ * A new machine, on the parent's engine, in the parent's current
+ * state. Parent and child share memory pages until either writes
+ * one. NULL when out of memory.
+ */
+lc3_machine *lc3_fork(lc3_machine *parent);
+
+/*
+ * Write a snapshot to a file and read one back, possibly in another
+ * process. Both return 0 or an LC3_ERR_ code.
+ */
+int lc3_snapshot_save(const lc3_snapshot *s, const char *filename);
+int lc3_snapshot_load(const char *filename, lc3_snapshot **s);
+
+/***************************************************************/
+/* Scheduler (lc3_sched.c).                                    */
+/***************************************************************/
+/*
+ * Many machines on the calling thread: lc3_sched_run() hands out
+ * lc3_run()s of quantum intructions round-robin. lc3_sched_add()
+ * gives a machine a queued console (lc3_console_queue()) and a budget
+ * of intructions, negative for none, and returns its id or an
+ * LC3_ERR_ code. A machine that stops to wait for input is parked
+ * until lc3_sched_feed() or lc3_sched_end() - not the lc3_console_
+ * calls, which the scheduler doesn't see - gives it something to
+ * read. Machines stay the caller's; lc3_sched_destroy() leaves them.
+ *
+ * Latencies are in intructions of the scheduler's clock, the sum
+ * over all its machines, so they don't depend on the host.
+ */
+#define LC3_SCHED_READY 0	/* queued or running */
+#define LC3_SCHED_PARKED 1	/* waiting for input */
+#define LC3_SCHED_HALTED 2
+#define LC3_SCHED_BUDGET 3	/* ran its budget */
+
+typedef struct lc3_sched lc3_sched;
+
+typedef struct lc3_sched_stats {
+  long long clock;		/* intructions run by all machines */
+  long long slices;		/* lc3_run() calls */
+  long long parks, wakes;
+  long long dispatches;		/* queue to running, for the dispatch latency */
+  double dispatch_mean;
+  long long dispatch_max;
+  long long woken;		/* feeds to running, for the wake latency */
+  double wake_mean;
+  long long wake_max;
+  double fairness;		/* Jain's index of the clock shares, 1 is even */
+  int machines, ready, parked;
+} lc3_sched_stats;
+
+typedef struct lc3_sched_machine {
+  int state;			/* LC3_SCHED_ */
+  long long intructions, slices, parks;
+  long long runnable;		/* clock while it was ready or running */
+  long long dispatch_max;
+} lc3_sched_machine;
+
+lc3_sched *lc3_sched_create(int quantum);
+void lc3_sched_destroy(lc3_sched *s);
+int lc3_sched_add(lc3_sched *s, lc3_machine *m, int budget);
+
+/* lc3_console_feed() and lc3_console_end(), waking the machine. */
+int lc3_sched_feed(lc3_sched *s, int id, const char *data, int length);
+void lc3_sched_end(lc3_sched *s, int id);
+
+/*
+ * Run until no machine is runnable or budget intructions have run.
+ * Returns the number of machines still runnable.
+ */
+int lc3_sched_run(lc3_sched *s, long long budget);
+
+void lc3_sched_report(lc3_sched *s, lc3_sched_stats *stats);
+
+/* One machine's counts. Returns 0, or -1 for an unknown id. */
+int lc3_sched_machine_report(lc3_sched *s, int id, lc3_sched_machine *stats);
+
+/***************************************************************/
+/* Batch runs (lc3_batch.c).                                   */
+/***************************************************************/
+#define LC3_BATCH_HALTED 1	/* reached HALT */
+#define LC3_BATCH_BUDGET 2	/* still running when the budget ran out */
+
+typedef struct lc3_batch_result {
+  int status;		/* LC3_BATCH_ or LC3_ERR_ code */
+  long long count;	/* intructions executed */
+  System_Latches latches;	/* final registers */
+  unsigned long long digest;	/* lc3_mem_digest() of final memory */
+} lc3_batch_result;
+
+/*
+ * Run each program on its own machine until HALT or budget
+ * intructions, spread over threads workers that steal from each
+ * other's queues. results[i] belongs to programs[i]. Returns 0, or
+ * -1 if the workers could not be started.
+ */
+int lc3_batch_run(char *const programs[], int count, int engine, int budget,
+                  int threads, lc3_batch_result results[]);
+
+/*
+ * lc3_batch_run() on the calling thread, every program on its own
+ * machine under one scheduler handing out quantum intructions at a
+ * time. Input is empty. Fills stats if not NULL. Returns 0, or -1 if
+ * the scheduler could not be set up.
+ */
+int lc3_batch_sched(char *const programs[], int count, int engine, int budget,
+                    int quantum, lc3_batch_result results[], lc3_sched_stats *stats);
+
+/* One line per program, in the order given. */
+void lc3_batch_report(FILE *report, char *const programs[], int count,
+                      const lc3_batch_result results[]);
+
+/***************************************************************/
+/* Lockstep lanes (lc3_lanes.c).                               */
+/***************************************************************/
+/*
+ * Up to LC3_LANES independent machines with their registers and
+ * memory kept lane-by-lane, so lanes at the same PC execute each
+ * intruction together in SIMD. Lanes that branch apart are run as
+ * separate groups until their PCs meet again. Build with
+ * -march=native (or -mavx2 / -mavx512f) to get full-width vectors.
+ */
+#define LC3_LANES 16
+
+typedef struct lc3_lanes lc3_lanes;
+
+lc3_lanes *lc3_lanes_create(int lanes);
+void lc3_lanes_destroy(lc3_lanes *l);
+
+/* Load a hex program into every lane, as lc3_load() does. */
+int lc3_lanes_load(lc3_lanes *l, const char *program_filename);
+
+/*
+ * Run every lane until it halts or has executed budget more
+ * intructions. Returns the number of lanes still running.
+ */
+int lc3_lanes_run(lc3_lanes *l, int budget);
+
+int lc3_lanes_halted(lc3_lanes *l, int lane);
+int lc3_lanes_read_mem(lc3_lanes *l, int lane, int address);
+void lc3_lanes_write_mem(lc3_lanes *l, int lane, int address, int value);
+void lc3_lanes_get_regs(lc3_lanes *l, int lane, System_Latches *latches);
+void lc3_lanes_set_regs(lc3_lanes *l, int lane, const System_Latches *latches);
+long long lc3_lanes_count(lc3_lanes *l, int lane);
+
+#endif
@@ -0,0 +1,245 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Batch runner                                                */
+/*                                                             */
+/*   Every worker owns a deque of program indices, dealt out   */
+/*   round-robin up front. A worker takes work from the back   */
+/*   of its own deque and, once that is empty, steals from the */
+/*   front of the others', so long-running programs don't      */
+/*   leave the remaining cores idle. Programs are independent  */
+/*   machines; results land in the caller's array by index.    */
+/*   Each worker keeps one machine and lc3_reset()s it between */
+/*   programs, which only clears the pages the last one wrote. */
+/*   Machines get no console: input is empty, output dropped.  */
+/*   lc3_batch_sched() is the one-thread form, every program   */
+/*   on a machine of its own under lc3_sched_run().            */
+/*                                                             */
+/***************************************************************/
+
+typedef struct Batch_Queue_Struct {
+  pthread_mutex_t lock;
+  int *jobs;
+  int head, tail;	/* jobs[head..tail) still to run */
+} Batch_Queue;
+
+typedef struct Batch_Struct {
+  char *const *programs;
+  lc3_batch_result *results;
+  int engine, budget, threads;
+  Batch_Queue *queues;
+} Batch;
+
+typedef struct Batch_Worker_Struct {
+  Batch *batch;
+  int id;
+} Batch_Worker;
+
+static void batch_run_one(Batch *b, lc3_machine *m, int job) {
+  lc3_batch_result *r = &b->results[job];
+  int words;
+
+  if (m == NULL) {
+    r->status = LC3_ERR_NOMEM;
+    return;
+  }
+  lc3_reset(m);
+  words = lc3_load(m, b->programs[job]);
+  if (words < 0) {
+    r->status = words;
+  } else {
+    lc3_run(m, b->budget);
+    r->status = lc3_halted(m) ? LC3_BATCH_HALTED : LC3_BATCH_BUDGET;
+  }
+  r->count = lc3_count(m);
+  lc3_get_regs(m, &r->latches);
+  r->digest = lc3_mem_digest(m);
+}
+
+/* Back of our own deque, or -1. */
+static int batch_pop(Batch_Queue *q) {
+  int job = -1;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->head < q->tail)
+    job = q->jobs[--q->tail];
+  pthread_mutex_unlock(&q->lock);
+  return job;
+}
+
+/* Front of someone else's deque, or -1. */
+static int batch_steal(Batch_Queue *q) {
+  int job = -1;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->head < q->tail)
+    job = q->jobs[q->head++];
+  pthread_mutex_unlock(&q->lock);
+  return job;
+}
+
+static void *batch_worker(void *arg) {
+  Batch_Worker *w = arg;
+  Batch *b = w->batch;
+  lc3_machine *m = lc3_create(b->engine);
+  int job, i;
+
+  if (m != NULL)
+    lc3_console(m, NULL, NULL);	/* programs run without a console */
+  for (;;) {
+    job = batch_pop(&b->queues[w->id]);
+    for (i = 1; job < 0 && i < b->threads; i++)
+      job = batch_steal(&b->queues[(w->id + i) % b->threads]);
+    if (job < 0)
+      break;	/* nothing is ever added, so we are done */
+    batch_run_one(b, m, job);
+  }
+  lc3_destroy(m);
+  return NULL;
+}
+
+int lc3_batch_run(char *const programs[], int count, int engine, int budget,
+                  int threads, lc3_batch_result results[]) {
+  Batch b;
+  Batch_Worker *workers;
+  pthread_t *tids;
+  int i, started, status = 0;
+
+  if (threads < 1) threads = 1;
+  if (threads > count) threads = count > 0 ? count : 1;
+
+  b.programs = programs;
+  b.results = results;
+  b.engine = engine;
+  b.budget = budget;
+  b.threads = threads;
+  b.queues = calloc(threads, sizeof(Batch_Queue));
+  workers = calloc(threads, sizeof(Batch_Worker));
+  tids = calloc(threads, sizeof(pthread_t));
+  if (b.queues == NULL || workers == NULL || tids == NULL) {
+    status = -1;
+    goto out;
+  }
+
+  for (i = 0; i < threads; i++) {
+    pthread_mutex_init(&b.queues[i].lock, NULL);
+    b.queues[i].jobs = malloc((count / threads + 1) * sizeof(int));
+    if (b.queues[i].jobs == NULL)
+      status = -1;
+  }
+  if (status == 0)
+    for (i = 0; i < count; i++) {
+      Batch_Queue *q = &b.queues[i % threads];
+      q->jobs[q->tail++] = i;
+    }
+
+  /* Workers 1..n-1 get threads; worker 0 is the caller. */
+  for (started = 1; status == 0 && started < threads; started++) {
+    workers[started].batch = &b;
+    workers[started].id = started;
+    if (pthread_create(&tids[started], NULL, batch_worker, &workers[started]) != 0)
+      break;
+  }
+  if (status == 0) {
+    workers[0].batch = &b;
+    workers[0].id = 0;
+    batch_worker(&workers[0]);
+  }
+  for (i = 1; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  for (i = 0; i < threads; i++) {
+    pthread_mutex_destroy(&b.queues[i].lock);
+    free(b.queues[i].jobs);
+  }
+out:
+  free(b.queues);
+  free(workers);
+  free(tids);
+  return status;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_batch_sched                                 */
+/*                                                             */
+/* Purpose   : The batch on one thread: a machine per program, */
+/*             all loaded up front and run by a scheduler, the */
+/*             results gathered once no machine can run.       */
+/*                                                             */
+/***************************************************************/
+int lc3_batch_sched(char *const programs[], int count, int engine, int budget,
+                    int quantum, lc3_batch_result results[], lc3_sched_stats *stats) {
+  lc3_sched *s = lc3_sched_create(quantum);
+  lc3_machine **machines = calloc(count > 0 ? count : 1, sizeof(lc3_machine *));
+  lc3_batch_result *r;
+  int i, words, status = 0;
+
+  if (s == NULL || machines == NULL) {
+    status = -1;
+    goto out;
+  }
+  for (i = 0; i < count; i++) {
+    r = &results[i];
+    memset(r, 0, sizeof(*r));
+    if ((machines[i] = lc3_create(engine)) == NULL) {
+      r->status = LC3_ERR_NOMEM;
+      continue;
+    }
+    lc3_console(machines[i], NULL, NULL);
+    if ((words = lc3_load(machines[i], programs[i])) < 0)
+      r->status = words;
+    else if ((words = lc3_sched_add(s, machines[i], budget)) < 0)
+      r->status = words;
+    else
+      lc3_sched_end(s, words);	/* programs run without input */
+  }
+
+  while (lc3_sched_run(s, 1LL << 30) > 0)
+    ;
+  if (stats != NULL)
+    lc3_sched_report(s, stats);
+
+  for (i = 0; i < count; i++) {
+    r = &results[i];
+    if (machines[i] == NULL)
+      continue;
+    if (r->status == 0)
+      r->status = lc3_halted(machines[i]) ? LC3_BATCH_HALTED : LC3_BATCH_BUDGET;
+    r->count = lc3_count(machines[i]);
+    lc3_get_regs(machines[i], &r->latches);
+    r->digest = lc3_mem_digest(machines[i]);
+    lc3_destroy(machines[i]);
+  }
+out:
+  free(machines);
+  lc3_sched_destroy(s);
+  return status;
+}
+
+void lc3_batch_report(FILE *report, char *const programs[], int count,
+                      const lc3_batch_result results[]) {
+  const lc3_batch_result *r;
+  int i, k;
+
+  for (i = 0; i < count; i++) {
+    r = &results[i];
+    fprintf(report, "%s ", programs[i]);
+    switch (r->status) {
+    case LC3_BATCH_HALTED: fprintf(report, "halted"); break;
+    case LC3_BATCH_BUDGET: fprintf(report, "budget"); break;
+    default: fprintf(report, "error%d\n", r->status); continue;
+    }
+    fprintf(report, " count=%lld PC=0x%.4x CC=%d%d%d", r->count, r->latches.PC,
+            r->latches.N, r->latches.Z, r->latches.P);
+    for (k = 0; k < LC_3_REGS; k++)
+      fprintf(report, " R%d=0x%.4x", k, r->latches.REGS[k]);
+    fprintf(report, " mem=%.16llx\n", r->digest);
+  }
+}
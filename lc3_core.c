@@ -0,0 +1,798 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_create / lc3_destroy                        */
+/*                                                             */
+/* Purpose   : Allocate a machine in its reset state, and free */
+/*             it again. calloc() and mmap() already hand back */
+/*             zeroed memory and no DECODED pages, and leave   */
+/*             pages nobody touches unbacked.                  */
+/*                                                             */
+/***************************************************************/
+lc3_machine *lc3_create(int engine) {
+  lc3_machine *m = calloc(1, sizeof(lc3_machine));
+
+  if (m == NULL)
+    return NULL;
+  m->MEMORY = mmap(NULL, MEMORY_BYTES, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m->MEMORY == MAP_FAILED) {
+    free(m);
+    return NULL;
+  }
+
+  m->CURRENT_LATCHES.Z = 1;
+  m->NEXT_LATCHES = m->CURRENT_LATCHES;
+  m->RUN_BIT = TRUE;
+  interrupt_reset(m);
+  m->CONSOLE_IN = stdin;
+  m->CONSOLE_OUT = stdout;
+
+  m->ENGINE = engine;
+  if ((engine == LC3_ENGINE_JIT || engine == LC3_ENGINE_JIT_CHECK) && !jit_init(m))
+    m->ENGINE = LC3_ENGINE_THREADED;
+  if (engine == LC3_ENGINE_PROFILE && !profile_init(m)) {
+    lc3_destroy(m);
+    return NULL;
+  }
+  return m;
+}
+
+void lc3_destroy(lc3_machine *m) {
+  if (m == NULL)
+    return;
+  lc3_console_flush(m);
+  jit_free(m);
+  profile_free(m);
+  debug_free(m);
+  lc3_record_stop(m);
+  lc3_trace_stop(m);
+  lc3_timing(m, NULL);
+  lc3_memo(m, FALSE);
+  lc3_hostperf(m, 0);
+  lc3_fuse(m, FALSE);
+  keyboard_free(m);
+  free(m->INPUT);
+  decode_free(m);
+  munmap(m->MEMORY, MEMORY_BYTES);
+  free(m);
+}
+
+int lc3_engine(lc3_machine *m) {
+  return m->ENGINE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_reset                                       */
+/*                                                             */
+/* Purpose   : Return the machine to its lc3_create() state,   */
+/*             zeroing only the pages written since the last   */
+/*             reset. Decodes of clean pages are still right.  */
+/*                                                             */
+/***************************************************************/
+void lc3_reset(lc3_machine *m) {
+  int page, i, base;
+
+  for (page = 0; page < PAGES_IN_MEM; page++) {
+    if (!m->DIRTY[page])
+      continue;
+    base = page << PAGE_SHIFT;
+    memset(&m->MEMORY[base], 0, LC3_PAGE_WORDS * sizeof(m->MEMORY[0]));
+    for (i = 0; i < LC3_PAGE_WORDS; i++)
+      decode_drop(m, base + i);
+    m->DIRTY[page] = FALSE;
+  }
+
+  lc3_console_flush(m);
+  lc3_record_stop(m);
+  lc3_trace_stop(m);
+  memset(&m->CURRENT_LATCHES, 0, sizeof(m->CURRENT_LATCHES));
+  m->CURRENT_LATCHES.Z = 1;
+  m->NEXT_LATCHES = m->CURRENT_LATCHES;
+  m->RUN_BIT = TRUE;
+  m->intruction_COUNT = 0;
+  device_reset(m);
+  interrupt_reset(m);
+  debug_reset(m);
+  jit_reset(m);
+  profile_reset(m);
+  timing_reset(m);
+  memo_reset(m);
+  hostperf_reset(m);
+  fuse_reset(m);
+}
+
+/**************************************************************/
+/*                                                            */
+/* Procedure : lc3_load                                       */
+/*                                                            */
+/* Purpose   : Load program and service routines into mem.    */
+/*             Binary images go to load_image().              */
+/*                                                            */
+/**************************************************************/
+int lc3_load(lc3_machine *m, const char *program_filename) {
+  FILE * prog;
+  int ii, word, program_base;
+
+  if (is_image(program_filename)) {
+    ii = load_image(m, program_filename);
+    if (ii >= 0 && m->FUSE != NULL)
+      fuse_scan(m);
+    return ii;
+  }
+
+  /* Open program file. */
+  prog = fopen(program_filename, "r");
+  if (prog == NULL)
+    return LC3_ERR_OPEN;
+
+  /* Read in the program. */
+  if (fscanf(prog, "%x\n", &word) != EOF)
+    program_base = word ;
+  else {
+    fclose(prog);
+    return LC3_ERR_EMPTY;
+  }
+
+  ii = 0;
+  while (fscanf(prog, "%x\n", &word) != EOF) {
+    /* Make sure it fits. */
+    if (program_base + ii >= WORDS_IN_MEM) {
+      fclose(prog);
+      return LC3_ERR_TOO_LONG;
+    }
+
+    /* Write the word to memory array. */
+    write_memory(m, program_base + ii, word);
+    ii++;
+  }
+  fclose(prog);
+
+  if (m->CURRENT_LATCHES.PC == 0) m->CURRENT_LATCHES.PC = program_base;
+  m->NEXT_LATCHES = m->CURRENT_LATCHES;
+  if (m->FUSE != NULL)
+    fuse_scan(m);
+
+  return ii;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cycle                                           */
+/*                                                             */
+/* Purpose   : Execute a cycle                                 */
+/*                                                             */
+/***************************************************************/
+void cycle(lc3_machine *m) {
+
+  process_intruction(m);	/* already latches NEXT into CURRENT */
+  m->intruction_COUNT++;
+}
+
+/* One run of the machine's engine, up to whatever stops it. */
+static int engine_slice(lc3_machine *m, int budget) {
+  int i;
+
+  if (m->TIMING != NULL || m->TRACE != NULL || m->RECORD != NULL) {
+    if (m->TIMING != NULL)
+      i = timing_run(m, budget);
+    else if (m->TRACE != NULL)
+      i = trace_run(m, budget);
+    else
+      i = record_run(m, budget);
+    if (m->ENGINE == LC3_ENGINE_JIT_CHECK)
+      jit_reset(m);	/* its JIT side missed these */
+    return i;
+  }
+
+  switch (m->ENGINE) {
+  case LC3_ENGINE_THREADED:
+    i = threaded_run(m, budget);
+    break;
+  case LC3_ENGINE_INPLACE:
+    i = inplace_run(m, budget);
+    break;
+  case LC3_ENGINE_JIT:
+    i = jit_run(m, budget);
+    break;
+  case LC3_ENGINE_JIT_CHECK:
+    i = jit_check_run(m, budget);
+    break;
+  default:
+    if (m->FUSE != NULL && m->PROFILE == NULL) {	/* would count a pair as one */
+      i = fuse_run(m, budget);
+      break;
+    }
+    for (i = 0; i < budget && m->RUN_BIT && !m->STOP && !m->WAITING &&
+         m->intruction_COUNT < m->NEXT_EVENT; i++)
+      cycle(m);
+    if (m->STOP) {
+      i--;
+      m->intruction_COUNT--;
+      m->STOP = FALSE;
+    }
+    break;
+  }
+  return i;
+}
+
+/*
+ * The intruction an engine stopped in front of, if it is one left
+ * to us: RTI, a device access, the BR of a loop to fast-forward, a
+ * call to memoize within limit intructions, or a GETC/IN that can
+ * run unless its queued input is empty. Returns how many ran, 0
+ * leaving it alone for anything else.
+ */
+static int engine_step(lc3_machine *m, int limit) {
+  Decoded_Intruction d;
+  int pc = m->CURRENT_LATCHES.PC;
+
+  decode_intruction(m->MEMORY[pc], &d);
+  if (m->DEBUG != NULL && debug_stops_at(m, pc, &d))
+    return 0;	/* debug_run() steps it */
+  if (d.opcode == 0b0000)
+    return loop_run(m, limit);
+  if (d.opcode == 0b0100 && m->MEMO != NULL)
+    return memo_run(m, limit);
+  if (d.opcode == 0b1111) {
+    if (input_blocks(m, &d)) {
+      m->WAITING = TRUE;
+      return 0;
+    }
+    step_decoded(m, &d);
+    return 1;
+  }
+  if (d.opcode != 0b1000 && !device_access(m, &d))
+    return 0;
+  step_decoded(m, &d);
+  return 1;
+}
+
+/* At most n intructions, and none past NEXT_EVENT. */
+static int until_event(lc3_machine *m, int n) {
+  return m->NEXT_EVENT - m->intruction_COUNT < n ? m->NEXT_EVENT - m->intruction_COUNT : n;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : engine_run                                      */
+/*                                                             */
+/* Purpose   : Execute up to n cycles with the machine's       */
+/*             engine, stopping when the run bit goes off or   */
+/*             in front of an OP_STOP entry. The engine gets   */
+/*             no further than NEXT_EVENT at a time; events    */
+/*             and interrupts are dealt with in between, as    */
+/*             are the RTIs, device accesses and loops it      */
+/*             stops in front of, and the intruction sampled   */
+/*             for host costs. A KBSR read finding queued      */
+/*             input empty ends the run after it.              */
+/*                                                             */
+/***************************************************************/
+int engine_run(lc3_machine *m, int budget) {
+  int executed = 0, n;
+
+  while (m->RUN_BIT) {
+    if (m->intruction_COUNT >= m->NEXT_EVENT)
+      events_run(m);
+    if (m->HOSTPERF != NULL && hostperf_due(m) && executed < budget) {
+      executed += hostperf_sample(m, engine_slice);
+      continue;
+    }
+    executed += engine_slice(m, until_event(m, budget - executed));
+    if (executed == budget || m->RUN_BIT == FALSE || m->WAITING)
+      break;
+    if (m->intruction_COUNT >= m->NEXT_EVENT)
+      continue;	/* the deadline stopped it */
+    if ((n = engine_step(m, until_event(m, budget - executed))) == 0)
+      break;
+    executed += n;
+    if (m->WAITING)
+      break;
+  }
+  return executed;
+}
+
+/*
+ * Run one intruction past whatever watches them: the timing model
+ * first, then the trace or the record log.
+ */
+void step_observed(lc3_machine *m, Decoded_Intruction *d) {
+  if (m->TIMING != NULL)
+    timing_step(m, d);
+  if (m->TRACE != NULL)
+    trace_step(m, d);
+  else if (m->RECORD != NULL)
+    record_step(m, d);
+  else
+    execute_decoded(m, d);
+}
+
+/*
+ * Run one intruction decoded outside the DECODED table, the way the
+ * engine would have: observed as above, and with the JIT side of
+ * jit-check brought back in line afterwards.
+ */
+void step_decoded(lc3_machine *m, Decoded_Intruction *d) {
+  step_observed(m, d);
+  if (m->ENGINE == LC3_ENGINE_JIT_CHECK)
+    jit_reset(m);	/* its JIT side missed this step */
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_run                                         */
+/*                                                             */
+/* Purpose   : Execute up to n cycles with the machine's       */
+/*             engine. HALT, or a write clearing MCR[15],      */
+/*             turns the run bit off and halts the machine; a  */
+/*             breakpoint or watchpoint stops it early without */
+/*             halting. Returns the number of cycles executed. */
+/*                                                             */
+/***************************************************************/
+int lc3_run(lc3_machine *m, int budget) {
+  int i;
+
+  m->WAITING = FALSE;
+  if (m->RUN_BIT == FALSE)
+    return 0;
+
+  if (m->HOSTPERF != NULL)
+    hostperf_begin(m);
+  i = m->DEBUG != NULL ? debug_run(m, budget) : engine_run(m, budget);
+  if (m->HOSTPERF != NULL)
+    hostperf_end(m);
+  if (m->RUN_BIT == FALSE)
+    lc3_console_flush(m);
+  return i;
+}
+
+int lc3_step(lc3_machine *m) {
+  return lc3_run(m, 1);
+}
+
+int lc3_halted(lc3_machine *m) {
+  return m->RUN_BIT == FALSE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : state accessors                                 */
+/*                                                             */
+/* Purpose   : Read and write memory and registers between     */
+/*             runs.                                           */
+/*                                                             */
+/***************************************************************/
+int lc3_read_mem(lc3_machine *m, int address) {
+  return m->MEMORY[Low16bits(address)];
+}
+
+void lc3_write_mem(lc3_machine *m, int address, int value) {
+  write_memory(m, address, value);
+}
+
+void lc3_get_regs(lc3_machine *m, System_Latches *latches) {
+  *latches = m->CURRENT_LATCHES;
+}
+
+void lc3_set_regs(lc3_machine *m, const System_Latches *latches) {
+  m->CURRENT_LATCHES = *latches;
+  m->NEXT_LATCHES = *latches;
+}
+
+long long lc3_count(lc3_machine *m) {
+  return m->intruction_COUNT;
+}
+
+int lc3_mem_touched(lc3_machine *m, int address) {
+  return m->DIRTY[Low16bits(address) >> PAGE_SHIFT];
+}
+
+unsigned long long lc3_mem_digest(lc3_machine *m) {
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+  int i;
+
+  for (i = 0; i < WORDS_IN_MEM; i++) {
+    hash = (hash ^ (m->MEMORY[i] & 0xFF)) * 0x100000001b3ULL;
+    hash = (hash ^ ((m->MEMORY[i] >> 8) & 0xFF)) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Intruction set                                              */
+/*                                                             */
+/***************************************************************/
+
+int x_to_32 (int x, int n) {
+    return (x << (32 - n)) >> (32 - n);
+}
+
+/*
+ * Loads and stores of the handlers below go through read_memory()
+ * and write_memory(), which leave the device page to lc3_device.c.
+ */
+int read_memory(lc3_machine *m, int address){
+  address = Low16bits(address);
+  if (m->PROFILE != NULL)
+    profile_access(m, address, FALSE);
+  return IS_DEVICE(address) ? device_read(m, address) : m->MEMORY[address];
+}
+
+static void store_memory(lc3_machine *m, int address, int value){
+  address = Low16bits(address);
+  if (m->PROFILE != NULL)
+    profile_access(m, address, TRUE);
+  if (IS_DEVICE(address))
+    device_write(m, address, value);
+  else
+    write_memory(m, address, value);
+}
+
+/*
+ * Writes to memory go through here so the predecoded copy of the
+ * word, and any translation of it, is dropped; self-modifying code
+ * then gets re-decoded on its next fetch. The page is marked for
+ * lc3_reset(). Addresses wrap at 16 bits like every other address
+ * the machine forms.
+ */
+void write_memory(lc3_machine *m, int address, int value){
+  address = Low16bits(address);
+  m->MEMORY[address] = Low16bits(value);
+  decode_drop(m, address);
+  jit_written(m, address);
+  m->DIRTY[address >> PAGE_SHIFT] = TRUE;
+}
+
+static Decoded_Intruction * fetch(lc3_machine *m){
+  Decoded_Intruction *d = DECODED_AT(m, m->CURRENT_LATCHES.PC);
+  if (!d->valid)
+    decode(m, m->CURRENT_LATCHES.PC, m->MEMORY[m->CURRENT_LATCHES.PC], d);
+  m->NEXT_LATCHES.PC = Low16bits(m->CURRENT_LATCHES.PC + 1);
+  return d;
+}
+
+static void Set_Condition_Code(lc3_machine *m, int dr){
+  int value = m->NEXT_LATCHES.REGS[dr];
+  int sign = (value & 0x8000) >> 15;
+  if (value == 0){
+    m->NEXT_LATCHES.N = 0;
+    m->NEXT_LATCHES.Z = 1;
+    m->NEXT_LATCHES.P = 0;
+  }
+  else if (sign){
+    m->NEXT_LATCHES.N = 1;
+    m->NEXT_LATCHES.Z = 0;
+    m->NEXT_LATCHES.P = 0;
+  }
+  else {
+    m->NEXT_LATCHES.N = 0;
+    m->NEXT_LATCHES.Z = 0;
+    m->NEXT_LATCHES.P = 1;
+  }
+}
+
+static void ADD(lc3_machine *m, Decoded_Intruction *d){
+  if (d->imm_flag) {
+    m->NEXT_LATCHES.REGS[d->dr] = m->CURRENT_LATCHES.REGS[d->sr1] + d->imm;
+  } else {
+    m->NEXT_LATCHES.REGS[d->dr] = m->CURRENT_LATCHES.REGS[d->sr1] + m->CURRENT_LATCHES.REGS[d->sr2];
+  }
+  m->NEXT_LATCHES.REGS[d->dr] = Low16bits(m->NEXT_LATCHES.REGS[d->dr]);
+  Set_Condition_Code(m, d->dr);
+}
+
+static void AND(lc3_machine *m, Decoded_Intruction *d){
+  if (d->imm_flag) {
+    m->NEXT_LATCHES.REGS[d->dr] = m->CURRENT_LATCHES.REGS[d->sr1] & d->imm;
+  } else {
+    m->NEXT_LATCHES.REGS[d->dr] = m->CURRENT_LATCHES.REGS[d->sr1] & m->CURRENT_LATCHES.REGS[d->sr2];
+  }
+  m->NEXT_LATCHES.REGS[d->dr] = Low16bits(m->NEXT_LATCHES.REGS[d->dr]);
+  Set_Condition_Code(m, d->dr);
+}
+
+static void BR(lc3_machine *m, Decoded_Intruction *d){
+  if (((d->nzp & 4) && m->CURRENT_LATCHES.N) ||
+      ((d->nzp & 2) && m->CURRENT_LATCHES.Z) ||
+      ((d->nzp & 1) && m->CURRENT_LATCHES.P)){
+    m->NEXT_LATCHES.PC = Low16bits(m->NEXT_LATCHES.PC + d->imm);
+  }
+}
+
+static void JMP(lc3_machine *m, Decoded_Intruction *d){
+  m->NEXT_LATCHES.PC = m->CURRENT_LATCHES.REGS[d->sr1];
+}
+
+static void JSR(lc3_machine *m, Decoded_Intruction *d){
+  m->NEXT_LATCHES.REGS[7] = m->NEXT_LATCHES.PC;
+
+  if (d->imm_flag){
+    m->NEXT_LATCHES.PC = Low16bits(m->NEXT_LATCHES.PC + d->imm);
+  } else {
+    m->NEXT_LATCHES.PC = m->CURRENT_LATCHES.REGS[d->sr1];
+  }
+}
+
+static void LD(lc3_machine *m, Decoded_Intruction *d){
+  int address = Low16bits(m->NEXT_LATCHES.PC + d->imm);
+
+  m->NEXT_LATCHES.REGS[d->dr] = Low16bits(read_memory(m, address));
+  Set_Condition_Code(m, d->dr);
+}
+
+static void LDI(lc3_machine *m, Decoded_Intruction *d){
+  int address = read_memory(m, m->NEXT_LATCHES.PC + d->imm);
+
+  m->NEXT_LATCHES.REGS[d->dr] = Low16bits(read_memory(m, address));
+  Set_Condition_Code(m, d->dr);
+}
+
+static void LDR(lc3_machine *m, Decoded_Intruction *d){
+  int address = Low16bits(m->CURRENT_LATCHES.REGS[d->sr1] + d->imm);
+
+  m->NEXT_LATCHES.REGS[d->dr] = Low16bits(read_memory(m, address));
+  Set_Condition_Code(m, d->dr);
+}
+
+static void LEA(lc3_machine *m, Decoded_Intruction *d){
+  m->NEXT_LATCHES.REGS[d->dr] = Low16bits(m->NEXT_LATCHES.PC + d->imm);
+  //Set_Condition_Code(dr);
+}
+
+static void NOT(lc3_machine *m, Decoded_Intruction *d){
+  m->NEXT_LATCHES.REGS[d->dr] = Low16bits(~m->CURRENT_LATCHES.REGS[d->sr1]);
+  Set_Condition_Code(m, d->dr);
+}
+
+static void ST(lc3_machine *m, Decoded_Intruction *d){
+  store_memory(m, m->NEXT_LATCHES.PC + d->imm, m->CURRENT_LATCHES.REGS[d->dr]);
+}
+
+static void STI(lc3_machine *m, Decoded_Intruction *d){
+  store_memory(m, read_memory(m, m->NEXT_LATCHES.PC + d->imm), m->CURRENT_LATCHES.REGS[d->dr]);
+}
+
+static void STR(lc3_machine *m, Decoded_Intruction *d){
+  store_memory(m, m->CURRENT_LATCHES.REGS[d->sr1] + d->imm, m->CURRENT_LATCHES.REGS[d->dr]);
+}
+
+static void TRAP(lc3_machine *m, Decoded_Intruction *d){
+  m->NEXT_LATCHES.PC = trap(m, d->imm, m->NEXT_LATCHES.REGS, m->NEXT_LATCHES.PC);
+}
+
+static void RTI(lc3_machine *m, Decoded_Intruction *d){
+  (void) d;
+  return_from_interrupt(m, &m->NEXT_LATCHES);
+}
+
+static void RESERVED(lc3_machine *m, Decoded_Intruction *d){
+  /* The reserved opcode does nothing. */
+  (void) m;
+  (void) d;
+}
+
+static void STOP_MARK(lc3_machine *m, Decoded_Intruction *d){
+  /* Stay on the marked word; engine_slice() uncounts this cycle. */
+  (void) d;
+  m->NEXT_LATCHES.PC = m->CURRENT_LATCHES.PC;
+  m->STOP = TRUE;
+}
+
+static void execute(lc3_machine *m, Decoded_Intruction *d){
+  d->handler(m, d);
+  if (m->PROFILE != NULL && d->opcode != OP_STOP)
+    profile_count(m, d);
+}
+
+/*
+ * Run one intruction decoded outside the DECODED table, for the
+ * words under an OP_STOP mark; see step_decoded().
+ */
+void execute_decoded(lc3_machine *m, Decoded_Intruction *d){
+  m->NEXT_LATCHES.PC = Low16bits(m->CURRENT_LATCHES.PC + 1);
+  execute(m, d);
+  m->CURRENT_LATCHES = m->NEXT_LATCHES;
+  m->intruction_COUNT++;
+}
+
+void decode_intruction(int intruction, Decoded_Intruction *d){
+  /*  function: decode_intruction
+   *
+   *    Split one intruction word into its fields once, so the
+   *    handlers never have to re-extract them:
+   *       -dr     DR, or SR for ST/STI/STR
+   *       -sr1    SR1, or BaseR for JMP/JSRR/LDR/STR
+   *       -imm    sign-extended imm5/offset6/PCoffset9/PCoffset11,
+   *               or the zero-extended trapvect8
+   */
+  d->intruction = intruction;
+  d->opcode = (intruction & 0xF000) >> 12;
+  d->dr = (intruction & 0x0E00) >> 9;
+  d->sr1 = (intruction & 0x01C0) >> 6;
+  d->sr2 = (intruction & 0x0007);
+  d->nzp = d->dr;
+  d->imm_flag = 0;
+  d->imm = 0;
+  d->fused = 0;
+
+  switch (d->opcode){
+  case 0b0001:
+    d->handler = ADD;
+    d->imm_flag = (intruction & 0x0020) >> 5;
+    d->imm = x_to_32(intruction & 0x001F, 5);
+    break;
+  case 0b0101:
+    d->handler = AND;
+    d->imm_flag = (intruction & 0x0020) >> 5;
+    d->imm = x_to_32(intruction & 0x001F, 5);
+    break;
+  case 0b0000:
+    d->handler = BR;
+    d->imm = x_to_32(intruction & 0x01FF, 9);
+    break;
+  case 0b1100:
+    d->handler = JMP;
+    break;
+  case 0b0100:
+    d->handler = JSR;
+    d->imm_flag = (intruction & 0x0800) >> 11;
+    d->imm = x_to_32(intruction & 0x07FF, 11);
+    break;
+  case 0b0010:
+    d->handler = LD;
+    d->imm = x_to_32(intruction & 0x01FF, 9);
+    break;
+  case 0b1010:
+    d->handler = LDI;
+    d->imm = x_to_32(intruction & 0x01FF, 9);
+    break;
+  case 0b0110:
+    d->handler = LDR;
+    d->imm = x_to_32(intruction & 0x003F, 6);
+    break;
+  case 0b1110:
+    d->handler = LEA;
+    d->imm = x_to_32(intruction & 0x01FF, 9);
+    break;
+  case 0b1001:
+    d->handler = NOT;
+    break;
+  case 0b0011:
+    d->handler = ST;
+    d->imm = x_to_32(intruction & 0x01FF, 9);
+    break;
+  case 0b1011:
+    d->handler = STI;
+    d->imm = x_to_32(intruction & 0x01FF, 9);
+    break;
+  case 0b0111:
+    d->handler = STR;
+    d->imm = x_to_32(intruction & 0x003F, 6);
+    break;
+  case 0b1111:
+    d->handler = TRAP;
+    d->imm = intruction & 0x00FF;
+    break;
+  case 0b1000:
+    d->handler = RTI;
+    break;
+  default:
+    d->handler = RESERVED;
+    break;
+  }
+  d->valid = TRUE;
+}
+
+/* The registers d reads, as a bit mask. */
+int intruction_reads(const Decoded_Intruction *d) {
+  switch (d->opcode) {
+  case 0b0001: case 0b0101:
+    return (1 << d->sr1) | (d->imm_flag ? 0 : 1 << d->sr2);
+  case 0b1001: case 0b0110: case 0b1100:
+    return 1 << d->sr1;
+  case 0b0111:
+    return (1 << d->sr1) | (1 << d->dr);
+  case 0b0011: case 0b1011:
+    return 1 << d->dr;
+  case 0b0100:
+    return d->imm_flag ? 0 : 1 << d->sr1;
+  default:
+    return 0;
+  }
+}
+
+/* Whether decode() marks d at address as OP_STOP. */
+int decode_marked(lc3_machine *m, int address, const Decoded_Intruction *d){
+  return d->opcode == 0b1000 || device_stops_at(address, d) ||
+    (m->DEBUG != NULL && debug_stops_at(m, address, d)) || loop_stops_at(m, address, d) ||
+    memo_stops_at(m, address, d) || input_stops_at(m, d);
+}
+
+void decode(lc3_machine *m, int address, int intruction, Decoded_Intruction *d){
+  decode_intruction(intruction, d);
+  if (decode_marked(m, address, d)) {
+    d->opcode = OP_STOP;
+    d->handler = STOP_MARK;
+  } else if (m->FUSE != NULL) {
+    fuse_at(m, address, d);
+  }
+}
+
+/*
+ * Drop the decode of the word at address, and of a superintruction
+ * before it that takes it in.
+ */
+void decode_drop(lc3_machine *m, int address){
+  Decoded_Intruction *d;
+  int k;
+
+  for (k = 0; k < FUSE_LENGTH_MAX; k++) {
+    d = m->DECODED[Low16bits(address - k) >> PAGE_SHIFT];
+    if (d == NULL)
+      continue;	/* nothing decoded on that page */
+    d += Low16bits(address - k) & (LC3_PAGE_WORDS - 1);
+    if (k == 0 || (d->valid && FUSE_LENGTH(d->fused) > k))
+      d->valid = FALSE;
+  }
+}
+
+/*
+ * DECODED_AT() of a page nothing has been decoded on yet: allocate
+ * it with every entry invalid. If calloc() fails, the machine's
+ * spare entry stands in, invalid each time, so words on that page
+ * are decoded afresh on every fetch.
+ */
+Decoded_Intruction *decode_page(lc3_machine *m, int address){
+  Decoded_Intruction *page = calloc(LC3_PAGE_WORDS, sizeof(Decoded_Intruction));
+
+  if (page == NULL) {
+    m->DECODE_SPARE.valid = FALSE;
+    return &m->DECODE_SPARE;
+  }
+  m->DECODED[address >> PAGE_SHIFT] = page;
+  return &page[address & (LC3_PAGE_WORDS - 1)];
+}
+
+/*
+ * Drop every decode and translation, so the OP_STOP marks are redone.
+ * Only the pages something was decoded on have entries to drop.
+ */
+void decode_reset(lc3_machine *m) {
+  int page, i;
+
+  for (page = 0; page < PAGES_IN_MEM; page++)
+    if (m->DECODED[page] != NULL)
+      for (i = 0; i < LC3_PAGE_WORDS; i++)
+        m->DECODED[page][i].valid = FALSE;
+  jit_reset(m);
+}
+
+void decode_free(lc3_machine *m) {
+  int page;
+
+  for (page = 0; page < PAGES_IN_MEM; page++) {
+    free(m->DECODED[page]);
+    m->DECODED[page] = NULL;
+  }
+}
+
+void process_intruction(lc3_machine *m){
+  /*  function: process_intruction
+   *
+   *    Process one intruction at a time
+   *       -Fetch one intruction (predecoded on first use)
+   *       -Execute
+   *       -Update NEXT_LATCHES
+   */
+  Decoded_Intruction *d = fetch(m);
+  execute(m, d);
+  m->CURRENT_LATCHES = m->NEXT_LATCHES;
+}
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Breakpoints and watchpoints                                 */
+/*                                                             */
+/*   Nothing here runs per intruction. An armed address makes  */
+/*   decode() turn its DECODED entry into OP_STOP, and every  */
+/*   engine stops in front of an OP_STOP entry as it would at */
+/*   the end of its budget; JIT blocks end before one. So the  */
+/*   engines run at full speed between the marked words, and   */
+/*   with nothing armed m->DEBUG is NULL and decode() and      */
+/*   lc3_run() go their usual way.                             */
+/*                                                             */
+/*   Watched words mark the stores that may hit them: every    */
+/*   STI and STR, whose targets are only known when they run,  */
+/*   and the ST whose target is watched. debug_run() executes  */
+/*   a marked intruction itself, checking the condition or     */
+/*   the store, and hands the rest back to the engine.         */
+/*                                                             */
+/***************************************************************/
+struct Debug_Struct {
+  unsigned char BREAK[WORDS_IN_MEM];
+  unsigned char WATCH[WORDS_IN_MEM];
+  lc3_condition CONDITION[WORDS_IN_MEM];	/* per breakpoint */
+  int BREAKS, WATCHES;	/* how many are armed */
+  lc3_stop STOP;	/* why the last run stopped */
+};
+
+static Debug *debug_get(lc3_machine *m) {
+  if (m->DEBUG == NULL)
+    m->DEBUG = calloc(1, sizeof(Debug));
+  return m->DEBUG;
+}
+
+void debug_free(lc3_machine *m) {
+  free(m->DEBUG);
+  m->DEBUG = NULL;
+}
+
+/* Breakpoints and watchpoints outlive lc3_reset(); the last stop doesn't. */
+void debug_reset(lc3_machine *m) {
+  if (m->DEBUG != NULL)
+    memset(&m->DEBUG->STOP, 0, sizeof(m->DEBUG->STOP));
+}
+
+int lc3_break(lc3_machine *m, int address, const lc3_condition *cond) {
+  Debug *g = debug_get(m);
+
+  if (g == NULL)
+    return LC3_ERR_NOMEM;
+  address = Low16bits(address);
+  if (!g->BREAK[address])
+    g->BREAKS++;
+  g->BREAK[address] = TRUE;
+  g->CONDITION[address].reg = LC3_COND_NONE;
+  if (cond != NULL)
+    g->CONDITION[address] = *cond;
+  decode_drop(m, address);
+  jit_reset(m);
+  return 0;
+}
+
+int lc3_watch(lc3_machine *m, int address) {
+  Debug *g = debug_get(m);
+
+  if (g == NULL)
+    return LC3_ERR_NOMEM;
+  address = Low16bits(address);
+  if (!g->WATCH[address])
+    g->WATCHES++;
+  g->WATCH[address] = TRUE;
+  decode_reset(m);
+  return 0;
+}
+
+void lc3_clear(lc3_machine *m, int address) {
+  Debug *g = m->DEBUG;
+
+  if (g == NULL)
+    return;
+  address = Low16bits(address);
+  if (g->BREAK[address]) {
+    g->BREAK[address] = FALSE;
+    g->BREAKS--;
+  }
+  if (g->WATCH[address]) {
+    g->WATCH[address] = FALSE;
+    g->WATCHES--;
+  }
+  if (g->BREAKS == 0 && g->WATCHES == 0)
+    debug_free(m);
+  decode_reset(m);
+}
+
+void lc3_stopped(lc3_machine *m, lc3_stop *stop) {
+  memset(stop, 0, sizeof(*stop));
+  if (m->DEBUG != NULL)
+    *stop = m->DEBUG->STOP;
+}
+
+/* The word a store at the PC will write, or -1 for other intructions. */
+int store_target(lc3_machine *m, const Decoded_Intruction *d) {
+  int next_pc = Low16bits(m->CURRENT_LATCHES.PC + 1);
+
+  switch (d->opcode) {
+  case 0b0011:
+    return Low16bits(next_pc + d->imm);
+  case 0b1011:
+    return m->MEMORY[Low16bits(next_pc + d->imm)];
+  case 0b0111:
+    return Low16bits(m->CURRENT_LATCHES.REGS[d->sr1] + d->imm);
+  default:
+    return -1;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : debug_stops_at                                  */
+/*                                                             */
+/* Purpose   : Whether decode() should mark the intruction d   */
+/*             at address as OP_STOP.                         */
+/*                                                             */
+/***************************************************************/
+int debug_stops_at(lc3_machine *m, int address, const Decoded_Intruction *d) {
+  Debug *g = m->DEBUG;
+
+  if (g->BREAK[address])
+    return TRUE;
+  if (g->WATCHES == 0)
+    return FALSE;
+  if (d->opcode == 0b1011 || d->opcode == 0b0111)
+    return TRUE;
+  return d->opcode == 0b0011 && g->WATCH[Low16bits(address + 1 + d->imm)];
+}
+
+static int condition_holds(lc3_machine *m, const lc3_condition *c) {
+  System_Latches *l = &m->CURRENT_LATCHES;
+  int a, b;
+
+  if (c->reg == LC3_COND_NONE)
+    return TRUE;
+  if (c->reg == LC3_COND_CC)
+    return ((c->value & 4) && l->N) || ((c->value & 2) && l->Z) || ((c->value & 1) && l->P);
+
+  a = x_to_32(Low16bits(l->REGS[c->reg]), 16);
+  b = x_to_32(Low16bits(c->value), 16);
+  switch (c->op) {
+  case LC3_EQ: return a == b;
+  case LC3_NE: return a != b;
+  case LC3_LT: return a < b;
+  case LC3_LE: return a <= b;
+  case LC3_GT: return a > b;
+  default:     return a >= b;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : debug_run                                       */
+/*                                                             */
+/* Purpose   : lc3_run() while anything is armed. The engine   */
+/*             runs up to the next marked intruction, which is */
+/*             then checked and executed here.                 */
+/*                                                             */
+/***************************************************************/
+int debug_run(lc3_machine *m, int num_cycles) {
+  Debug *g = m->DEBUG;
+  Decoded_Intruction d;
+  int executed = 0, n, pc, target, old_value;
+  int resume = g->STOP.reason == LC3_STOP_BREAK ? g->STOP.address : -1;
+
+  memset(&g->STOP, 0, sizeof(g->STOP));
+  while (executed < num_cycles && m->RUN_BIT) {
+    pc = m->CURRENT_LATCHES.PC;
+    decode_intruction(m->MEMORY[pc], &d);
+    if (!debug_stops_at(m, pc, &d)) {
+      n = engine_run(m, num_cycles - executed);
+      executed += n;
+      if ((n == 0 && m->CURRENT_LATCHES.PC == pc) || m->RUN_BIT == FALSE || m->WAITING)
+        break;	/* the engine stopped for its own reasons */
+      resume = -1;
+      continue;
+    }
+
+    /* The breakpoint just reported is where we carry on from. */
+    if (g->BREAK[pc] && pc != resume && condition_holds(m, &g->CONDITION[pc])) {
+      g->STOP.reason = LC3_STOP_BREAK;
+      g->STOP.address = pc;
+      break;
+    }
+    resume = -1;
+    if (input_blocks(m, &d)) {
+      m->WAITING = TRUE;
+      break;
+    }
+
+    target = store_target(m, &d);
+    old_value = target >= 0 ? m->MEMORY[target] : 0;
+    step_decoded(m, &d);
+    executed++;
+    if (target >= 0 && g->WATCH[target]) {
+      g->STOP.reason = LC3_STOP_WATCH;
+      g->STOP.address = target;
+      g->STOP.old_value = old_value;
+      g->STOP.new_value = m->MEMORY[target];
+      break;
+    }
+    if (m->WAITING)
+      break;
+  }
+  return executed;
+}
+
+/*
+ * After a step back: whether the PC is on a breakpoint that holds. If
+ * so it is reported as the last stop, and the next run executes it.
+ */
+int debug_reverse_stop(lc3_machine *m) {
+  Debug *g = m->DEBUG;
+  int pc = m->CURRENT_LATCHES.PC;
+
+  if (g == NULL || !g->BREAK[pc] || !condition_holds(m, &g->CONDITION[pc]))
+    return FALSE;
+  memset(&g->STOP, 0, sizeof(g->STOP));
+  g->STOP.reason = LC3_STOP_BREAK;
+  g->STOP.address = pc;
+  return TRUE;
+}
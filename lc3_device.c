@@ -0,0 +1,313 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Device registers                                            */
+/*                                                             */
+/*   KBSR, KBDR, DSR, DDR, TSR, TIR and MCR live in the        */
+/*   machine, not in MEMORY; every other word of the device    */
+/*   page is plain memory. Only accesses to the page at        */
+/*   DEVICE_BASE and up are intercepted: decode() marks an     */
+/*   LD/ST/LDI/STI whose PC-relative word is in the page as    */
+/*   OP_STOP, and the fast engines compare the computed        */
+/*   address of LDR/STR and the LDI/STI pointer with           */
+/*   DEVICE_BASE once, stopping in front when it is in the     */
+/*   page. engine_run() then steps that one intruction through */
+/*   the handlers of lc3_core.c, which read and write the page */
+/*   with device_read() and device_write().                    */
+/*                                                             */
+/*   Keyboard input comes from a ring filled by an I/O thread, */
+/*   so a program polling KBSR keeps running while the host    */
+/*   waits for a key. The thread only reads the console when a */
+/*   poll finds the ring empty: input nobody asked for stays   */
+/*   with the host, for GETC or the shell. With KBSR[14] set   */
+/*   the polls come from EVENT_KEYBOARD instead. A queued      */
+/*   console (lc3_console_queue()) needs no thread: polls take */
+/*   from the queue, and a KBSR read finding it empty ends the */
+/*   run so the host can wait instead of the program.          */
+/*                                                             */
+/*   The timer sets TSR[15] every TIR intructions, through     */
+/*   EVENT_TIMER; reading TSR clears it.                       */
+/*                                                             */
+/***************************************************************/
+#define KEYBOARD_RING 256	/* a power of two */
+
+struct Keyboard_Struct {
+  pthread_t THREAD;
+  pthread_mutex_t LOCK;
+  pthread_cond_t WAKE;	/* the thread has something to do */
+  pthread_cond_t READY;	/* a character came in, or end of input */
+  FILE *INPUT;
+
+  /* Everything below is guarded by LOCK. */
+  unsigned char RING[KEYBOARD_RING];
+  unsigned HEAD, TAIL;	/* read and write counts */
+  int WANTED;		/* the machine is waiting for a character */
+  int READING;		/* the thread is inside getc() */
+  int AT_EOF, QUIT;
+};
+
+static void keyboard_destroy(Keyboard *k) {
+  pthread_cond_destroy(&k->READY);
+  pthread_cond_destroy(&k->WAKE);
+  pthread_mutex_destroy(&k->LOCK);
+  free(k);
+}
+
+static void *keyboard_thread(void *arg) {
+  Keyboard *k = arg;
+  int c;
+
+  pthread_mutex_lock(&k->LOCK);
+  for (;;) {
+    while (!k->QUIT && (!k->WANTED || k->AT_EOF || k->TAIL - k->HEAD == KEYBOARD_RING))
+      pthread_cond_wait(&k->WAKE, &k->LOCK);
+    if (k->QUIT)
+      break;
+
+    k->READING = TRUE;
+    pthread_mutex_unlock(&k->LOCK);
+    c = getc(k->INPUT);
+    pthread_mutex_lock(&k->LOCK);
+    k->READING = FALSE;
+
+    if (k->QUIT) {
+      /* keyboard_free() left us to clean up after ourselves. */
+      pthread_mutex_unlock(&k->LOCK);
+      keyboard_destroy(k);
+      return NULL;
+    }
+    if (c == EOF)
+      k->AT_EOF = TRUE;
+    else
+      k->RING[k->TAIL++ % KEYBOARD_RING] = (unsigned char) c;
+    k->WANTED = FALSE;
+    pthread_cond_broadcast(&k->READY);
+  }
+  pthread_mutex_unlock(&k->LOCK);
+  return NULL;
+}
+
+static Keyboard *keyboard_get(lc3_machine *m) {
+  Keyboard *k;
+
+  if (m->KEYBOARD != NULL || m->CONSOLE_IN == NULL)
+    return m->KEYBOARD;
+  if ((k = calloc(1, sizeof(Keyboard))) == NULL)
+    return NULL;
+  k->INPUT = m->CONSOLE_IN;
+  pthread_mutex_init(&k->LOCK, NULL);
+  pthread_cond_init(&k->WAKE, NULL);
+  pthread_cond_init(&k->READY, NULL);
+  if (pthread_create(&k->THREAD, NULL, keyboard_thread, k) != 0) {
+    keyboard_destroy(k);
+    return NULL;
+  }
+  m->KEYBOARD = k;
+  return k;
+}
+
+/*
+ * Stop the I/O thread. One blocked in getc() can't be joined; it is
+ * detached and frees the keyboard itself once its read returns.
+ */
+void keyboard_free(lc3_machine *m) {
+  Keyboard *k = m->KEYBOARD;
+  int reading;
+
+  if (k == NULL)
+    return;
+  m->KEYBOARD = NULL;
+  pthread_mutex_lock(&k->LOCK);
+  k->QUIT = TRUE;
+  reading = k->READING;
+  pthread_cond_signal(&k->WAKE);
+  pthread_mutex_unlock(&k->LOCK);
+
+  if (reading) {
+    pthread_detach(k->THREAD);
+    return;
+  }
+  pthread_join(k->THREAD, NULL);
+  keyboard_destroy(k);
+}
+
+/* The next character from the ring, or -1 when it is empty. */
+static int keyboard_take(Keyboard *k) {
+  if (k->TAIL == k->HEAD)
+    return -1;
+  return k->RING[k->HEAD++ % KEYBOARD_RING];
+}
+
+/*
+ * A KBSR read or keyboard event with no character latched: latch one
+ * from the ring if there is one, otherwise ask the thread for it and
+ * carry on.
+ */
+static void keyboard_latch(lc3_machine *m, int c) {
+  m->KBDR = c;
+  m->KBSR |= 0x8000;
+  if (m->KBSR & 0x4000)
+    event_schedule(m, EVENT_INTERRUPT, m->intruction_COUNT);
+}
+
+void keyboard_poll(lc3_machine *m) {
+  Keyboard *k;
+  int c;
+
+  if (m->INPUT != NULL) {
+    if ((c = input_take(m)) >= 0)
+      keyboard_latch(m, c);
+    return;
+  }
+  if ((k = keyboard_get(m)) == NULL)
+    return;
+  pthread_mutex_lock(&k->LOCK);
+  if ((c = keyboard_take(k)) >= 0)
+    keyboard_latch(m, c);
+  else if (!k->WANTED && !k->AT_EOF) {
+    lc3_console_flush(m);	/* show any prompt first */
+    k->WANTED = TRUE;
+    pthread_cond_signal(&k->WAKE);
+  }
+  pthread_mutex_unlock(&k->LOCK);
+}
+
+/*
+ * GETC and IN once a program has polled the keyboard: a character
+ * already latched in KBDR goes first, then the ring, waiting for the
+ * thread if need be. Returns 0 at end of input.
+ */
+int keyboard_getc(lc3_machine *m) {
+  Keyboard *k = m->KEYBOARD;
+  int c;
+
+  if (m->KBSR & 0x8000) {
+    m->KBSR &= ~0x8000;
+    return m->KBDR;
+  }
+  pthread_mutex_lock(&k->LOCK);
+  while ((c = keyboard_take(k)) < 0 && !k->AT_EOF) {
+    k->WANTED = TRUE;
+    pthread_cond_signal(&k->WAKE);
+    pthread_cond_wait(&k->READY, &k->LOCK);
+  }
+  pthread_mutex_unlock(&k->LOCK);
+  return c < 0 ? 0 : c;
+}
+
+/* Registers back to their power-on values; the keyboard stays. */
+void device_reset(lc3_machine *m) {
+  m->KBSR = m->KBDR = m->DSR = m->MCR = m->TSR = m->TIR = m->TIMER_START = 0;
+}
+
+int device_read(lc3_machine *m, int address) {
+  int value;
+
+  switch (address) {
+  case DEVICE_KBSR:
+    if (!(m->KBSR & 0x8000))
+      keyboard_poll(m);
+    if (lc3_console_starved(m))
+      m->WAITING = TRUE;	/* lc3_run() returns after this read */
+    return m->KBSR;
+  case DEVICE_KBDR:
+    value = m->KBDR;
+    m->KBSR &= ~0x8000;
+    return value;
+  case DEVICE_DSR:
+    return 0x8000 | m->DSR;	/* output never has to wait */
+  case DEVICE_DDR:
+    return 0;
+  case DEVICE_TSR:
+    value = m->TSR;
+    m->TSR &= ~0x8000;
+    return value;
+  case DEVICE_TIR:
+    return m->TIR;
+  case DEVICE_MCR:
+    return (m->RUN_BIT ? 0x8000 : 0) | m->MCR;
+  default:
+    return m->MEMORY[address];
+  }
+}
+
+void device_write(lc3_machine *m, int address, int value) {
+  switch (address) {
+  case DEVICE_KBSR:
+    m->KBSR = (m->KBSR & 0x8000) | (value & 0x4000);
+    if (m->KBSR & 0x4000)
+      event_schedule(m, EVENT_KEYBOARD, m->intruction_COUNT);
+    else
+      event_cancel(m, EVENT_KEYBOARD);
+    break;
+  case DEVICE_KBDR:
+    break;
+  case DEVICE_DSR:
+    m->DSR = value & 0x4000;
+    break;
+  case DEVICE_DDR:
+    console_put(m, value & 0xFF);
+    break;
+  case DEVICE_TSR:
+    m->TSR = (m->TSR & 0x8000) | (value & 0x4000);
+    event_schedule(m, EVENT_INTERRUPT, m->intruction_COUNT);
+    break;
+  case DEVICE_TIR:
+    m->TIR = Low16bits(value);
+    m->TIMER_START = m->intruction_COUNT;
+    if (m->TIR != 0)
+      event_schedule(m, EVENT_TIMER, m->intruction_COUNT + m->TIR);
+    else
+      event_cancel(m, EVENT_TIMER);
+    break;
+  case DEVICE_MCR:
+    m->MCR = value & 0x7FFF;
+    if (!(value & 0x8000))
+      m->RUN_BIT = FALSE;	/* clock disabled */
+    break;
+  default:
+    write_memory(m, address, value);
+    break;
+  }
+}
+
+int is_device_register(int address) {
+  switch (address) {
+  case DEVICE_KBSR: case DEVICE_KBDR: case DEVICE_DSR: case DEVICE_DDR:
+  case DEVICE_TSR: case DEVICE_TIR: case DEVICE_MCR:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+/* Whether decode() should mark d at address: its PC-relative word is in the page. */
+int device_stops_at(int address, const Decoded_Intruction *d) {
+  switch (d->opcode) {
+  case 0b0010: case 0b0011: case 0b1010: case 0b1011:
+    return IS_DEVICE(Low16bits(address + 1 + d->imm));
+  default:
+    return FALSE;
+  }
+}
+
+/* Whether d, about to run at the PC, reads or writes the device page. */
+int device_access(lc3_machine *m, const Decoded_Intruction *d) {
+  int next_pc = Low16bits(m->CURRENT_LATCHES.PC + 1);
+  int address = Low16bits(next_pc + d->imm);
+
+  switch (d->opcode) {
+  case 0b0010: case 0b0011:
+    return IS_DEVICE(address);
+  case 0b1010: case 0b1011:
+    return IS_DEVICE(address) || IS_DEVICE(m->MEMORY[address]);
+  case 0b0110: case 0b0111:
+    return IS_DEVICE(Low16bits(m->CURRENT_LATCHES.REGS[d->sr1] + d->imm));
+  default:
+    return FALSE;
+  }
+}
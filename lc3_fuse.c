@@ -0,0 +1,359 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Superintructions                                            */
+/*                                                             */
+/*   fuse_scan() walks the control flow of what is loaded,     */
+/*   from the PC and every trap and interrupt vector set,      */
+/*   through fall-throughs and BR/JSR/TRAP targets; JMP, RTI   */
+/*   and HALT end a path. The words it reaches are CODE, and   */
+/*   it counts the opcode pairs and triples inside their       */
+/*   blocks for the report.                                    */
+/*                                                             */
+/*   decode() of a CODE word then looks at the words after it  */
+/*   for one of these, none of them under an OP_STOP mark:     */
+/*                                                             */
+/*   - ADD, BR                 the countdown closing a loop    */
+/*   - LDR, ADD                a load and use                  */
+/*   - AND R, Rx, #0, ADD R, R, #imm      a constant load      */
+/*   - LDR, ADD, BR            a load, test and branch         */
+/*                                                             */
+/*   and sets fused in the entry, keeping the later words'     */
+/*   decodes in TAIL. Only the switch engine acts on it, with  */
+/*   fuse_run() in place of cycle() per intruction: a fused    */
+/*   entry runs all its words in one dispatch, straight into   */
+/*   CURRENT_LATCHES, setting the condition codes after each   */
+/*   as the words would and counting each. Other engines run   */
+/*   it as its first word alone. A store to any word of one    */
+/*   drops it (decode_drop()); the re-decode fuses what is     */
+/*   there now. Build with -DNO_FUSE to never fuse.            */
+/*                                                             */
+/***************************************************************/
+
+struct Fuse_Struct {
+  unsigned char CODE[WORDS_IN_MEM];	/* reached by the walk */
+  unsigned char LEADER[WORDS_IN_MEM];	/* starts a block */
+  Decoded_Intruction (*TAIL)[FUSE_LENGTH_MAX - 1];	/* words after a fused one */
+  lc3_fuse_stats STATS;
+};
+
+#define F_SETCC(l, value) do {			\
+    int v_ = (value);				\
+    (l)->N = (v_ & 0x8000) != 0;		\
+    (l)->Z = v_ == 0;				\
+    (l)->P = !(l)->N && !(l)->Z;		\
+  } while (0)
+
+/* Whether control can leave d other than to the next word. */
+static int ends_block(const Decoded_Intruction *d) {
+  switch (d->opcode) {
+  case 0b0000:
+    return d->nzp != 0;
+  case 0b0100: case 0b1100: case 0b1000: case 0b1111:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : fuse_walk                                       */
+/*                                                             */
+/* Purpose   : Mark CODE and LEADER for every word reachable   */
+/*             from root.                                      */
+/*                                                             */
+/***************************************************************/
+static void fuse_walk(lc3_machine *m, int root, int *stack) {
+  Fuse *f = m->FUSE;
+  Decoded_Intruction d;
+  int depth = 0, address, target;
+
+  if (IS_DEVICE(root))
+    return;
+  f->LEADER[root] = TRUE;
+  stack[depth++] = root;
+  while (depth > 0) {
+    address = stack[--depth];
+    while (!IS_DEVICE(address) && !f->CODE[address]) {
+      f->CODE[address] = TRUE;
+      decode_intruction(m->MEMORY[address], &d);
+      target = -1;
+      if ((d.opcode == 0b0000 && d.nzp != 0) || (d.opcode == 0b0100 && d.imm_flag))
+        target = Low16bits(address + 1 + d.imm);
+      else if (d.opcode == 0b1111 && m->MEMORY[d.imm] != 0)
+        target = m->MEMORY[d.imm];	/* a routine loaded over the vector */
+      if (target >= 0 && !IS_DEVICE(target)) {
+        f->LEADER[target] = TRUE;
+        if (!f->CODE[target])
+          stack[depth++] = target;
+      }
+
+      if ((d.opcode == 0b0000 && d.nzp == 7) || d.opcode == 0b1100 || d.opcode == 0b1000 ||
+          (d.opcode == 0b1111 && d.imm == TRAP_HALT))
+        break;	/* nothing falls through */
+      if (ends_block(&d))
+        f->LEADER[Low16bits(address + 1)] = TRUE;
+      address = Low16bits(address + 1);
+    }
+  }
+}
+
+/* Keep (count, opcodes) among the LC3_FUSE_TOP biggest. */
+static void fuse_top(int top[][4], int count, int a, int b, int c) {
+  int i, k;
+
+  for (i = 0; i < LC3_FUSE_TOP && top[i][0] >= count; i++)
+    ;
+  if (i == LC3_FUSE_TOP)
+    return;
+  for (k = LC3_FUSE_TOP - 1; k > i; k--)
+    memcpy(top[k], top[k - 1], sizeof(top[k]));
+  top[i][0] = count;
+  top[i][1] = a;
+  top[i][2] = b;
+  top[i][3] = c;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : fuse_scan                                       */
+/*                                                             */
+/* Purpose   : Walk what is loaded now, count its pairs and    */
+/*             triples, and have every word decoded again so   */
+/*             the sites get fused.                            */
+/*                                                             */
+/***************************************************************/
+void fuse_scan(lc3_machine *m) {
+  Fuse *f = m->FUSE;
+  static int pairs[16][16], triples[16][16][16];
+  int *stack, top[LC3_FUSE_TOP][4], a, b, c, i, vector;
+  Decoded_Intruction d;
+
+  if ((stack = malloc(WORDS_IN_MEM * sizeof(int))) == NULL)
+    return;	/* nothing gets fused */
+  memset(f->CODE, 0, sizeof(f->CODE));
+  memset(f->LEADER, 0, sizeof(f->LEADER));
+  fuse_walk(m, m->CURRENT_LATCHES.PC, stack);
+  for (vector = TRAP_GETC; vector <= TRAP_HALT; vector++)
+    if (m->MEMORY[vector] != 0)
+      fuse_walk(m, m->MEMORY[vector], stack);
+  for (vector = 0x0100; vector < 0x0200; vector++)
+    if (m->MEMORY[vector] != 0)
+      fuse_walk(m, m->MEMORY[vector], stack);
+  free(stack);
+
+  memset(pairs, 0, sizeof(pairs));
+  memset(triples, 0, sizeof(triples));
+  memset(&f->STATS, 0, sizeof(f->STATS));
+  for (i = 0; i < WORDS_IN_MEM; i++) {
+    if (!f->CODE[i])
+      continue;
+    f->STATS.code_words++;
+    f->STATS.blocks += f->LEADER[i];
+    decode_intruction(m->MEMORY[i], &d);
+    if (i + 1 >= WORDS_IN_MEM || !f->CODE[i + 1] || f->LEADER[i + 1] || ends_block(&d))
+      continue;
+    a = d.opcode;
+    b = m->MEMORY[i + 1] >> 12;
+    pairs[a][b]++;
+    decode_intruction(m->MEMORY[i + 1], &d);
+    if (i + 2 >= WORDS_IN_MEM || !f->CODE[i + 2] || f->LEADER[i + 2] || ends_block(&d))
+      continue;
+    triples[a][b][m->MEMORY[i + 2] >> 12]++;
+  }
+
+  memset(top, 0, sizeof(top));
+  for (a = 0; a < 16; a++)
+    for (b = 0; b < 16; b++)
+      if (pairs[a][b] > 0)
+        fuse_top(top, pairs[a][b], a, b, -1);
+  memcpy(f->STATS.pairs, top, sizeof(top));
+  memset(top, 0, sizeof(top));
+  for (a = 0; a < 16; a++)
+    for (b = 0; b < 16; b++)
+      for (c = 0; c < 16; c++)
+        if (triples[a][b][c] > 0)
+          fuse_top(top, triples[a][b][c], a, b, c);
+  memcpy(f->STATS.triples, top, sizeof(top));
+
+  decode_reset(m);
+  for (i = 0; i < WORDS_IN_MEM; i++)
+    if (f->CODE[i]) {
+      decode(m, i, m->MEMORY[i], &d);	/* DECODED fills in as it runs */
+      if (d.fused)
+        f->STATS.sites[d.fused]++;
+    }
+}
+
+#ifndef NO_FUSE
+/* Decode the code word at address; FALSE if it isn't one or is marked. */
+static int fuse_next(lc3_machine *m, int address, Decoded_Intruction *d) {
+  if (address >= WORDS_IN_MEM || !m->FUSE->CODE[address])
+    return FALSE;
+  decode_intruction(m->MEMORY[address], d);
+  return !decode_marked(m, address, d);
+}
+#endif
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : fuse_at                                         */
+/*                                                             */
+/* Purpose   : From decode(): fuse d at address with the words */
+/*             after it if they make one of the patterns.      */
+/*                                                             */
+/***************************************************************/
+void fuse_at(lc3_machine *m, int address, Decoded_Intruction *d) {
+#ifndef NO_FUSE
+  Fuse *f = m->FUSE;
+  Decoded_Intruction t[FUSE_LENGTH_MAX - 1];
+  int kind = 0;
+
+  if (!f->CODE[address] || !fuse_next(m, address + 1, &t[0]))
+    return;
+  switch (d->opcode) {
+  case 0b0001:
+    if (t[0].opcode == 0b0000)
+      kind = LC3_FUSE_ADD_BR;
+    break;
+  case 0b0110:
+    if (t[0].opcode != 0b0001)
+      break;
+    kind = LC3_FUSE_LDR_ADD;
+    if (fuse_next(m, address + 2, &t[1]) && t[1].opcode == 0b0000)
+      kind = LC3_FUSE_LDR_ADD_BR;
+    break;
+  case 0b0101:
+    if (d->imm_flag && d->imm == 0 && t[0].opcode == 0b0001 && t[0].imm_flag &&
+        t[0].dr == d->dr && t[0].sr1 == d->dr)
+      kind = LC3_FUSE_CONST;
+    break;
+  default:
+    break;
+  }
+  if (kind == 0)
+    return;
+
+  if (f->TAIL == NULL &&
+      (f->TAIL = calloc(WORDS_IN_MEM, sizeof(f->TAIL[0]))) == NULL)
+    return;
+  memcpy(f->TAIL[address], t, sizeof(t));
+  d->fused = kind;
+#endif
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : fuse_run                                        */
+/*                                                             */
+/* Purpose   : The switch engine while fusing: cycle() per     */
+/*             intruction, except that a fused entry with room */
+/*             for all its words before budget and NEXT_EVENT  */
+/*             runs them in one go.                            */
+/*                                                             */
+/***************************************************************/
+int fuse_run(lc3_machine *m, int num_cycles) {
+  System_Latches *l = &m->CURRENT_LATCHES;
+  Fuse *f = m->FUSE;
+  Decoded_Intruction *d, *t;
+  int executed = 0, pc, length, address;
+
+  while (executed < num_cycles && m->RUN_BIT && !m->WAITING &&
+         m->intruction_COUNT < m->NEXT_EVENT) {
+    pc = l->PC;
+    d = DECODED_AT(m, pc);
+    if (!d->valid)
+      decode(m, pc, m->MEMORY[pc], d);
+    if (d->opcode == OP_STOP)
+      break;
+    length = FUSE_LENGTH(d->fused);
+    if (d->fused == 0 || executed + length > num_cycles ||
+        m->intruction_COUNT + length > m->NEXT_EVENT) {
+      cycle(m);
+      executed++;
+      continue;
+    }
+
+    t = f->TAIL[pc];
+    switch (d->fused) {
+    case LC3_FUSE_ADD_BR:
+      l->REGS[d->dr] = Low16bits(l->REGS[d->sr1] + (d->imm_flag ? d->imm : l->REGS[d->sr2]));
+      F_SETCC(l, l->REGS[d->dr]);
+      l->PC = Low16bits(pc + 2);
+      if ((t[0].nzp & 4 && l->N) || (t[0].nzp & 2 && l->Z) || (t[0].nzp & 1 && l->P))
+        l->PC = Low16bits(l->PC + t[0].imm);
+      break;
+    case LC3_FUSE_CONST:
+      l->REGS[d->dr] = Low16bits(t[0].imm);
+      F_SETCC(l, l->REGS[d->dr]);
+      l->PC = Low16bits(pc + 2);
+      break;
+    default:	/* LDR, ADD and maybe BR */
+      address = Low16bits(l->REGS[d->sr1] + d->imm);
+      if (IS_DEVICE(address)) {
+        cycle(m);	/* the read may end the run after it */
+        executed++;
+        continue;
+      }
+      l->REGS[d->dr] = m->MEMORY[address];
+      l->REGS[t[0].dr] = Low16bits(l->REGS[t[0].sr1] +
+                                   (t[0].imm_flag ? t[0].imm : l->REGS[t[0].sr2]));
+      F_SETCC(l, l->REGS[t[0].dr]);
+      l->PC = Low16bits(pc + length);
+      if (d->fused == LC3_FUSE_LDR_ADD_BR &&
+          ((t[1].nzp & 4 && l->N) || (t[1].nzp & 2 && l->Z) || (t[1].nzp & 1 && l->P)))
+        l->PC = Low16bits(l->PC + t[1].imm);
+      break;
+    }
+    m->NEXT_LATCHES = *l;
+    m->intruction_COUNT += length;
+    executed += length;
+    f->STATS.runs[d->fused]++;
+  }
+  return executed;
+}
+
+void fuse_reset(lc3_machine *m) {
+  Fuse *f = m->FUSE;
+
+  if (f == NULL)
+    return;
+  memset(f->CODE, 0, sizeof(f->CODE));
+  memset(&f->STATS, 0, sizeof(f->STATS));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_fuse                                        */
+/*                                                             */
+/* Purpose   : Start fusing, with a walk over what is loaded   */
+/*             now, or stop.                                   */
+/*                                                             */
+/***************************************************************/
+int lc3_fuse(lc3_machine *m, int on) {
+  if (m->FUSE != NULL) {
+    free(m->FUSE->TAIL);
+    free(m->FUSE);
+    m->FUSE = NULL;
+    decode_reset(m);
+  }
+  if (!on)
+    return 0;
+
+  if ((m->FUSE = calloc(1, sizeof(Fuse))) == NULL)
+    return LC3_ERR_NOMEM;
+  fuse_scan(m);
+  return 0;
+}
+
+int lc3_fuse_report(lc3_machine *m, lc3_fuse_stats *stats) {
+  if (m->FUSE == NULL)
+    return -1;
+  *stats = m->FUSE->STATS;
+  return 0;
+}
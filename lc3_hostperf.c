@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#define HOST_PERF_EVENTS
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HOST_TSC
+#endif
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Host counters                                               */
+/*                                                             */
+/*   What the simulator costs the host, measured around it     */
+/*   rather than inside it. lc3_run() reads the counters on    */
+/*   the way in and out for the totals. For the split by       */
+/*   opcode EVENT_SAMPLE comes due every PERIOD intructions on */
+/*   average, and engine_run() then runs one intruction        */
+/*   through the machine's own engine between two more reads,  */
+/*   charging the difference to its opcode. BASE, the least    */
+/*   two reads back to back ever cost, comes off each sample.  */
+/*                                                             */
+/*   The counters are a perf_event_open() group counting user  */
+/*   space only, so the read() in between adds little of its   */
+/*   own. Where the kernel won't give us the cycle counter we  */
+/*   fall back to the time stamp counter, or failing that to   */
+/*   CLOCK_MONOTONIC nanoseconds, in the cycles slot alone.    */
+/*                                                             */
+/***************************************************************/
+
+#define CALIBRATE_ROUNDS 256
+
+struct Hostperf_Struct {
+  int FD[LC3_HOST_COUNTERS];	/* perf events, the cycles leader first, or -1 */
+  int SLOT[LC3_HOST_COUNTERS];	/* place of each in a group read, or -1 */
+  int PERIOD;		/* mean intructions between samples */
+  unsigned RANDOM;	/* xorshift state spacing them */
+  int DUE;			/* EVENT_SAMPLE fired, the next intruction is measured */
+  unsigned long long BASE[LC3_HOST_COUNTERS];
+  unsigned long long START[LC3_HOST_COUNTERS];	/* at the start of lc3_run() */
+  long long START_COUNT;
+  lc3_hostperf_stats STATS;
+};
+
+#ifdef HOST_PERF_EVENTS
+static int perf_open(int counter, int leader) {
+  static const unsigned long long configs[LC3_HOST_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+  };
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = configs[counter];
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+#endif
+
+/* Open what counters we can and note where the readings come from. */
+static void host_open(Hostperf *h) {
+  int k;
+
+  for (k = 0; k < LC3_HOST_COUNTERS; k++)
+    h->FD[k] = h->SLOT[k] = -1;
+#ifdef HOST_PERF_EVENTS
+  if ((h->FD[0] = perf_open(LC3_HOST_CYCLES, -1)) >= 0) {
+    int slots = 1;
+
+    h->STATS.source = LC3_HOST_PERF;
+    h->SLOT[0] = 0;
+    h->STATS.have = 1 << LC3_HOST_CYCLES;
+    for (k = 1; k < LC3_HOST_COUNTERS; k++)
+      if ((h->FD[k] = perf_open(k, h->FD[0])) >= 0) {
+        h->SLOT[k] = slots++;
+        h->STATS.have |= 1 << k;
+      }
+    return;
+  }
+#endif
+#ifdef HOST_TSC
+  h->STATS.source = LC3_HOST_TSC;
+#else
+  h->STATS.source = LC3_HOST_CLOCK;
+#endif
+  h->STATS.have = 1 << LC3_HOST_CYCLES;
+}
+
+static void host_close(Hostperf *h) {
+  int k;
+
+  for (k = LC3_HOST_COUNTERS - 1; k >= 0; k--)
+    if (h->FD[k] >= 0)
+      close(h->FD[k]);
+}
+
+static void host_read(Hostperf *h, unsigned long long value[]) {
+#ifdef HOST_PERF_EVENTS
+  unsigned long long group[1 + LC3_HOST_COUNTERS];
+  int k;
+
+  if (h->STATS.source == LC3_HOST_PERF) {
+    if (read(h->FD[0], group, sizeof(group)) <= 0)
+      memset(group, 0, sizeof(group));
+    for (k = 0; k < LC3_HOST_COUNTERS; k++)
+      value[k] = h->SLOT[k] >= 0 ? group[1 + h->SLOT[k]] : 0;
+    return;
+  }
+#endif
+  (void) h;	/* only the perf counters are read through it */
+  memset(value, 0, LC3_HOST_COUNTERS * sizeof(value[0]));
+#ifdef HOST_TSC
+  value[LC3_HOST_CYCLES] = __rdtsc();
+#else
+  {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    value[LC3_HOST_CYCLES] = now.tv_sec * 1000000000ULL + now.tv_nsec;
+  }
+#endif
+}
+
+/* The least each counter moves between two reads with nothing in between. */
+static void host_calibrate(Hostperf *h) {
+  unsigned long long a[LC3_HOST_COUNTERS], b[LC3_HOST_COUNTERS];
+  int i, k;
+
+  for (k = 0; k < LC3_HOST_COUNTERS; k++)
+    h->BASE[k] = ~0ULL;
+  for (i = 0; i < CALIBRATE_ROUNDS; i++) {
+    host_read(h, a);
+    host_read(h, b);
+    for (k = 0; k < LC3_HOST_COUNTERS; k++)
+      if (b[k] - a[k] < h->BASE[k])
+        h->BASE[k] = b[k] - a[k];
+  }
+}
+
+/* lc3_run() is starting: note where the counters stand. */
+void hostperf_begin(lc3_machine *m) {
+  Hostperf *h = m->HOSTPERF;
+
+  h->START_COUNT = m->intruction_COUNT;
+  host_read(h, h->START);
+}
+
+/* lc3_run() is done: add what it cost to the totals. */
+void hostperf_end(lc3_machine *m) {
+  Hostperf *h = m->HOSTPERF;
+  unsigned long long now[LC3_HOST_COUNTERS];
+  int k;
+
+  host_read(h, now);
+  for (k = 0; k < LC3_HOST_COUNTERS; k++)
+    h->STATS.total[k] += now[k] - h->START[k];
+  h->STATS.intructions += m->intruction_COUNT - h->START_COUNT;
+}
+
+/*
+ * The next EVENT_SAMPLE, 1 to 2 PERIOD - 1 intructions on, so a loop
+ * whose length divides PERIOD isn't always caught at the same place.
+ */
+static void host_schedule(lc3_machine *m) {
+  Hostperf *h = m->HOSTPERF;
+
+  h->RANDOM ^= h->RANDOM << 13;
+  h->RANDOM ^= h->RANDOM >> 17;
+  h->RANDOM ^= h->RANDOM << 5;
+  event_schedule(m, EVENT_SAMPLE, m->intruction_COUNT + 1 + h->RANDOM % (2 * h->PERIOD - 1));
+}
+
+/* EVENT_SAMPLE: measure the next intruction, and pick the next one. */
+void hostperf_fire(lc3_machine *m) {
+  m->HOSTPERF->DUE = TRUE;
+  host_schedule(m);
+}
+
+int hostperf_due(lc3_machine *m) {
+  return m->HOSTPERF->DUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : hostperf_sample                                 */
+/*                                                             */
+/* Purpose   : Run one intruction with slice(), reading the    */
+/*             counters on either side, and charge it to its   */
+/*             opcode. Returns what slice() did, which is 0    */
+/*             and charges nothing in front of an OP_STOP.     */
+/*                                                             */
+/***************************************************************/
+int hostperf_sample(lc3_machine *m, int (*slice)(lc3_machine *m, int budget)) {
+  Hostperf *h = m->HOSTPERF;
+  unsigned long long before[LC3_HOST_COUNTERS], after[LC3_HOST_COUNTERS], cost;
+  int opcode = m->MEMORY[m->CURRENT_LATCHES.PC] >> 12, n, k;
+
+  h->DUE = FALSE;
+  host_read(h, before);
+  n = slice(m, 1);
+  host_read(h, after);
+  if (n == 0)
+    return 0;
+
+  for (k = 0; k < LC3_HOST_COUNTERS; k++) {
+    cost = after[k] - before[k];
+    cost = cost > h->BASE[k] ? cost - h->BASE[k] : 0;
+    h->STATS.sampled[opcode][k] += cost;
+    if (h->STATS.samples[opcode] == 0 || cost < h->STATS.least[opcode][k])
+      h->STATS.least[opcode][k] = cost;
+  }
+  h->STATS.samples[opcode]++;
+  return n;
+}
+
+void hostperf_reset(lc3_machine *m) {
+  Hostperf *h = m->HOSTPERF;
+
+  if (h == NULL)
+    return;
+  h->DUE = FALSE;
+  h->RANDOM = 2463534242U;
+  host_schedule(m);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_hostperf                                    */
+/*                                                             */
+/* Purpose   : Start counting afresh, sampling every period    */
+/*             intructions, or stop for a period of 0.         */
+/*                                                             */
+/***************************************************************/
+int lc3_hostperf(lc3_machine *m, int period) {
+  Hostperf *h;
+
+  if (period < 0)
+    return LC3_ERR_FORMAT;
+  if (m->HOSTPERF != NULL) {
+    host_close(m->HOSTPERF);
+    free(m->HOSTPERF);
+    m->HOSTPERF = NULL;
+    event_cancel(m, EVENT_SAMPLE);
+  }
+  if (period == 0)
+    return 0;
+
+  if ((h = calloc(1, sizeof(Hostperf))) == NULL)
+    return LC3_ERR_NOMEM;
+  h->PERIOD = period;
+  host_open(h);
+  host_calibrate(h);
+  m->HOSTPERF = h;
+  hostperf_reset(m);
+  return 0;
+}
+
+void lc3_hostperf_clear(lc3_machine *m) {
+  Hostperf *h = m->HOSTPERF;
+  int source, have;
+
+  if (h == NULL)
+    return;
+  source = h->STATS.source;
+  have = h->STATS.have;
+  memset(&h->STATS, 0, sizeof(h->STATS));
+  h->STATS.source = source;
+  h->STATS.have = have;
+}
+
+int lc3_hostperf_report(lc3_machine *m, lc3_hostperf_stats *stats) {
+  if (m->HOSTPERF == NULL)
+    return -1;
+  *stats = m->HOSTPERF->STATS;
+  return 0;
+}
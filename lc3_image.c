@@ -0,0 +1,243 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Binary program images                                       */
+/*                                                             */
+/*   The same content as a set of hex files, ready to copy     */
+/*   into memory. Everything is little-endian:                 */
+/*                                                             */
+/*     header   "LC3B", u16 version, u16 segments,             */
+/*              u32 entry PC, u32 checksum                     */
+/*     table    per segment: u32 origin, u32 words, u32 offset */
+/*     data     each segment's words at its file offset        */
+/*                                                             */
+/*   The checksum is FNV-1a over every byte after the header.  */
+/*   Segments are loaded in table order, like hex files given  */
+/*   in that order, and the entry PC is the first origin.      */
+/*                                                             */
+/***************************************************************/
+
+#define IMAGE_MAGIC    "LC3B"
+#define IMAGE_VERSION  1
+#define IMAGE_HEADER   16
+#define IMAGE_SEGMENT  12
+
+typedef struct Image_Segment_Struct {
+  int origin;
+  int words;
+  uint16_t *data;
+} Image_Segment;
+
+static unsigned int image_checksum(const unsigned char *bytes, size_t length) {
+  unsigned int hash = 0x811c9dc5;
+  size_t i;
+
+  for (i = 0; i < length; i++)
+    hash = (hash ^ bytes[i]) * 0x01000193;
+  return hash;
+}
+
+static void put16(unsigned char *p, unsigned int v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(unsigned char *p, unsigned int v) {
+  put16(p, v & 0xFFFF);
+  put16(p + 2, v >> 16);
+}
+
+static unsigned int get16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned int get32(const unsigned char *p) {
+  return get16(p) | (get16(p + 2) << 16);
+}
+
+int is_image(const char *filename) {
+  unsigned char magic[4];
+  FILE *f = fopen(filename, "rb");
+  int is_image;
+
+  if (f == NULL)
+    return FALSE;
+  is_image = fread(magic, 1, 4, f) == 4 && memcmp(magic, IMAGE_MAGIC, 4) == 0;
+  fclose(f);
+  return is_image;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_image_convert                               */
+/*                                                             */
+/* Purpose   : Read hex files with lc3_load() on a scratch     */
+/*             machine, so they parse exactly as they would    */
+/*             when run, and write them out as one image.      */
+/*             Images are not accepted as input.               */
+/*                                                             */
+/***************************************************************/
+int lc3_image_convert(char *const hex_files[], int count, const char *image_filename) {
+  lc3_machine *m = lc3_create(LC3_ENGINE_SWITCH);
+  Image_Segment *segments = calloc(count > 0 ? count : 1, sizeof(Image_Segment));
+  System_Latches latches;
+  unsigned char *image = NULL;
+  size_t length, offset;
+  FILE *f;
+  int i, k, status = 0;
+
+  if (m == NULL || segments == NULL) {
+    status = LC3_ERR_NOMEM;
+    goto out;
+  }
+  if (count > 0xFFFF) {
+    status = LC3_ERR_TOO_LONG;	/* the segment count is 16 bits */
+    goto out;
+  }
+
+  length = IMAGE_HEADER + (size_t) count * IMAGE_SEGMENT;
+  for (i = 0; i < count && status == 0; i++) {
+    if (is_image(hex_files[i])) {
+      status = LC3_ERR_FORMAT;
+      break;
+    }
+    lc3_reset(m);
+    segments[i].words = lc3_load(m, hex_files[i]);
+    if (segments[i].words < 0) {
+      status = segments[i].words;
+      break;
+    }
+    lc3_get_regs(m, &latches);
+    segments[i].origin = latches.PC;
+    segments[i].data = malloc((segments[i].words + 1) * sizeof(uint16_t));
+    if (segments[i].data == NULL) {
+      status = LC3_ERR_NOMEM;
+      break;
+    }
+    for (k = 0; k < segments[i].words; k++)
+      segments[i].data[k] = lc3_read_mem(m, segments[i].origin + k);
+    length += 2 * (size_t) segments[i].words;
+  }
+  if (status != 0)
+    goto out;
+
+  image = calloc(1, length);
+  if (image == NULL) {
+    status = LC3_ERR_NOMEM;
+    goto out;
+  }
+  memcpy(image, IMAGE_MAGIC, 4);
+  put16(image + 4, IMAGE_VERSION);
+  put16(image + 6, count);
+  put32(image + 8, count > 0 ? segments[0].origin : 0);
+
+  offset = IMAGE_HEADER + (size_t) count * IMAGE_SEGMENT;
+  for (i = 0; i < count; i++) {
+    unsigned char *entry = image + IMAGE_HEADER + i * IMAGE_SEGMENT;
+    put32(entry, segments[i].origin);
+    put32(entry + 4, segments[i].words);
+    put32(entry + 8, offset);
+    for (k = 0; k < segments[i].words; k++, offset += 2)
+      put16(image + offset, segments[i].data[k]);
+  }
+  put32(image + 12, image_checksum(image + IMAGE_HEADER, length - IMAGE_HEADER));
+
+  f = fopen(image_filename, "wb");
+  if (f == NULL) {
+    status = LC3_ERR_OPEN;
+    goto out;
+  }
+  if (fwrite(image, 1, length, f) != length)
+    status = LC3_ERR_OPEN;
+  if (fclose(f) != 0)
+    status = LC3_ERR_OPEN;
+
+out:
+  if (segments != NULL)
+    for (i = 0; i < count; i++)
+      free(segments[i].data);
+  free(segments);
+  free(image);
+  lc3_destroy(m);
+  return status;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : load_image                                      */
+/*                                                             */
+/* Purpose   : Map an image, check it, and copy its segments   */
+/*             into memory. Returns the number of words        */
+/*             loaded, or an LC3_ERR_ code with memory left    */
+/*             untouched.                                      */
+/*                                                             */
+/***************************************************************/
+int load_image(lc3_machine *m, const char *image_filename) {
+  const unsigned char *image, *entry, *data;
+  struct stat st;
+  size_t length;
+  unsigned int origin, words, offset;
+  int fd, segments, i, k, total = 0, status = 0;
+
+  fd = open(image_filename, O_RDONLY);
+  if (fd < 0)
+    return LC3_ERR_OPEN;
+  if (fstat(fd, &st) != 0 || st.st_size < IMAGE_HEADER) {
+    close(fd);
+    return LC3_ERR_FORMAT;
+  }
+  length = st.st_size;
+  image = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED)
+    return LC3_ERR_NOMEM;
+
+  segments = get16(image + 6);
+  if (memcmp(image, IMAGE_MAGIC, 4) != 0 || get16(image + 4) != IMAGE_VERSION ||
+      length < IMAGE_HEADER + (size_t) segments * IMAGE_SEGMENT ||
+      get32(image + 12) != image_checksum(image + IMAGE_HEADER, length - IMAGE_HEADER))
+    status = LC3_ERR_FORMAT;
+
+  /* Check the whole table before writing anything. */
+  for (i = 0; i < segments && status == 0; i++) {
+    entry = image + IMAGE_HEADER + i * IMAGE_SEGMENT;
+    origin = get32(entry);
+    words = get32(entry + 4);
+    offset = get32(entry + 8);
+    if (origin + (size_t) words > WORDS_IN_MEM)
+      status = LC3_ERR_TOO_LONG;
+    else if (offset + 2 * (size_t) words > length)
+      status = LC3_ERR_FORMAT;
+  }
+
+  for (i = 0; i < segments && status == 0; i++) {
+    entry = image + IMAGE_HEADER + i * IMAGE_SEGMENT;
+    origin = get32(entry);
+    words = get32(entry + 4);
+    data = image + get32(entry + 8);
+    for (k = 0; k < (int) words; k++) {
+      m->MEMORY[origin + k] = get16(data + 2 * k);
+      decode_drop(m, origin + k);
+    }
+    for (k = origin >> PAGE_SHIFT; words > 0 && k <= (int) ((origin + words - 1) >> PAGE_SHIFT); k++)
+      m->DIRTY[k] = TRUE;
+    total += words;
+  }
+
+  if (status == 0 && segments > 0) {
+    if (m->CURRENT_LATCHES.PC == 0) m->CURRENT_LATCHES.PC = get32(image + 8);
+    m->NEXT_LATCHES = m->CURRENT_LATCHES;
+    jit_reset(m);	/* the words went in behind write_memory() */
+  }
+  munmap((void *) image, length);
+  return status != 0 ? status : total;
+}
@@ -0,0 +1,120 @@
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* In-place engine                                             */
+/*                                                             */
+/*   Executes straight into CURRENT_LATCHES, so there is no    */
+/*   NEXT_LATCHES copy per cycle, and never computes N/Z/P     */
+/*   after an ALU or load op. Only the last result is kept:    */
+/*   BR derives its condition from it, and the latches get     */
+/*   real N/Z/P and a matching NEXT_LATCHES when the run ends. */
+/*   Until the first result the latches' own N/Z/P stand, so   */
+/*   latches with none of them set come back that way.         */
+/*                                                             */
+/***************************************************************/
+#define RESULT_NONE (-1)	/* no result yet: N/Z/P are the latches' */
+
+/* The condition codes as nzp bits: of the result, or of the latches. */
+static int result_nzp(const System_Latches *l, int result) {
+  if (result == RESULT_NONE)
+    return l->N << 2 | l->Z << 1 | l->P;
+  return result & 0x8000 ? 4 : result == 0 ? 2 : 1;
+}
+
+int inplace_run(lc3_machine *m, int num_cycles){
+  System_Latches *l = &m->CURRENT_LATCHES;
+  Decoded_Intruction *d;
+  int executed, result, base, address;
+
+  result = RESULT_NONE;
+
+  for (executed = 0; executed < num_cycles; executed++) {
+    d = DECODED_AT(m, l->PC);
+    if (!d->valid)
+      decode(m, l->PC, m->MEMORY[l->PC], d);
+    l->PC = Low16bits(l->PC + 1);
+
+    switch (d->opcode){
+    case 0b0001:
+      result = l->REGS[d->dr] =
+        Low16bits(l->REGS[d->sr1] + (d->imm_flag ? d->imm : l->REGS[d->sr2]));
+      break;
+    case 0b0101:
+      result = l->REGS[d->dr] =
+        Low16bits(l->REGS[d->sr1] & (d->imm_flag ? d->imm : l->REGS[d->sr2]));
+      break;
+    case 0b0000:
+      if (d->nzp & result_nzp(l, result))
+        l->PC = Low16bits(l->PC + d->imm);
+      break;
+    case 0b1100:
+      l->PC = l->REGS[d->sr1];
+      break;
+    case 0b0100:
+      base = l->REGS[d->sr1];
+      l->REGS[7] = l->PC;
+      l->PC = d->imm_flag ? Low16bits(l->PC + d->imm) : base;
+      break;
+    case 0b0010:
+      result = l->REGS[d->dr] = Low16bits(m->MEMORY[Low16bits(l->PC + d->imm)]);
+      break;
+    case 0b1010:
+      address = m->MEMORY[Low16bits(l->PC + d->imm)];
+      if (IS_DEVICE(address))
+        goto front;
+      result = l->REGS[d->dr] = Low16bits(m->MEMORY[address]);
+      break;
+    case 0b0110:
+      address = Low16bits(l->REGS[d->sr1] + d->imm);
+      if (IS_DEVICE(address))
+        goto front;
+      result = l->REGS[d->dr] = Low16bits(m->MEMORY[address]);
+      break;
+    case 0b1110:
+      l->REGS[d->dr] = Low16bits(l->PC + d->imm);
+      break;
+    case 0b1001:
+      result = l->REGS[d->dr] = Low16bits(~l->REGS[d->sr1]);
+      break;
+    case 0b0011:
+      write_memory(m, l->PC + d->imm, l->REGS[d->dr]);
+      break;
+    case 0b1011:
+      address = m->MEMORY[Low16bits(l->PC + d->imm)];
+      if (IS_DEVICE(address))
+        goto front;
+      write_memory(m, address, l->REGS[d->dr]);
+      break;
+    case 0b0111:
+      address = Low16bits(l->REGS[d->sr1] + d->imm);
+      if (IS_DEVICE(address))
+        goto front;
+      write_memory(m, address, l->REGS[d->dr]);
+      break;
+    case 0b1111:
+      l->PC = trap(m, d->imm, l->REGS, l->PC);
+      if (!m->RUN_BIT) {
+        executed++;
+        goto stopped;
+      }
+      break;
+    case OP_STOP:
+    front:	/* or a device access */
+      l->PC = Low16bits(l->PC - 1);	/* stop in front of it, uncounted */
+      goto stopped;
+    default:
+      break;
+    }
+  }
+stopped:
+
+  if (result != RESULT_NONE) {
+    l->N = (result & 0x8000) != 0;
+    l->Z = result == 0;
+    l->P = !l->N && !l->Z;
+  }
+  m->NEXT_LATCHES = m->CURRENT_LATCHES;
+  m->intruction_COUNT += executed;
+  return executed;
+}
@@ -0,0 +1,327 @@
+#ifndef LC3_INTERNAL_H
+#define LC3_INTERNAL_H
+
+#include <stdint.h>
+
+#include "lc3.h"
+
+/***************************************************************/
+/* Predecoded intructions, one entry per memory word.          */
+/***************************************************************/
+/*
+  DECODED[A] caches the fields of MEMORY[A] and the handler that
+  executes it. Entries are filled lazily on fetch and dropped
+  whenever the word is written. The table is kept in pages of
+  LC3_PAGE_WORDS entries, each allocated when a word in it is first
+  decoded, so a machine only pays for the pages it runs code from.
+*/
+typedef struct Decoded_Intruction_Struct Decoded_Intruction;
+
+struct Decoded_Intruction_Struct {
+
+  void (*handler)(lc3_machine *, Decoded_Intruction *); /* execute routine */
+  int16_t imm;		/* sign-extended immediate/offset, or trapvect8 */
+  uint16_t intruction;	/* raw intruction word */
+  uint8_t valid,	/* entry matches MEMORY[A] */
+    opcode,		/* bits [15:12] */
+    dr,		/* DR, or SR for stores */
+    sr1,		/* SR1, or BaseR */
+    sr2,		/* SR2 */
+    nzp,		/* BR condition mask */
+    imm_flag,		/* ADD/AND immediate, JSR long form */
+    fused;		/* LC3_FUSE_ kind heading a superintruction, or 0 */
+};
+
+typedef struct Jit_Cache_Struct Jit_Cache;
+typedef struct Profile_Struct Profile;
+typedef struct Debug_Struct Debug;
+typedef struct Record_Struct Record;
+typedef struct Trace_Struct Trace;
+typedef struct Timing_Struct Timing;
+typedef struct Memo_Struct Memo;
+typedef struct Hostperf_Struct Hostperf;
+typedef struct Fuse_Struct Fuse;
+typedef struct Keyboard_Struct Keyboard;
+typedef struct Input_Queue_Struct Input_Queue;
+
+/*
+ * Opcode of a DECODED entry where a breakpoint, a watchpoint, the
+ * device page, an RTI, a loop to skip, a call to memoize or a GETC/IN
+ * that may have to wait wants a look before the intruction runs.
+ * Engines stop in front of it, with the PC on it and without
+ * counting it, and engine_run() or lc3_run() takes over.
+ */
+#define OP_STOP 16
+
+#define PAGE_SHIFT   8
+#define PAGES_IN_MEM (WORDS_IN_MEM >> PAGE_SHIFT)
+#define MEMORY_BYTES (WORDS_IN_MEM * sizeof(uint16_t))
+
+/* DECODED[A]'s entry, with its page allocated on first use. */
+#define DECODED_AT(m, address)						\
+  ((m)->DECODED[(address) >> PAGE_SHIFT] != NULL ?			\
+   &(m)->DECODED[(address) >> PAGE_SHIFT][(address) & (LC3_PAGE_WORDS - 1)] : \
+   decode_page(m, address))
+
+/* The device page, and the registers in it. */
+#define DEVICE_BASE 0xFE00
+#define DEVICE_KBSR 0xFE00	/* keyboard status: ready, interrupt enable */
+#define DEVICE_KBDR 0xFE02	/* keyboard data */
+#define DEVICE_DSR  0xFE04	/* display status */
+#define DEVICE_DDR  0xFE06	/* display data */
+#define DEVICE_TSR  0xFE08	/* timer status: fired, interrupt enable */
+#define DEVICE_TIR  0xFE0A	/* timer interval, in intructions */
+#define DEVICE_MCR  0xFFFE	/* machine control: clock enable */
+#define IS_DEVICE(address) ((address) >= DEVICE_BASE)
+
+/* Things that happen at an intruction count; see lc3_interrupt.c. */
+#define EVENT_TIMER     0	/* the timer interval ran out */
+#define EVENT_KEYBOARD  1	/* poll the keyboard for an interrupt */
+#define EVENT_INTERRUPT 2	/* an interrupt may have become pending */
+#define EVENT_SAMPLE    3	/* measure the next intruction's host cost */
+#define EVENT_KINDS     4
+
+typedef struct Event_Struct {
+  long long when;	/* intruction_COUNT it is due at */
+  int kind;		/* EVENT_ kind */
+} Event;
+
+/* PSR bits kept in the machine; N/Z/P stay in the latches. */
+#define PSR_USER     0x8000	/* user mode, else supervisor */
+#define PSR_PRIORITY 0x0700	/* priority level */
+
+/* Console output is buffered this many bytes at a time. */
+#define CONSOLE_BUFFER (1 << 16)
+
+/***************************************************************/
+/* One LC-3 machine.                                           */
+/***************************************************************/
+struct lc3_machine {
+
+  /*
+   * MEMORY[A] stores the word address A. It is its own mapping so a
+   * snapshot image can be mapped copy-on-write in its place.
+   */
+  uint16_t *MEMORY;
+  /* DECODED[A >> PAGE_SHIFT], NULL until a word of A's page is decoded */
+  Decoded_Intruction *DECODED[PAGES_IN_MEM];
+  Decoded_Intruction DECODE_SPARE;	/* stands in for a page calloc() refused */
+  /* DIRTY[A >> PAGE_SHIFT] is set once any word of A's page is written */
+  unsigned char DIRTY[PAGES_IN_MEM];
+
+  System_Latches CURRENT_LATCHES, NEXT_LATCHES;
+  int RUN_BIT;		/* run bit, MCR[15] */
+  long long intruction_COUNT;	/* a cycle counter */
+
+  int ENGINE;
+  Jit_Cache *JIT;	/* code cache, NULL unless a JIT engine is used */
+  Profile *PROFILE;	/* counters, NULL unless the profiling engine is used */
+  Debug *DEBUG;		/* breakpoints/watchpoints, NULL while none are armed */
+  int STOP;	/* the switch engine reached an OP_STOP */
+  Record *RECORD;	/* undo log, NULL unless recording */
+  Trace *TRACE;		/* trace writer, NULL unless tracing */
+  Timing *TIMING;	/* timing model, NULL unless on */
+  Memo *MEMO;		/* remembered calls, NULL unless memoizing */
+  Hostperf *HOSTPERF;	/* host counters, NULL unless measuring */
+  Fuse *FUSE;		/* superintruction sites, NULL unless fusing */
+
+  /* Console for the native TRAP routines; NULL means none. */
+  FILE *CONSOLE_IN, *CONSOLE_OUT;
+  Input_Queue *INPUT;	/* host-fed input in place of CONSOLE_IN, or NULL */
+  int WAITING;		/* the run stopped for input INPUT doesn't have yet */
+  int OUTPUT_LENGTH;
+  char OUTPUT[CONSOLE_BUFFER];
+
+  /* Device registers, outside MEMORY; see lc3_device.c. */
+  int KBSR, KBDR, DSR, MCR, TSR, TIR;
+  long long TIMER_START;	/* intruction_COUNT when TIR was written */
+  Keyboard *KEYBOARD;	/* input thread, NULL until a program polls KBSR */
+
+  /* Privilege and priority; see lc3_interrupt.c. */
+  int PSR;		/* PSR_USER | PSR_PRIORITY */
+  int SAVED_SSP, SAVED_USP;	/* R6 of the mode not running */
+
+  /* Pending events, a min-heap on when; one per kind at most. */
+  Event EVENTS[EVENT_KINDS];
+  int EVENTS_PENDING;
+  int EVENT_SLOT[EVENT_KINDS];	/* heap index of each kind, or -1 */
+  long long NEXT_EVENT;	/* when of the first event, LLONG_MAX if none */
+};
+
+/***************************************************************/
+/* Core (lc3_core.c).                                          */
+/***************************************************************/
+int x_to_32(int x, int n);
+int read_memory(lc3_machine *m, int address);
+void decode_intruction(int intruction, Decoded_Intruction *d);
+int intruction_reads(const Decoded_Intruction *d);
+int decode_marked(lc3_machine *m, int address, const Decoded_Intruction *d);
+void decode(lc3_machine *m, int address, int intruction, Decoded_Intruction *d);
+void decode_drop(lc3_machine *m, int address);
+Decoded_Intruction *decode_page(lc3_machine *m, int address);
+void decode_reset(lc3_machine *m);
+void decode_free(lc3_machine *m);
+void write_memory(lc3_machine *m, int address, int value);
+void process_intruction(lc3_machine *m);
+void execute_decoded(lc3_machine *m, Decoded_Intruction *d);
+void step_observed(lc3_machine *m, Decoded_Intruction *d);
+void step_decoded(lc3_machine *m, Decoded_Intruction *d);
+void cycle(lc3_machine *m);
+int engine_run(lc3_machine *m, int num_cycles);
+
+/***************************************************************/
+/* Device registers (lc3_device.c). Engines stop in front of   */
+/* an access to the device page and engine_run() steps it.     */
+/***************************************************************/
+int device_read(lc3_machine *m, int address);
+void device_write(lc3_machine *m, int address, int value);
+int device_stops_at(int address, const Decoded_Intruction *d);
+int device_access(lc3_machine *m, const Decoded_Intruction *d);
+int is_device_register(int address);
+void device_reset(lc3_machine *m);
+int keyboard_getc(lc3_machine *m);
+void keyboard_poll(lc3_machine *m);
+void keyboard_free(lc3_machine *m);
+
+/***************************************************************/
+/* Interrupts and events (lc3_interrupt.c). engine_run() runs  */
+/* the engine up to NEXT_EVENT, then calls events_run().       */
+/***************************************************************/
+#define VECTOR_TABLE     0x0100	/* handler addresses, by vector */
+#define SUPERVISOR_STACK 0x3000	/* R6 on the first switch to supervisor mode */
+#define EXCEPTION_PRIVILEGE 0x00	/* RTI in user mode */
+#define INTERRUPT_KEYBOARD  0x80
+#define INTERRUPT_TIMER     0x81
+
+void interrupt_reset(lc3_machine *m);
+void event_schedule(lc3_machine *m, int kind, long long when);
+void event_cancel(lc3_machine *m, int kind);
+void events_run(lc3_machine *m);
+void events_rewind(lc3_machine *m);
+void interrupt_enter(lc3_machine *m, System_Latches *l, int vector, int priority, int pc);
+void return_from_interrupt(lc3_machine *m, System_Latches *l);
+
+/***************************************************************/
+/* Loop fast-forwarding (lc3_loop.c). Engines stop in front of */
+/* the BR closing a loop loop_run() can skip.                  */
+/***************************************************************/
+int loop_stops_at(lc3_machine *m, int address, const Decoded_Intruction *d);
+int loop_run(lc3_machine *m, int limit);
+
+/***************************************************************/
+/* Subroutine memoization (lc3_memo.c). Engines stop in front  */
+/* of every JSR and JSRR while it is on.                       */
+/***************************************************************/
+int memo_stops_at(lc3_machine *m, int address, const Decoded_Intruction *d);
+int memo_run(lc3_machine *m, int limit);
+void memo_reset(lc3_machine *m);
+
+/***************************************************************/
+/* Host counters (lc3_hostperf.c). lc3_run() reads them on the */
+/* way in and out; engine_run() hands them one intruction at   */
+/* each EVENT_SAMPLE.                                          */
+/***************************************************************/
+void hostperf_begin(lc3_machine *m);
+void hostperf_end(lc3_machine *m);
+void hostperf_fire(lc3_machine *m);
+int hostperf_due(lc3_machine *m);
+int hostperf_sample(lc3_machine *m, int (*slice)(lc3_machine *m, int budget));
+void hostperf_reset(lc3_machine *m);
+
+/***************************************************************/
+/* Superintructions (lc3_fuse.c). decode() fuses a word with   */
+/* the ones after it; the switch engine runs fuse_run().       */
+/***************************************************************/
+#define FUSE_LENGTH_MAX 3
+#define FUSE_LENGTH(kind) \
+  ((kind) == LC3_FUSE_LDR_ADD_BR ? 3 : (kind) != 0 ? 2 : 1)
+
+void fuse_scan(lc3_machine *m);
+void fuse_at(lc3_machine *m, int address, Decoded_Intruction *d);
+int fuse_run(lc3_machine *m, int num_cycles);
+void fuse_reset(lc3_machine *m);
+
+/***************************************************************/
+/* Breakpoints and watchpoints (lc3_debug.c).                  */
+/***************************************************************/
+int debug_stops_at(lc3_machine *m, int address, const Decoded_Intruction *d);
+int debug_run(lc3_machine *m, int num_cycles);
+void debug_free(lc3_machine *m);
+void debug_reset(lc3_machine *m);
+int debug_reverse_stop(lc3_machine *m);
+int store_target(lc3_machine *m, const Decoded_Intruction *d);
+
+/***************************************************************/
+/* Record and replay (lc3_record.c). While recording, every    */
+/* intruction goes through record_step().                      */
+/***************************************************************/
+void record_step(lc3_machine *m, Decoded_Intruction *d);
+void record_interrupt(lc3_machine *m, int vector, int priority);
+int record_run(lc3_machine *m, int num_cycles);
+
+/***************************************************************/
+/* Execution traces (lc3_trace.c). While tracing, every        */
+/* intruction goes through trace_step().                       */
+/***************************************************************/
+void trace_step(lc3_machine *m, Decoded_Intruction *d);
+void trace_interrupt(lc3_machine *m, int vector, int pc);
+int trace_run(lc3_machine *m, int num_cycles);
+
+/***************************************************************/
+/* Timing model (lc3_timing.c). While it is on, every          */
+/* intruction goes through timing_step() before it runs.       */
+/***************************************************************/
+void timing_step(lc3_machine *m, const Decoded_Intruction *d);
+void timing_interrupt(lc3_machine *m);
+int timing_run(lc3_machine *m, int num_cycles);
+void timing_reset(lc3_machine *m);
+
+/***************************************************************/
+/* TRAP (lc3_trap.c). Vectors run natively while MEMORY[vector]  */
+/* is 0; trap() takes the engine's registers and the address   */
+/* after the TRAP and returns the next PC.                     */
+/***************************************************************/
+#define TRAP_GETC  0x20
+#define TRAP_OUT   0x21
+#define TRAP_PUTS  0x22
+#define TRAP_IN    0x23
+#define TRAP_PUTSP 0x24
+#define TRAP_HALT  0x25
+
+int trap(lc3_machine *m, int vector, int regs[], int pc);
+void console_put(lc3_machine *m, int c);
+int input_take(lc3_machine *m);
+int input_stops_at(lc3_machine *m, const Decoded_Intruction *d);
+int input_blocks(lc3_machine *m, const Decoded_Intruction *d);
+
+/***************************************************************/
+/* Binary images (lc3_image.c).                                */
+/***************************************************************/
+int is_image(const char *filename);
+int load_image(lc3_machine *m, const char *image_filename);
+
+/***************************************************************/
+/* Engines. Each runs up to num_cycles intructions, stops when */
+/* the run bit goes off or in front of an OP_STOP entry or a   */
+/* device access, adds to intruction_COUNT, leaves the state   */
+/* in CURRENT_LATCHES == NEXT_LATCHES and returns the count.   */
+/* Those that access the device page in place (switch and     */
+/* record) also stop at NEXT_EVENT, which a device write can   */
+/* bring forward.                                              */
+/***************************************************************/
+int threaded_run(lc3_machine *m, int num_cycles);
+int inplace_run(lc3_machine *m, int num_cycles);
+int jit_init(lc3_machine *m);
+void jit_free(lc3_machine *m);
+void jit_reset(lc3_machine *m);
+void jit_written(lc3_machine *m, int address);
+int jit_run(lc3_machine *m, int num_cycles);
+int jit_check_run(lc3_machine *m, int num_cycles);
+int profile_init(lc3_machine *m);
+void profile_free(lc3_machine *m);
+void profile_reset(lc3_machine *m);
+void profile_count(lc3_machine *m, const Decoded_Intruction *d);
+void profile_access(lc3_machine *m, int address, int write);
+void profile_loop(lc3_machine *m, int target, int pc, int n, int exits);
+
+#endif
@@ -0,0 +1,247 @@
+#include <limits.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Interrupts and events                                       */
+/*                                                             */
+/*   A machine starts in user mode at priority 0. Taking an    */
+/*   interrupt switches R6 to the supervisor stack (kept in    */
+/*   SAVED_SSP while user code runs), pushes the PSR and the   */
+/*   PC, raises the priority to the device's and jumps through */
+/*   VECTOR_TABLE + vector. RTI pops both back; in user mode   */
+/*   it is a privilege exception through vector x00 instead.   */
+/*   The condition codes carry over into the handler.          */
+/*                                                             */
+/*   Nothing polls the devices per intruction. What a device   */
+/*   will do later goes in a min-heap of events keyed by       */
+/*   intruction_COUNT, and NEXT_EVENT is when the first one is */
+/*   due: engine_run() cuts the engine's budget off there, so  */
+/*   the engines themselves carry no interrupt checks. At the  */
+/*   deadline events_run() fires what is due, then takes the   */
+/*   most urgent interrupt that beats the current priority.    */
+/*   Anything that can raise a request between deadlines -- a  */
+/*   KBSR or TSR write, a key latched by a poll, an RTI        */
+/*   dropping the priority -- schedules EVENT_INTERRUPT now.   */
+/*                                                             */
+/***************************************************************/
+
+#define PRIORITY_KEYBOARD 4
+#define PRIORITY_TIMER    5
+
+/* Intructions between keyboard polls while KBSR[14] is set. */
+#define KEYBOARD_POLL 1024
+
+void interrupt_reset(lc3_machine *m) {
+  int kind;
+
+  m->PSR = PSR_USER;
+  m->SAVED_SSP = SUPERVISOR_STACK;
+  m->SAVED_USP = 0;
+  m->EVENTS_PENDING = 0;
+  for (kind = 0; kind < EVENT_KINDS; kind++)
+    m->EVENT_SLOT[kind] = -1;
+  m->NEXT_EVENT = LLONG_MAX;
+}
+
+static void heap_set(lc3_machine *m, int i, Event e) {
+  m->EVENTS[i] = e;
+  m->EVENT_SLOT[e.kind] = i;
+}
+
+/* Move the event at i up or down to where the heap holds again. */
+static void heap_fix(lc3_machine *m, int i) {
+  Event e = m->EVENTS[i];
+  int child;
+
+  while (i > 0 && m->EVENTS[(i - 1) / 2].when > e.when) {
+    heap_set(m, i, m->EVENTS[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  while ((child = 2 * i + 1) < m->EVENTS_PENDING) {
+    if (child + 1 < m->EVENTS_PENDING && m->EVENTS[child + 1].when < m->EVENTS[child].when)
+      child++;
+    if (m->EVENTS[child].when >= e.when)
+      break;
+    heap_set(m, i, m->EVENTS[child]);
+    i = child;
+  }
+  heap_set(m, i, e);
+}
+
+/* Set the event of this kind to happen at when, pending or not. */
+void event_schedule(lc3_machine *m, int kind, long long when) {
+  int i = m->EVENT_SLOT[kind];
+
+  if (i < 0)
+    i = m->EVENTS_PENDING++;
+  m->EVENTS[i].when = when;
+  m->EVENTS[i].kind = kind;
+  heap_fix(m, i);
+  m->NEXT_EVENT = m->EVENTS[0].when;
+}
+
+void event_cancel(lc3_machine *m, int kind) {
+  int i = m->EVENT_SLOT[kind];
+
+  if (i < 0)
+    return;
+  m->EVENT_SLOT[kind] = -1;
+  if (i != --m->EVENTS_PENDING) {
+    m->EVENTS[i] = m->EVENTS[m->EVENTS_PENDING];
+    heap_fix(m, i);
+  }
+  m->NEXT_EVENT = m->EVENTS_PENDING > 0 ? m->EVENTS[0].when : LLONG_MAX;
+}
+
+static void event_fire(lc3_machine *m, Event e) {
+  switch (e.kind) {
+  case EVENT_TIMER:
+    m->TSR |= 0x8000;
+    event_schedule(m, EVENT_TIMER, e.when + m->TIR);	/* keep the phase */
+    break;
+  case EVENT_KEYBOARD:
+    if (!(m->KBSR & 0x8000))
+      keyboard_poll(m);
+    event_schedule(m, EVENT_KEYBOARD, m->intruction_COUNT + KEYBOARD_POLL);
+    break;
+  case EVENT_SAMPLE:
+    hostperf_fire(m);
+    break;
+  default:
+    break;	/* EVENT_INTERRUPT only makes events_run() look */
+  }
+}
+
+static void push(lc3_machine *m, System_Latches *l, int value) {
+  l->REGS[6] = Low16bits(l->REGS[6] - 1);
+  write_memory(m, l->REGS[6], value);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : interrupt_enter                                 */
+/*                                                             */
+/* Purpose   : Start the handler at vector with the given      */
+/*             priority, saving the PSR and pc on the          */
+/*             supervisor stack. l is the latches the machine  */
+/*             carries on from.                                */
+/*                                                             */
+/***************************************************************/
+void interrupt_enter(lc3_machine *m, System_Latches *l, int vector, int priority, int pc) {
+  int psr = m->PSR | (l->N << 2) | (l->Z << 1) | l->P;
+
+  if (m->PSR & PSR_USER) {
+    m->SAVED_USP = l->REGS[6];
+    l->REGS[6] = m->SAVED_SSP;
+  }
+  push(m, l, psr);
+  push(m, l, pc);
+  m->PSR = priority << 8;
+  l->PC = m->MEMORY[VECTOR_TABLE + vector];
+}
+
+/*
+ * RTI, on the NEXT_LATCHES of its handler. With no privilege handler
+ * installed (x0100 is 0) the exception halts on the RTI, as the
+ * exception routine of the LC-3 OS would.
+ */
+void return_from_interrupt(lc3_machine *m, System_Latches *l) {
+  int rti = Low16bits(l->PC - 1), psr;
+
+  if (m->PSR & PSR_USER) {
+    if (m->MEMORY[VECTOR_TABLE + EXCEPTION_PRIVILEGE] == 0) {
+      m->RUN_BIT = FALSE;
+      l->PC = rti;
+      return;
+    }
+    interrupt_enter(m, l, EXCEPTION_PRIVILEGE, (m->PSR & PSR_PRIORITY) >> 8, rti);
+    return;
+  }
+
+  l->PC = m->MEMORY[l->REGS[6]];
+  l->REGS[6] = Low16bits(l->REGS[6] + 1);
+  psr = m->MEMORY[l->REGS[6]];
+  l->REGS[6] = Low16bits(l->REGS[6] + 1);
+
+  m->PSR = psr & (PSR_USER | PSR_PRIORITY);
+  l->N = (psr >> 2) & 1;	/* exactly one of N/Z/P, whatever was popped */
+  l->P = !l->N && (psr & 1);
+  l->Z = !l->N && !l->P;
+  if (psr & PSR_USER) {
+    m->SAVED_SSP = l->REGS[6];
+    l->REGS[6] = m->SAVED_USP;
+  }
+  event_schedule(m, EVENT_INTERRUPT, m->intruction_COUNT);	/* the priority may have dropped */
+}
+
+/* Whether a status register requests an interrupt the machine takes now. */
+static int requested(lc3_machine *m, int status, int vector, int priority) {
+  return (status & 0xC000) == 0xC000 && priority > (m->PSR & PSR_PRIORITY) >> 8 &&
+    m->MEMORY[VECTOR_TABLE + vector] != 0;
+}
+
+static void interrupt_take(lc3_machine *m, int vector, int priority) {
+  int pc = m->CURRENT_LATCHES.PC;
+
+  if (m->RECORD != NULL)
+    record_interrupt(m, vector, priority);
+  else
+    interrupt_enter(m, &m->CURRENT_LATCHES, vector, priority, pc);
+  if (m->TRACE != NULL)
+    trace_interrupt(m, vector, pc);
+  if (m->TIMING != NULL)
+    timing_interrupt(m);
+  m->NEXT_LATCHES = m->CURRENT_LATCHES;
+  if (m->ENGINE == LC3_ENGINE_JIT_CHECK)
+    jit_reset(m);	/* its JIT side missed the switch */
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : events_run                                      */
+/*                                                             */
+/* Purpose   : At NEXT_EVENT, between two intructions: fire    */
+/*             the events that are due, then take a pending    */
+/*             interrupt. An interrupt whose vector is still 0 */
+/*             has no handler and stays pending.               */
+/*                                                             */
+/***************************************************************/
+void events_run(lc3_machine *m) {
+  Event e;
+
+  while (m->EVENTS_PENDING > 0 && m->EVENTS[0].when <= m->intruction_COUNT) {
+    e = m->EVENTS[0];
+    event_cancel(m, e.kind);
+    event_fire(m, e);
+  }
+
+  if (requested(m, m->TSR, INTERRUPT_TIMER, PRIORITY_TIMER))
+    interrupt_take(m, INTERRUPT_TIMER, PRIORITY_TIMER);
+  else if (requested(m, m->KBSR, INTERRUPT_KEYBOARD, PRIORITY_KEYBOARD))
+    interrupt_take(m, INTERRUPT_KEYBOARD, PRIORITY_KEYBOARD);
+}
+
+/*
+ * intruction_COUNT was put back, by a step back or a snapshot
+ * restore. The timer keeps ticking at TIMER_START + k * TIR, the
+ * first tick not yet taken at this count; the rest is looked at
+ * right away.
+ */
+void events_rewind(lc3_machine *m) {
+  long long ticks;
+
+  if (m->TIR != 0) {
+    ticks = (m->intruction_COUNT - m->TIMER_START + m->TIR - 1) / m->TIR;
+    event_schedule(m, EVENT_TIMER, m->TIMER_START + (ticks > 1 ? ticks : 1) * m->TIR);
+  }
+  if (m->KBSR & 0x4000)
+    event_schedule(m, EVENT_KEYBOARD, m->intruction_COUNT);
+  event_schedule(m, EVENT_INTERRUPT, m->intruction_COUNT);
+}
+
+int lc3_psr(lc3_machine *m) {
+  return m->PSR | (m->CURRENT_LATCHES.N << 2) | (m->CURRENT_LATCHES.Z << 1) |
+    m->CURRENT_LATCHES.P;
+}
@@ -0,0 +1,769 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* JIT engine (x86-64)                                         */
+/*                                                             */
+/*   Straight-line runs of intructions ending at BR/JMP/JSR/   */
+/*   TRAP are translated into native code in an mmap'd cache. */
+/*   Guest R0-R7 live in r8d-r15d, rbx holds the base of the   */
+/*   16-bit memory image, rbp the remaining intruction budget  */
+/*   and esi the last result, sign-extended, from which N/Z/P  */
+/*   are derived.                                              */
+/*                                                             */
+/*   Block exits with a static target end in a jmp that is     */
+/*   patched to the target block once it exists, so hot loops  */
+/*   stay in native code. Stores mark their page dirty; one    */
+/*   that lands on a translated word leaves the block and      */
+/*   flushes the cache. A computed address in the device page  */
+/*   leaves the block in front of its intruction. A block      */
+/*   longer than the budget left leaves before it starts, and  */
+/*   the interpreter finishes the run.                         */
+/*                                                             */
+/*   The cache is mapped writable or executable, never both:   */
+/*   it is flipped to write while translating or patching and  */
+/*   back before native code runs.                             */
+/*                                                             */
+/***************************************************************/
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define JIT_SUPPORTED 1
+#endif
+
+#ifdef JIT_SUPPORTED
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define JIT_CACHE_SIZE  (4 << 20)
+#define JIT_MAX_BLOCK   64	/* intructions per block */
+#define JIT_BLOCK_ROOM  (JIT_MAX_BLOCK * 160)	/* worst-case bytes */
+
+#define JIT_EXIT_CHAIN    0	/* static target not translated yet */
+#define JIT_EXIT_DISPATCH 1	/* JMP/JSRR */
+#define JIT_EXIT_BUDGET   2	/* block longer than the budget left */
+#define JIT_EXIT_STORE    3	/* store hit a translated word */
+#define JIT_EXIT_TRAP     4	/* TRAP, left to trap() */
+#define JIT_EXIT_STOP     5	/* reached an OP_STOP word or a device access */
+
+typedef struct Jit_State_Struct {
+  int REGS[LC_3_REGS];
+  int CC;		/* last result, sign-extended: <0 N, 0 Z, >0 P */
+  int PC;
+  long long BUDGET;	/* intructions left */
+  uint16_t *MEMORY;	/* guest memory the code runs against */
+  unsigned char *DIRTY;	/* page bits set by stores */
+  unsigned char *MAP;	/* nonzero where a word has been translated */
+  unsigned char *TARGET;	/* block to enter */
+  unsigned char *PATCH;	/* chain jmp that exited, or NULL */
+  int STORE;		/* address written by a JIT_EXIT_STORE */
+  int TRAP;		/* vector of a JIT_EXIT_TRAP, or -1 */
+  int STOPPED;		/* the last entry ended in JIT_EXIT_STOP */
+  int SPENT;		/* ... or in JIT_EXIT_BUDGET */
+} Jit_State;
+
+/* Host registers. */
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RBP 5
+#define RSI 6
+#define RDI 7
+#define GREG(r) (8 + (r))
+
+struct Jit_Cache_Struct {
+  unsigned char *CODE;		/* start of the cache */
+  unsigned char *BASE;		/* first byte after the entry/exit stubs */
+  unsigned char *PTR;		/* emit position */
+  unsigned char *EPILOGUE;
+  int (*ENTER)(Jit_State *);
+  int WRITABLE;			/* mapped to write, not to run */
+
+  unsigned char *BLOCKS[WORDS_IN_MEM];	/* translated block per PC */
+  int LENGTH[WORDS_IN_MEM];		/* intructions in that block */
+  unsigned char MAP[WORDS_IN_MEM];
+  int GENERATION;		/* bumped on every flush */
+
+  unsigned char *PENDING;	/* chain jmp waiting to be patched */
+  int PENDING_GENERATION;
+
+  Jit_State STATE;		/* JIT side of jit-check */
+  uint16_t CHECK_MEMORY[WORDS_IN_MEM];
+  unsigned char CHECK_DIRTY[PAGES_IN_MEM];	/* pages the JIT side wrote */
+  unsigned char CHECK_WRITTEN[PAGES_IN_MEM];	/* ... and the interpreter */
+  int CHECK_STARTED;
+};
+
+static void emit8(Jit_Cache *c, int b) { *c->PTR++ = (unsigned char) b; }
+
+static void emit32(Jit_Cache *c, int v) { memcpy(c->PTR, &v, 4); c->PTR += 4; }
+
+static void emit64(Jit_Cache *c, long long v) { memcpy(c->PTR, &v, 8); c->PTR += 8; }
+
+static void emit_rex(Jit_Cache *c, int w, int reg, int rm) {
+  int rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (rex != 0x40) emit8(c, rex);
+}
+
+static void emit_modrm(Jit_Cache *c, int mod, int reg, int rm) {
+  emit8(c, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* op r/m32, r32 with both operands registers (add, and, mov, test). */
+static void emit_rr(Jit_Cache *c, int op, int dst, int src) {
+  emit_rex(c, 0, src, dst);
+  emit8(c, op);
+  emit_modrm(c, 3, src, dst);
+}
+
+/* 81 /ext r/m, imm32 (add 0, and 4, sub 5, cmp 7). */
+static void emit_ri(Jit_Cache *c, int w, int ext, int dst, int imm) {
+  emit_rex(c, w, 0, dst);
+  emit8(c, 0x81);
+  emit_modrm(c, 3, ext, dst);
+  emit32(c, imm);
+}
+
+static void emit_mov_ri(Jit_Cache *c, int dst, int imm) {
+  emit_rex(c, 0, 0, dst);
+  emit8(c, 0xB8 + (dst & 7));
+  emit32(c, imm);
+}
+
+static void emit_mov_ri64(Jit_Cache *c, int dst, long long imm) {
+  emit_rex(c, 1, 0, dst);
+  emit8(c, 0xB8 + (dst & 7));
+  emit64(c, imm);
+}
+
+static void emit_not(Jit_Cache *c, int dst) {
+  emit_rex(c, 0, 0, dst);
+  emit8(c, 0xF7);
+  emit_modrm(c, 3, 2, dst);
+}
+
+/* movzx/movsx r32, r16 */
+static void emit_ext16(Jit_Cache *c, int op, int dst, int src) {
+  emit_rex(c, 0, dst, src);
+  emit8(c, 0x0F);
+  emit8(c, op);
+  emit_modrm(c, 3, dst, src);
+}
+
+/* op reg, [base + disp32] / op [base + disp32], reg */
+static void emit_mem(Jit_Cache *c, int w, int op, int reg, int base, int disp) {
+  emit_rex(c, w, reg, base);
+  emit8(c, op);
+  emit_modrm(c, 2, reg, base);
+  emit32(c, disp);
+}
+
+/* movzx reg, word [base + disp32] */
+static void emit_load16(Jit_Cache *c, int reg, int base, int disp) {
+  emit_rex(c, 0, reg, base);
+  emit8(c, 0x0F);
+  emit8(c, 0xB7);
+  emit_modrm(c, 2, reg, base);
+  emit32(c, disp);
+}
+
+/* movzx reg, word [base + rax*2] */
+static void emit_load16_index(Jit_Cache *c, int reg, int base) {
+  emit_rex(c, 0, reg, base);
+  emit8(c, 0x0F);
+  emit8(c, 0xB7);
+  emit_modrm(c, 0, reg, 4);
+  emit8(c, (1 << 6) | (RAX << 3) | (base & 7));
+}
+
+/* mov word [base + rax*2], reg */
+static void emit_store16_index(Jit_Cache *c, int reg, int base) {
+  emit8(c, 0x66);
+  emit_rex(c, 0, reg, base);
+  emit8(c, 0x89);
+  emit_modrm(c, 0, reg, 4);
+  emit8(c, (1 << 6) | (RAX << 3) | (base & 7));
+}
+
+static void emit_push(Jit_Cache *c, int r) { emit_rex(c, 0, 0, r); emit8(c, 0x50 + (r & 7)); }
+
+static void emit_pop(Jit_Cache *c, int r) { emit_rex(c, 0, 0, r); emit8(c, 0x58 + (r & 7)); }
+
+/* jcc/jmp rel32; returns the rel32 field for later patching. */
+static unsigned char *emit_jcc(Jit_Cache *c, int cc) {
+  emit8(c, 0x0F);
+  emit8(c, 0x80 + cc);
+  emit32(c, 0);
+  return c->PTR - 4;
+}
+
+static unsigned char *emit_jmp(Jit_Cache *c) {
+  emit8(c, 0xE9);
+  emit32(c, 0);
+  return c->PTR - 4;
+}
+
+static void patch_rel32(unsigned char *field, unsigned char *target) {
+  int rel = (int) (target - (field + 4));
+  memcpy(field, &rel, 4);
+}
+
+static void emit_set_pc(Jit_Cache *c, int pc) {
+  emit8(c, 0xC7);
+  emit_modrm(c, 2, 0, RDI);
+  emit32(c, offsetof(Jit_State, PC));
+  emit32(c, pc);
+}
+
+static void emit_exit(Jit_Cache *c, int reason) {
+  emit_mov_ri(c, RAX, reason);
+  patch_rel32(emit_jmp(c), c->EPILOGUE);
+}
+
+/* Leave towards a static target; the jmp is patched once it exists. */
+static void emit_chain(Jit_Cache *c, int pc) {
+  unsigned char *slot = c->PTR;
+
+  emit_jmp(c);			/* jmp +0 falls into the stub below */
+  emit_mov_ri64(c, RAX, (long long) slot);
+  emit_mem(c, 1, 0x89, RAX, RDI, offsetof(Jit_State, PATCH));
+  emit_set_pc(c, pc);
+  emit_exit(c, JIT_EXIT_CHAIN);
+}
+
+/* Leave towards the PC held in eax. */
+static void emit_dispatch(Jit_Cache *c) {
+  emit_mem(c, 0, 0x89, RAX, RDI, offsetof(Jit_State, PC));
+  emit_exit(c, JIT_EXIT_DISPATCH);
+}
+
+/* Set the lazy condition code from ax and write ax to a register. */
+static void emit_result(Jit_Cache *c, int dr) {
+  emit_ext16(c, 0xB7, GREG(dr), RAX);
+  emit_ext16(c, 0xBF, RSI, RAX);
+}
+
+/*
+ * Jump out when the 16-bit address in eax is in the device page;
+ * jit_translate() emits the stub that leaves in front of the word.
+ */
+static unsigned char *emit_device_check(Jit_Cache *c) {
+  emit_ri(c, 0, 7, RAX, DEVICE_BASE);		/* cmp eax, DEVICE_BASE */
+  return emit_jcc(c, 0x03);			/* jae */
+}
+
+/* Load the word at the 16-bit address in eax into a register. */
+static void emit_load_result(Jit_Cache *c, int dr) {
+  emit_load16_index(c, RAX, RBX);
+  emit_result(c, dr);
+}
+
+static void jit_emit_stubs(Jit_Cache *c) {
+  int i;
+
+  c->ENTER = (int (*)(Jit_State *)) c->PTR;
+  emit_push(c, RBX); emit_push(c, RBP);
+  emit_push(c, 12); emit_push(c, 13); emit_push(c, 14); emit_push(c, 15);
+  emit_mem(c, 1, 0x8B, RBX, RDI, offsetof(Jit_State, MEMORY));
+  emit_mem(c, 1, 0x8B, RBP, RDI, offsetof(Jit_State, BUDGET));
+  emit_mem(c, 0, 0x8B, RSI, RDI, offsetof(Jit_State, CC));
+  for (i = 0; i < LC_3_REGS; i++)
+    emit_mem(c, 0, 0x8B, GREG(i), RDI, offsetof(Jit_State, REGS) + 4 * i);
+  emit_mem(c, 0, 0xFF, 4, RDI, offsetof(Jit_State, TARGET));	/* jmp [rdi+TARGET] */
+
+  c->EPILOGUE = c->PTR;
+  for (i = 0; i < LC_3_REGS; i++)
+    emit_mem(c, 0, 0x89, GREG(i), RDI, offsetof(Jit_State, REGS) + 4 * i);
+  emit_mem(c, 0, 0x89, RSI, RDI, offsetof(Jit_State, CC));
+  emit_mem(c, 1, 0x89, RBP, RDI, offsetof(Jit_State, BUDGET));
+  emit_pop(c, 15); emit_pop(c, 14); emit_pop(c, 13); emit_pop(c, 12);
+  emit_pop(c, RBP); emit_pop(c, RBX);
+  emit8(c, 0xC3);
+  c->BASE = c->PTR;
+}
+
+/* Map the cache to write code into it, or to run it. */
+static int jit_protect(Jit_Cache *c, int writable) {
+  if (c->WRITABLE == writable)
+    return TRUE;
+  if (mprotect(c->CODE, JIT_CACHE_SIZE,
+               writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0)
+    return FALSE;
+  c->WRITABLE = writable;
+  return TRUE;
+}
+
+static void jit_flush(Jit_Cache *c) {
+  memset(c->BLOCKS, 0, sizeof(c->BLOCKS));
+  memset(c->MAP, 0, sizeof(c->MAP));
+  c->PTR = c->BASE;
+  c->GENERATION++;
+}
+
+/*
+ * Translate up to limit intructions starting at start. Sets *length
+ * to the number translated; the block is not registered here.
+ */
+static unsigned char *jit_translate(lc3_machine *m, Jit_State *js, int start, int limit, int *length) {
+  Jit_Cache *c = m->JIT;
+  Decoded_Intruction code[JIT_MAX_BLOCK], *d;
+  unsigned char *block, *budget_jcc, *store_jcc[JIT_MAX_BLOCK], *device_jcc[JIT_MAX_BLOCK];
+  int store_pc[JIT_MAX_BLOCK], store_rest[JIT_MAX_BLOCK];
+  int device_pc[JIT_MAX_BLOCK], device_rest[JIT_MAX_BLOCK];
+  int n = 0, stores = 0, devices = 0, i, pc, npc, ends = FALSE, debug = FALSE;
+
+  if (limit > JIT_MAX_BLOCK) limit = JIT_MAX_BLOCK;
+  while (n < limit && start + n < WORDS_IN_MEM && !ends) {
+    decode(m, start + n, js->MEMORY[start + n], &code[n]);
+    if (code[n].opcode == OP_STOP) {
+      debug = TRUE;	/* the block ends in front of it */
+      break;
+    }
+    switch (code[n].opcode) {
+    case 0b0000: case 0b1100: case 0b0100: case 0b1111:
+      ends = TRUE;
+    }
+    n++;
+  }
+
+  if (c->PTR + JIT_BLOCK_ROOM > c->CODE + JIT_CACHE_SIZE)
+    jit_flush(c);
+  block = c->PTR;
+
+  emit_ri(c, 1, 7, RBP, n);			/* cmp rbp, n */
+  budget_jcc = emit_jcc(c, 0x0C);		/* jl */
+  emit_ri(c, 1, 5, RBP, n);			/* sub rbp, n */
+
+  for (i = 0; i < n; i++) {
+    d = &code[i];
+    pc = start + i;
+    npc = Low16bits(pc + 1);
+    c->MAP[pc] = 1;
+
+    switch (d->opcode) {
+    case 0b0001: /* ADD */
+    case 0b0101: /* AND */
+      emit_rr(c, 0x89, RAX, GREG(d->sr1));
+      if (d->imm_flag)
+        emit_ri(c, 0, d->opcode == 0b0001 ? 0 : 4, RAX, d->imm);
+      else
+        emit_rr(c, d->opcode == 0b0001 ? 0x01 : 0x21, RAX, GREG(d->sr2));
+      emit_result(c, d->dr);
+      break;
+    case 0b1001: /* NOT */
+      emit_rr(c, 0x89, RAX, GREG(d->sr1));
+      emit_not(c, RAX);
+      emit_result(c, d->dr);
+      break;
+    case 0b1110: /* LEA */
+      emit_mov_ri(c, GREG(d->dr), Low16bits(npc + d->imm));
+      break;
+    case 0b0010: /* LD */
+      emit_load16(c, RAX, RBX, 2 * Low16bits(npc + d->imm));
+      emit_result(c, d->dr);
+      break;
+    case 0b1010: /* LDI */
+    case 0b0110: /* LDR */
+      if (d->opcode == 0b1010) {
+        emit_load16(c, RAX, RBX, 2 * Low16bits(npc + d->imm));
+      } else {
+        emit_rr(c, 0x89, RAX, GREG(d->sr1));
+        emit_ri(c, 0, 0, RAX, d->imm);
+        emit_ext16(c, 0xB7, RAX, RAX);
+      }
+      device_jcc[devices] = emit_device_check(c);
+      device_pc[devices] = pc;
+      device_rest[devices] = n - i;
+      devices++;
+      emit_load_result(c, d->dr);
+      break;
+    case 0b0011: /* ST */
+    case 0b1011: /* STI */
+    case 0b0111: /* STR */
+      if (d->opcode == 0b0011) {
+        emit_mov_ri(c, RAX, Low16bits(npc + d->imm));
+      } else if (d->opcode == 0b1011) {
+        emit_load16(c, RAX, RBX, 2 * Low16bits(npc + d->imm));
+      } else {
+        emit_rr(c, 0x89, RAX, GREG(d->sr1));
+        emit_ri(c, 0, 0, RAX, d->imm);
+        emit_ext16(c, 0xB7, RAX, RAX);
+      }
+      if (d->opcode != 0b0011) {
+        device_jcc[devices] = emit_device_check(c);
+        device_pc[devices] = pc;
+        device_rest[devices] = n - i;
+        devices++;
+      }
+      emit_store16_index(c, GREG(d->dr), RBX);
+      emit_mem(c, 1, 0x8B, RDX, RDI, offsetof(Jit_State, DIRTY));
+      emit_rr(c, 0x89, RCX, RAX);		/* mov ecx, eax */
+      emit8(c, 0xC1);			/* shr ecx, PAGE_SHIFT */
+      emit_modrm(c, 3, 5, RCX);
+      emit8(c, PAGE_SHIFT);
+      emit8(c, 0xC6);			/* mov byte [rdx + rcx], 1 */
+      emit_modrm(c, 0, 0, 4);
+      emit8(c, (RCX << 3) | RDX);
+      emit8(c, 1);
+      emit_mem(c, 1, 0x8B, RDX, RDI, offsetof(Jit_State, MAP));
+      emit8(c, 0x80);			/* cmp byte [rdx + rax], 0 */
+      emit_modrm(c, 0, 7, 4);
+      emit8(c, (RAX << 3) | RDX);
+      emit8(c, 0);
+      store_jcc[stores] = emit_jcc(c, 0x05);	/* jne */
+      store_pc[stores] = npc;
+      store_rest[stores] = n - (i + 1);
+      stores++;
+      break;
+    case 0b0000: /* BR */
+      if (d->nzp == 7) {
+        emit_chain(c, Low16bits(npc + d->imm));
+      } else if (d->nzp == 0) {
+        emit_chain(c, npc);
+      } else {
+        static const int taken[8] = { 0, 0x0F, 0x04, 0x0D, 0x0C, 0x05, 0x0E, 0 };
+        unsigned char *jcc;
+        emit_rr(c, 0x85, RSI, RSI);		/* test esi, esi */
+        jcc = emit_jcc(c, taken[d->nzp]);
+        emit_chain(c, npc);
+        patch_rel32(jcc, c->PTR);
+        emit_chain(c, Low16bits(npc + d->imm));
+      }
+      break;
+    case 0b1100: /* JMP */
+      emit_rr(c, 0x89, RAX, GREG(d->sr1));
+      emit_dispatch(c);
+      break;
+    case 0b0100: /* JSR */
+      if (d->imm_flag) {
+        emit_mov_ri(c, GREG(7), npc);
+        emit_chain(c, Low16bits(npc + d->imm));
+      } else {
+        emit_rr(c, 0x89, RAX, GREG(d->sr1));
+        emit_mov_ri(c, GREG(7), npc);
+        emit_dispatch(c);
+      }
+      break;
+    case 0b1111: /* TRAP */
+      emit_mov_ri(c, RAX, d->imm);
+      emit_mem(c, 0, 0x89, RAX, RDI, offsetof(Jit_State, TRAP));
+      emit_set_pc(c, npc);
+      emit_exit(c, JIT_EXIT_TRAP);
+      break;
+    default:
+      break;
+    }
+  }
+  if (debug) {
+    emit_set_pc(c, start + n);
+    emit_exit(c, JIT_EXIT_STOP);
+  } else if (!ends)
+    emit_chain(c, Low16bits(start + n));
+
+  patch_rel32(budget_jcc, c->PTR);
+  emit_set_pc(c, start);
+  emit_exit(c, JIT_EXIT_BUDGET);
+
+  for (i = 0; i < stores; i++) {
+    patch_rel32(store_jcc[i], c->PTR);
+    emit_mem(c, 0, 0x89, RAX, RDI, offsetof(Jit_State, STORE));
+    emit_set_pc(c, store_pc[i]);
+    emit_ri(c, 1, 0, RBP, store_rest[i]);	/* give back the untaken rest */
+    emit_exit(c, JIT_EXIT_STORE);
+  }
+  for (i = 0; i < devices; i++) {
+    patch_rel32(device_jcc[i], c->PTR);
+    emit_set_pc(c, device_pc[i]);
+    emit_ri(c, 1, 0, RBP, device_rest[i]);	/* give back it and the rest */
+    emit_exit(c, JIT_EXIT_STOP);
+  }
+
+  *length = n;
+  return block;
+}
+
+/*
+ * Run one native entry: at most budget intructions, returning how
+ * many were executed.
+ */
+static int jit_enter(lc3_machine *m, Jit_State *js, int budget) {
+  Jit_Cache *c = m->JIT;
+  unsigned char *block;
+  int pc = js->PC, length, reason;
+
+  block = c->BLOCKS[pc];
+  if (block == NULL) {
+    jit_protect(c, TRUE);
+    block = jit_translate(m, js, pc, JIT_MAX_BLOCK, &length);
+    c->BLOCKS[pc] = block;
+    c->LENGTH[pc] = length;
+  }
+  if (c->PENDING != NULL && c->PENDING_GENERATION == c->GENERATION) {
+    jit_protect(c, TRUE);
+    patch_rel32(c->PENDING + 1, block);
+  }
+  c->PENDING = NULL;
+
+  js->TARGET = block;
+  js->BUDGET = budget;
+  js->PATCH = NULL;
+  jit_protect(c, FALSE);
+  reason = c->ENTER(js);
+  js->STOPPED = reason == JIT_EXIT_STOP;
+  js->SPENT = reason == JIT_EXIT_BUDGET;
+
+  if (reason == JIT_EXIT_STORE) {
+    decode_drop(m, js->STORE);
+    jit_flush(c);
+  } else if (reason == JIT_EXIT_CHAIN) {
+    c->PENDING = js->PATCH;
+    c->PENDING_GENERATION = c->GENERATION;
+  }
+  return budget - (int) js->BUDGET;
+}
+
+/*
+ * Keep going until the budget left is too short for the next block,
+ * the PC leaves memory or a TRAP halts the machine. TRAPs are
+ * finished here, in C, by trap().
+ */
+static int jit_enter_all(lc3_machine *m, Jit_State *js, int budget) {
+  int executed = 0;
+
+  while (executed < budget) {
+    if (js->PC < 0 || js->PC >= WORDS_IN_MEM)
+      break;
+    executed += jit_enter(m, js, budget - executed);
+    if (js->STOPPED || js->SPENT)
+      break;
+    if (js->TRAP >= 0) {
+      js->PC = trap(m, js->TRAP, js->REGS, js->PC);
+      js->TRAP = -1;
+      if (!m->RUN_BIT)
+        break;
+    }
+  }
+  return executed;
+}
+
+static void jit_load_state(lc3_machine *m, Jit_State *js, uint16_t *memory,
+                           unsigned char *dirty) {
+  memcpy(js->REGS, m->CURRENT_LATCHES.REGS, sizeof(js->REGS));
+  js->PC = m->CURRENT_LATCHES.PC;
+  js->CC = m->CURRENT_LATCHES.N ? -1 : m->CURRENT_LATCHES.Z ? 0 : 1;
+  js->MEMORY = memory;
+  js->DIRTY = dirty;
+  js->MAP = m->JIT->MAP;
+  js->TRAP = -1;
+  js->STOPPED = FALSE;
+  js->SPENT = FALSE;
+}
+
+static void jit_store_state(Jit_State *js, System_Latches *latches) {
+  memcpy(latches->REGS, js->REGS, sizeof(js->REGS));
+  latches->PC = js->PC;
+  latches->N = js->CC < 0;
+  latches->Z = js->CC == 0;
+  latches->P = js->CC > 0;
+}
+
+int jit_init(lc3_machine *m) {
+  Jit_Cache *c = calloc(1, sizeof(Jit_Cache));
+
+  if (c == NULL)
+    return FALSE;
+  c->CODE = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (c->CODE == MAP_FAILED) {
+    free(c);
+    return FALSE;
+  }
+  c->WRITABLE = TRUE;
+  c->PTR = c->CODE;
+  jit_emit_stubs(c);
+  jit_flush(c);
+  if (!jit_protect(c, FALSE)) {
+    munmap(c->CODE, JIT_CACHE_SIZE);
+    free(c);
+    return FALSE;
+  }
+  m->JIT = c;
+  return TRUE;
+}
+
+void jit_free(lc3_machine *m) {
+  if (m->JIT == NULL)
+    return;
+  munmap(m->JIT->CODE, JIT_CACHE_SIZE);
+  free(m->JIT);
+  m->JIT = NULL;
+}
+
+/* Memory was cleared under the translations; start over. */
+void jit_reset(lc3_machine *m) {
+  if (m->JIT == NULL)
+    return;
+  jit_flush(m->JIT);
+  m->JIT->PENDING = NULL;
+  m->JIT->CHECK_STARTED = FALSE;
+}
+
+/* A word was written outside translated code; drop it if translated. */
+void jit_written(lc3_machine *m, int address) {
+  if (m->JIT == NULL)
+    return;
+  m->JIT->CHECK_WRITTEN[address >> PAGE_SHIFT] = TRUE;
+  if (m->JIT->MAP[address])
+    jit_reset(m);
+}
+
+/*
+ * Run up to num_cycles intructions in the interpreter. Native code
+ * keeps N/Z/P as the last result, which can't say that none is set,
+ * so with no_flags it runs only until an intruction sets them; it
+ * also runs the rest of a budget too short for the next block.
+ */
+static int jit_interpret(lc3_machine *m, int num_cycles, int no_flags) {
+  System_Latches *l = &m->CURRENT_LATCHES;
+  int n;
+
+  for (n = 0; n < num_cycles && m->RUN_BIT && !m->STOP && !m->WAITING &&
+         !(no_flags && (l->N || l->Z || l->P)); n++)
+    cycle(m);
+  if (m->STOP) {	/* in front of it, as the switch engine stops */
+    n--;
+    m->intruction_COUNT--;
+    m->STOP = FALSE;
+  }
+  return n;
+}
+
+int jit_run(lc3_machine *m, int num_cycles) {
+  Jit_State js;
+  int stepped = jit_interpret(m, num_cycles, TRUE), executed;
+
+  if (!m->CURRENT_LATCHES.N && !m->CURRENT_LATCHES.Z && !m->CURRENT_LATCHES.P)
+    return stepped;
+  jit_load_state(m, &js, m->MEMORY, m->DIRTY);
+  executed = jit_enter_all(m, &js, num_cycles - stepped);
+  jit_store_state(&js, &m->CURRENT_LATCHES);
+  m->NEXT_LATCHES = m->CURRENT_LATCHES;
+  m->intruction_COUNT += executed;
+  if (js.SPENT)
+    executed += jit_interpret(m, num_cycles - stepped - executed, FALSE);
+  return stepped + executed;
+}
+
+/*
+ * The first word of memory the two sides of jit-check disagree on,
+ * or -1, looking only at pages either wrote since the last look.
+ */
+static int jit_check_memory(lc3_machine *m) {
+  Jit_Cache *c = m->JIT;
+  int page, base, address = -1;
+
+  for (page = 0; page < PAGES_IN_MEM; page++) {
+    if (!c->CHECK_DIRTY[page] && !c->CHECK_WRITTEN[page])
+      continue;
+    c->CHECK_DIRTY[page] = c->CHECK_WRITTEN[page] = FALSE;
+    base = page << PAGE_SHIFT;
+    if (address < 0 && memcmp(&c->CHECK_MEMORY[base], &m->MEMORY[base],
+                              LC3_PAGE_WORDS * sizeof(m->MEMORY[0])) != 0)
+      for (address = base; c->CHECK_MEMORY[address] == m->MEMORY[address]; address++);
+  }
+  return address;
+}
+
+/*
+ * Lockstep check: the JIT runs on its own copy of memory while the
+ * interpreter drives the real machine; after every native entry the
+ * interpreter executes as many cycles and both states must agree.
+ * The first difference is reported and halts the machine. A TRAP is
+ * only run by the interpreter, so console I/O happens once, and the
+ * JIT side takes the registers and PC it leaves.
+ */
+int jit_check_run(lc3_machine *m, int num_cycles) {
+  Jit_Cache *c = m->JIT;
+  Jit_State *js = &c->STATE;
+  System_Latches jit_latches;
+  int executed = jit_interpret(m, num_cycles, TRUE), n, i, address, page;
+
+  if (executed > 0)
+    c->CHECK_STARTED = FALSE;	/* the JIT side missed these */
+  if (!c->CHECK_STARTED) {
+    memcpy(c->CHECK_MEMORY, m->MEMORY, sizeof(c->CHECK_MEMORY));
+    memset(c->CHECK_DIRTY, 0, sizeof(c->CHECK_DIRTY));
+    memset(c->CHECK_WRITTEN, 0, sizeof(c->CHECK_WRITTEN));
+    jit_load_state(m, js, c->CHECK_MEMORY, c->CHECK_DIRTY);
+    c->CHECK_STARTED = TRUE;
+  }
+
+  while (executed < num_cycles && m->RUN_BIT) {
+    if (js->PC < 0 || js->PC >= WORDS_IN_MEM)
+      break;
+    n = jit_enter(m, js, num_cycles - executed);
+    for (i = 0; i < n; i++)
+      cycle(m);
+    executed += n;
+    if (js->TRAP >= 0) {
+      memcpy(js->REGS, m->CURRENT_LATCHES.REGS, sizeof(js->REGS));
+      js->PC = m->CURRENT_LATCHES.PC;
+      js->TRAP = -1;
+    }
+
+    jit_store_state(js, &jit_latches);
+    if (memcmp(&jit_latches, &m->CURRENT_LATCHES, sizeof(jit_latches)) != 0) {
+      printf("JIT check failed after %lld intructions:\n", m->intruction_COUNT);
+      printf("  PC  jit 0x%.4x  interpreter 0x%.4x\n", jit_latches.PC, m->CURRENT_LATCHES.PC);
+      printf("  CCs jit %d%d%d  interpreter %d%d%d\n",
+             jit_latches.N, jit_latches.Z, jit_latches.P,
+             m->CURRENT_LATCHES.N, m->CURRENT_LATCHES.Z, m->CURRENT_LATCHES.P);
+      for (i = 0; i < LC_3_REGS; i++)
+        printf("  R%d  jit 0x%.4x  interpreter 0x%.4x\n", i,
+               jit_latches.REGS[i], m->CURRENT_LATCHES.REGS[i]);
+      m->RUN_BIT = FALSE;
+      break;
+    }
+    if ((address = jit_check_memory(m)) >= 0) {
+      printf("JIT check failed after %lld intructions:\n", m->intruction_COUNT);
+      printf("  MEMORY[0x%.4x] jit 0x%.4x  interpreter 0x%.4x\n",
+             address, c->CHECK_MEMORY[address], m->MEMORY[address]);
+      m->RUN_BIT = FALSE;
+      break;
+    }
+    if (js->STOPPED)
+      break;
+    if (js->SPENT) {
+      /* The interpreter runs the rest; the JIT side takes what it leaves. */
+      executed += jit_interpret(m, num_cycles - executed, FALSE);
+      for (page = 0; page < PAGES_IN_MEM; page++)
+        if (c->CHECK_WRITTEN[page]) {
+          memcpy(&c->CHECK_MEMORY[page << PAGE_SHIFT], &m->MEMORY[page << PAGE_SHIFT],
+                 LC3_PAGE_WORDS * sizeof(m->MEMORY[0]));
+          c->CHECK_WRITTEN[page] = FALSE;
+        }
+      jit_load_state(m, js, c->CHECK_MEMORY, c->CHECK_DIRTY);
+      break;
+    }
+  }
+  return executed;
+}
+
+#else
+
+int jit_init(lc3_machine *m) { (void) m; return FALSE; }
+
+void jit_free(lc3_machine *m) { (void) m; }
+
+void jit_reset(lc3_machine *m) { (void) m; }
+
+void jit_written(lc3_machine *m, int address) { (void) m; (void) address; }
+
+int jit_run(lc3_machine *m, int num_cycles) { return threaded_run(m, num_cycles); }
+
+int jit_check_run(lc3_machine *m, int num_cycles) { return threaded_run(m, num_cycles); }
+
+#endif
@@ -0,0 +1,479 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Lockstep lanes                                              */
+/*                                                             */
+/*   LC3_LANES machines stored structure-of-arrays: every      */
+/*   register, latch and memory word is a Lane_Vec holding     */
+/*   that value for all lanes, so MEMORY[A] is one vector and  */
+/*   an ADD is one vector add whatever the lane count.         */
+/*                                                             */
+/*   Each step picks the live lane with the lowest PC and      */
+/*   runs the intruction there for every live lane at the same */
+/*   PC holding the same word; the others are masked off. A    */
+/*   BR or JMP that goes different ways splits the group, and  */
+/*   lowest-PC-first lets the trailing group catch up so the   */
+/*   lanes merge again where their paths rejoin.               */
+/*                                                             */
+/*   The ops below follow the handlers in lc3_core.c line by   */
+/*   line, so every lane ends in exactly the state a scalar    */
+/*   machine would. Lanes take no interrupts, though: no key   */
+/*   ever comes in and the timer never fires, so only RTI's    */
+/*   privilege exception ever puts a lane in supervisor mode.  */
+/*   tests/library.c holds every lane of the regression        */
+/*   programs to a scalar machine's state.                     */
+/*                                                             */
+/***************************************************************/
+
+/* One int per lane; a comparison yields -1 (true) or 0 per lane. */
+typedef int Lane_Vec __attribute__((vector_size(LC3_LANES * sizeof(int))));
+
+#define LANE_BLEND(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+struct lc3_lanes {
+
+  /* MEMORY[A][lane] stores the word address A of that lane */
+  Lane_Vec MEMORY[WORDS_IN_MEM];
+  Lane_Vec REGS[LC_3_REGS];
+  Lane_Vec PC, N, Z, P;
+  Lane_Vec RUNNING;		/* -1 until the lane halts */
+  Lane_Vec KBSR, DSR, MCR, TSR, TIR;	/* device registers, see lanes_device_read() */
+  Lane_Vec PSR, SAVED_SSP, SAVED_USP;	/* as in lc3_interrupt.c */
+  long long COUNT[LC3_LANES];	/* intructions executed per lane */
+  int LANES;
+
+  /* DECODED[A] caches the last word decoded at A, for any lane */
+  Decoded_Intruction DECODED[WORDS_IN_MEM];
+};
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_lanes_create / lc3_lanes_destroy            */
+/*                                                             */
+/* Purpose   : Allocate lanes machines in their reset state,   */
+/*             and free them again.                            */
+/*                                                             */
+/***************************************************************/
+lc3_lanes *lc3_lanes_create(int lanes) {
+  lc3_lanes *l;
+  int i;
+
+  if (lanes < 1 || lanes > LC3_LANES)
+    return NULL;
+  l = aligned_alloc(sizeof(Lane_Vec), sizeof(lc3_lanes));
+  if (l == NULL)
+    return NULL;
+  memset(l, 0, sizeof(lc3_lanes));
+
+  l->LANES = lanes;
+  for (i = 0; i < lanes; i++) {
+    l->Z[i] = 1;
+    l->RUNNING[i] = -1;
+    l->PSR[i] = PSR_USER;
+    l->SAVED_SSP[i] = SUPERVISOR_STACK;
+  }
+  return l;
+}
+
+void lc3_lanes_destroy(lc3_lanes *l) {
+  free(l);
+}
+
+/**************************************************************/
+/*                                                            */
+/* Procedure : lc3_lanes_load                                 */
+/*                                                            */
+/* Purpose   : Load a program into every lane, through a      */
+/*             scratch machine so the file is parsed the same */
+/*             way lc3_load() does. Every page it wrote, for  */
+/*             each segment of an image, is copied whole.     */
+/*                                                            */
+/**************************************************************/
+int lc3_lanes_load(lc3_lanes *l, const char *program_filename) {
+  lc3_machine *m = lc3_create(LC3_ENGINE_SWITCH);
+  System_Latches latches;
+  int words, program_base, page, i;
+
+  if (m == NULL)
+    return LC3_ERR_NOMEM;
+  words = lc3_load(m, program_filename);
+  if (words < 0) {
+    lc3_destroy(m);
+    return words;
+  }
+  lc3_get_regs(m, &latches);
+  program_base = latches.PC;
+
+  for (page = 0; page < PAGES_IN_MEM; page++) {
+    if (!m->DIRTY[page])
+      continue;
+    for (i = page << PAGE_SHIFT; i < (page + 1) << PAGE_SHIFT; i++)
+      l->MEMORY[i] = (Lane_Vec){0} + m->MEMORY[i];
+  }
+  for (i = 0; i < l->LANES; i++)
+    if (l->PC[i] == 0) l->PC[i] = program_base;
+
+  lc3_destroy(m);
+  return words;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Intruction set, one group of lanes at a time                */
+/*                                                             */
+/***************************************************************/
+
+/*
+ * Write a result to DR and set N/Z/P from it, for the group's lanes.
+ * Vectors go by pointer: by value they would need a wider ABI than
+ * the one the rest of the library is built for.
+ */
+static void lanes_set_result(lc3_lanes *l, const Lane_Vec *group, int dr, const Lane_Vec *value) {
+  Lane_Vec n = ((*value & 0x8000) != 0) & 1;
+  Lane_Vec z = (*value == 0) & 1;
+
+  l->REGS[dr] = LANE_BLEND(*group, *value, l->REGS[dr]);
+  l->N = LANE_BLEND(*group, n, l->N);
+  l->Z = LANE_BLEND(*group, z, l->Z);
+  l->P = LANE_BLEND(*group, (n | z) ^ 1, l->P);
+}
+
+/*
+ * The device page as device_read() and device_write() have it for a
+ * machine without a console: no key ever comes in, display output is
+ * dropped, and clearing MCR[15] halts the lane.
+ */
+static int lanes_device_read(lc3_lanes *l, int lane, int address) {
+  switch (address) {
+  case DEVICE_KBSR: return l->KBSR[lane];
+  case DEVICE_KBDR: return 0;
+  case DEVICE_DSR:  return 0x8000 | l->DSR[lane];
+  case DEVICE_DDR:  return 0;
+  case DEVICE_TSR:  return l->TSR[lane];
+  case DEVICE_TIR:  return l->TIR[lane];
+  case DEVICE_MCR:  return 0x8000 | l->MCR[lane];
+  default:          return l->MEMORY[address][lane];
+  }
+}
+
+static void lanes_device_write(lc3_lanes *l, int lane, int address, int value) {
+  switch (address) {
+  case DEVICE_KBSR: l->KBSR[lane] = value & 0x4000; break;
+  case DEVICE_DSR:  l->DSR[lane] = value & 0x4000; break;
+  case DEVICE_TSR:  l->TSR[lane] = value & 0x4000; break;
+  case DEVICE_TIR:  l->TIR[lane] = Low16bits(value); break;
+  case DEVICE_KBDR:
+  case DEVICE_DDR:  break;
+  case DEVICE_MCR:
+    l->MCR[lane] = value & 0x7FFF;
+    if (!(value & 0x8000))
+      l->RUNNING[lane] = 0;
+    break;
+  default:
+    l->MEMORY[address][lane] = Low16bits(value);
+    break;
+  }
+}
+
+/* value[lane] = MEMORY[address[lane]][lane] for each lane in the group. */
+static void lanes_gather(lc3_lanes *l, const Lane_Vec *group, const Lane_Vec *address,
+                         Lane_Vec *value) {
+  int i;
+
+  for (i = 0; i < LC3_LANES; i++)
+    if (!(*group)[i])
+      (*value)[i] = 0;
+    else if (IS_DEVICE((*address)[i]))
+      (*value)[i] = lanes_device_read(l, i, (*address)[i]);
+    else
+      (*value)[i] = l->MEMORY[(*address)[i]][i];
+}
+
+static void lanes_scatter(lc3_lanes *l, const Lane_Vec *group, const Lane_Vec *address,
+                          const Lane_Vec *value) {
+  int i;
+
+  for (i = 0; i < LC3_LANES; i++)
+    if (!(*group)[i])
+      continue;
+    else if (IS_DEVICE((*address)[i]))
+      lanes_device_write(l, i, (*address)[i], (*value)[i]);
+    else
+      l->MEMORY[(*address)[i]][i] = Low16bits((*value)[i]);
+}
+
+/*
+ * TRAP as trap() runs it, per lane. Lanes have no console: GETC and
+ * IN read end of input (R0 = 0) and output is dropped.
+ */
+static void lanes_trap(lc3_lanes *l, const Lane_Vec *group, int vector, int next_pc) {
+  Lane_Vec native = *group & (l->MEMORY[vector] == 0);
+
+  if (vector < TRAP_GETC || vector > TRAP_HALT)
+    native = (Lane_Vec){0};
+  l->PC = LANE_BLEND(*group & ~native, l->MEMORY[vector], l->PC);
+  if (vector == TRAP_HALT) {
+    l->PC = LANE_BLEND(native, (Lane_Vec){0}, l->PC);
+    l->RUNNING &= ~native;
+    l->REGS[7] = LANE_BLEND(*group & ~native, (Lane_Vec){0} + next_pc, l->REGS[7]);
+    return;
+  }
+  if (vector == TRAP_GETC || vector == TRAP_IN)
+    l->REGS[0] = LANE_BLEND(native, (Lane_Vec){0}, l->REGS[0]);
+  l->REGS[7] = LANE_BLEND(*group, (Lane_Vec){0} + next_pc, l->REGS[7]);
+}
+
+/*
+ * RTI as return_from_interrupt() runs it, per lane: in user mode a
+ * privilege exception, or a halt with no handler at x0100.
+ */
+static void lanes_rti(lc3_lanes *l, const Lane_Vec *group, int pc) {
+  int i, sp, psr;
+
+  for (i = 0; i < LC3_LANES; i++) {
+    if (!(*group)[i])
+      continue;
+    if (l->PSR[i] & PSR_USER) {
+      if (l->MEMORY[VECTOR_TABLE + EXCEPTION_PRIVILEGE][i] == 0) {
+        l->RUNNING[i] = 0;
+        l->PC[i] = pc;
+        continue;
+      }
+      psr = l->PSR[i] | (l->N[i] << 2) | (l->Z[i] << 1) | l->P[i];
+      l->SAVED_USP[i] = l->REGS[6][i];
+      sp = Low16bits(l->SAVED_SSP[i] - 1);
+      l->MEMORY[sp][i] = psr;
+      sp = Low16bits(sp - 1);
+      l->MEMORY[sp][i] = pc;
+      l->REGS[6][i] = sp;
+      l->PSR[i] &= PSR_PRIORITY;
+      l->PC[i] = l->MEMORY[VECTOR_TABLE + EXCEPTION_PRIVILEGE][i];
+      continue;
+    }
+    sp = l->REGS[6][i];
+    l->PC[i] = l->MEMORY[sp][i];
+    psr = l->MEMORY[Low16bits(sp + 1)][i];
+    sp = Low16bits(sp + 2);
+    l->PSR[i] = psr & (PSR_USER | PSR_PRIORITY);
+    l->N[i] = (psr >> 2) & 1;
+    l->P[i] = !l->N[i] && (psr & 1);
+    l->Z[i] = !l->N[i] && !l->P[i];
+    if (psr & PSR_USER) {
+      l->SAVED_SSP[i] = sp;
+      sp = l->SAVED_USP[i];
+    }
+    l->REGS[6][i] = sp;
+  }
+}
+
+static void lanes_execute(lc3_lanes *l, Decoded_Intruction *d, const Lane_Vec *mask, int pc) {
+  Lane_Vec group = *mask, value, address, taken;
+  int next_pc = Low16bits(pc + 1), cell = Low16bits(next_pc + d->imm);
+
+  l->PC = LANE_BLEND(group, (Lane_Vec){0} + next_pc, l->PC);
+
+  switch (d->opcode) {
+  case 0b0001:	/* ADD */
+    value = l->REGS[d->sr1] + (d->imm_flag ? (Lane_Vec){0} + d->imm : l->REGS[d->sr2]);
+    value &= 0xFFFF;
+    lanes_set_result(l, &group, d->dr, &value);
+    break;
+  case 0b0101:	/* AND */
+    value = l->REGS[d->sr1] & (d->imm_flag ? (Lane_Vec){0} + d->imm : l->REGS[d->sr2]);
+    value &= 0xFFFF;
+    lanes_set_result(l, &group, d->dr, &value);
+    break;
+  case 0b1001:	/* NOT */
+    value = ~l->REGS[d->sr1] & 0xFFFF;
+    lanes_set_result(l, &group, d->dr, &value);
+    break;
+  case 0b0000:	/* BR */
+    taken = (l->N & ((d->nzp >> 2) & 1)) | (l->Z & ((d->nzp >> 1) & 1)) | (l->P & (d->nzp & 1));
+    taken = (taken != 0) & group;
+    l->PC = LANE_BLEND(taken, (Lane_Vec){0} + Low16bits(next_pc + d->imm), l->PC);
+    break;
+  case 0b1100:	/* JMP */
+    l->PC = LANE_BLEND(group, l->REGS[d->sr1], l->PC);
+    break;
+  case 0b0100:	/* JSR */
+    address = d->imm_flag ? (Lane_Vec){0} + Low16bits(next_pc + d->imm) : l->REGS[d->sr1];
+    l->REGS[7] = LANE_BLEND(group, (Lane_Vec){0} + next_pc, l->REGS[7]);
+    l->PC = LANE_BLEND(group, address, l->PC);
+    break;
+  case 0b0010:	/* LD */
+    address = (Lane_Vec){0} + cell;
+    if (IS_DEVICE(cell))
+      lanes_gather(l, &group, &address, &value);
+    else
+      value = l->MEMORY[cell];
+    value &= 0xFFFF;
+    lanes_set_result(l, &group, d->dr, &value);
+    break;
+  case 0b1010:	/* LDI */
+    value = (Lane_Vec){0} + cell;
+    if (IS_DEVICE(cell))
+      lanes_gather(l, &group, &value, &address);
+    else
+      address = l->MEMORY[cell];
+    lanes_gather(l, &group, &address, &value);
+    value &= 0xFFFF;
+    lanes_set_result(l, &group, d->dr, &value);
+    break;
+  case 0b0110:	/* LDR */
+    address = (l->REGS[d->sr1] + d->imm) & 0xFFFF;
+    lanes_gather(l, &group, &address, &value);
+    value &= 0xFFFF;
+    lanes_set_result(l, &group, d->dr, &value);
+    break;
+  case 0b1110:	/* LEA */
+    l->REGS[d->dr] = LANE_BLEND(group, (Lane_Vec){0} + Low16bits(next_pc + d->imm), l->REGS[d->dr]);
+    break;
+  case 0b0011:	/* ST */
+    address = (Lane_Vec){0} + cell;
+    if (IS_DEVICE(cell))
+      lanes_scatter(l, &group, &address, &l->REGS[d->dr]);
+    else
+      l->MEMORY[cell] = LANE_BLEND(group, l->REGS[d->dr] & 0xFFFF, l->MEMORY[cell]);
+    break;
+  case 0b1011:	/* STI */
+    value = (Lane_Vec){0} + cell;
+    if (IS_DEVICE(cell))
+      lanes_gather(l, &group, &value, &address);
+    else
+      address = l->MEMORY[cell];
+    lanes_scatter(l, &group, &address, &l->REGS[d->dr]);
+    break;
+  case 0b0111:	/* STR */
+    address = (l->REGS[d->sr1] + d->imm) & 0xFFFF;
+    lanes_scatter(l, &group, &address, &l->REGS[d->dr]);
+    break;
+  case 0b1111:	/* TRAP */
+    lanes_trap(l, &group, d->imm, next_pc);
+    break;
+  case 0b1000:	/* RTI */
+    lanes_rti(l, &group, pc);
+    break;
+  default:	/* the reserved opcode does nothing */
+    break;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_lanes_run                                   */
+/*                                                             */
+/* Purpose   : Run every lane until it halts or has executed   */
+/*             budget intructions. A lane halts the way        */
+/*             lc3_run() halts a machine: at HALT or when it   */
+/*             clears MCR[15].                                 */
+/*                                                             */
+/***************************************************************/
+int lc3_lanes_run(lc3_lanes *l, int budget) {
+  Lane_Vec left = (Lane_Vec){0} + budget;
+  Lane_Vec live, group;
+  Decoded_Intruction *d;
+  int i, leader, pc, word, steps, converged, running;
+
+  for (;;) {
+    live = l->RUNNING & (left > 0);
+
+    leader = -1;
+    for (i = 0; i < LC3_LANES; i++)
+      if (live[i] && (leader < 0 || l->PC[i] < l->PC[leader]))
+        leader = i;
+    if (leader < 0)
+      break;
+
+    pc = l->PC[leader];
+    word = l->MEMORY[pc][leader];
+    group = live & (l->PC == pc) & (l->MEMORY[pc] == word);
+
+    /*
+     * With every live lane in the group, no other lane can be
+     * waiting to merge, so the group may run on to the end of the
+     * block without looking for a new leader. steps keeps each
+     * lane inside its budget.
+     */
+    converged = TRUE;
+    steps = budget;
+    for (i = 0; i < LC3_LANES; i++)
+      if (live[i]) {
+        if (!group[i]) converged = FALSE;
+        else if (left[i] < steps) steps = left[i];
+      }
+
+    for (;;) {
+      d = &l->DECODED[pc];
+      if (!d->valid || d->intruction != word)
+        decode_intruction(word, d);
+      lanes_execute(l, d, &group, pc);
+
+      left += group;	/* group lanes are -1 */
+      group &= l->RUNNING;	/* a store to MCR may have halted some */
+
+      if (!converged || --steps == 0 || d->opcode == 0b0000 || d->opcode == 0b1100 ||
+          d->opcode == 0b0100 || d->opcode == 0b1111 || d->opcode == 0b1000)
+        break;
+      /* Lanes whose next word differs drop out and wait at pc. */
+      pc = Low16bits(pc + 1);
+      word = l->MEMORY[pc][leader];
+      group &= l->MEMORY[pc] == word;
+    }
+  }
+
+  running = 0;
+  for (i = 0; i < l->LANES; i++) {
+    l->COUNT[i] += budget - left[i];	/* what this run took */
+    if (l->RUNNING[i]) running++;
+  }
+  return running;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lane accessors                                  */
+/*                                                             */
+/* Purpose   : Read and write one lane's state between runs.   */
+/*                                                             */
+/***************************************************************/
+int lc3_lanes_halted(lc3_lanes *l, int lane) {
+  return l->RUNNING[lane] == 0;
+}
+
+int lc3_lanes_read_mem(lc3_lanes *l, int lane, int address) {
+  return l->MEMORY[Low16bits(address)][lane];
+}
+
+void lc3_lanes_write_mem(lc3_lanes *l, int lane, int address, int value) {
+  l->MEMORY[Low16bits(address)][lane] = Low16bits(value);
+}
+
+void lc3_lanes_get_regs(lc3_lanes *l, int lane, System_Latches *latches) {
+  int k;
+
+  latches->PC = l->PC[lane];
+  latches->N = l->N[lane];
+  latches->Z = l->Z[lane];
+  latches->P = l->P[lane];
+  for (k = 0; k < LC_3_REGS; k++)
+    latches->REGS[k] = l->REGS[k][lane];
+}
+
+void lc3_lanes_set_regs(lc3_lanes *l, int lane, const System_Latches *latches) {
+  int k;
+
+  l->PC[lane] = latches->PC;
+  l->N[lane] = latches->N;
+  l->Z[lane] = latches->Z;
+  l->P[lane] = latches->P;
+  for (k = 0; k < LC_3_REGS; k++)
+    l->REGS[k][lane] = latches->REGS[k];
+}
+
+long long lc3_lanes_count(lc3_lanes *l, int lane) {
+  return l->COUNT[lane];
+}
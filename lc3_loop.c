@@ -0,0 +1,189 @@
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Loop fast-forwarding                                        */
+/*                                                             */
+/*   decode() marks a backward BR as OP_STOP when it closes a  */
+/*   loop whose outcome can be worked out without running it:  */
+/*                                                             */
+/*   - an idle loop, a BR to itself. Once taken nothing but    */
+/*     intruction_COUNT changes until an interrupt comes.      */
+/*   - a counted loop of up to LOOP_BODY register intructions  */
+/*     (ADD, AND, NOT, LEA) ending in ADD Rc, Rc, #step, with  */
+/*     BRp/BRzp for a negative step or BRn/BRnz for a positive */
+/*     one. Every other register in it is written by one       */
+/*     intruction reading only itself and registers the body   */
+/*     leaves alone, so after n iterations it holds a closed   */
+/*     form: R + n*imm, R + n*S, R << n, R & X once, ~R n      */
+/*     times, or its single value.                             */
+/*                                                             */
+/*   The engine stops in front of the BR and loop_run() jumps  */
+/*   over as many whole iterations as fit in what is left of   */
+/*   the budget and before NEXT_EVENT, adding exactly what     */
+/*   they would have executed to intruction_COUNT, and to the  */
+/*   profile when there is one. Recording, tracing, the timing */
+/*   model and breakpoints see every intruction, so they step  */
+/*   the BR instead.                                           */
+/*   Build with -DNO_LOOP_SKIP to leave every loop to the      */
+/*   engines.                                                  */
+/*                                                             */
+/***************************************************************/
+
+#define LOOP_BODY 8
+
+typedef struct {
+  int TARGET,		/* first word of the body */
+    LENGTH,		/* body words, 0 for an idle loop */
+    COUNTER,		/* Rc */
+    STEP;		/* added to Rc per iteration */
+  Decoded_Intruction BODY[LOOP_BODY];
+} Loop;
+
+static int is_register_op(const Decoded_Intruction *d) {
+  return d->opcode == 0b0001 || d->opcode == 0b0101 || d->opcode == 0b1001 ||
+    d->opcode == 0b1110;
+}
+
+/* Whether the BR d at address closes a loop loop_run() can skip. */
+static int loop_shape(lc3_machine *m, int address, const Decoded_Intruction *d, Loop *loop) {
+  Decoded_Intruction *counter;
+  int i, j, written = 0;
+
+  if (d->opcode != 0b0000 || d->nzp == 0 || d->imm >= 0 || d->imm < -(LOOP_BODY + 1) ||
+      address + 1 + d->imm < 0)
+    return FALSE;
+  loop->TARGET = address + 1 + d->imm;
+  loop->LENGTH = -d->imm - 1;
+  if (loop->LENGTH == 0)
+    return TRUE;
+
+  for (i = 0; i < loop->LENGTH; i++) {
+    decode_intruction(m->MEMORY[loop->TARGET + i], &loop->BODY[i]);
+    if (!is_register_op(&loop->BODY[i]) || (written & (1 << loop->BODY[i].dr)))
+      return FALSE;	/* memory, control, or a register written twice */
+    written |= 1 << loop->BODY[i].dr;
+  }
+
+  counter = &loop->BODY[loop->LENGTH - 1];
+  if (counter->opcode != 0b0001 || !counter->imm_flag || counter->sr1 != counter->dr ||
+      counter->imm == 0)
+    return FALSE;
+  if (counter->imm < 0 ? d->nzp != 1 && d->nzp != 3 : d->nzp != 4 && d->nzp != 6)
+    return FALSE;	/* not an exit Rc is heading for */
+  loop->COUNTER = counter->dr;
+  loop->STEP = counter->imm;
+
+  for (i = 0; i < loop->LENGTH - 1; i++) {
+    if (intruction_reads(&loop->BODY[i]) & written & ~(1 << loop->BODY[i].dr))
+      return FALSE;	/* reads a register the body changes */
+    for (j = 0; j < loop->LENGTH; j++)
+      if (j != i && (intruction_reads(&loop->BODY[j]) & (1 << loop->BODY[i].dr)))
+        return FALSE;	/* another intruction reads what it writes */
+  }
+  return TRUE;
+}
+
+int loop_stops_at(lc3_machine *m, int address, const Decoded_Intruction *d) {
+#ifdef NO_LOOP_SKIP
+  return FALSE;
+#else
+  Loop loop;
+
+  return loop_shape(m, address, d, &loop);
+#endif
+}
+
+/* What body intruction d at address leaves in DR after n >= 1 iterations. */
+static int loop_closed(const Decoded_Intruction *d, int address, const int regs[], int n) {
+  unsigned int r = regs[d->dr], times = n;
+  int a = d->sr1 == d->dr, b = !d->imm_flag && d->sr2 == d->dr;
+
+  switch (d->opcode) {
+  case 0b0001:
+    if (d->imm_flag)
+      return Low16bits(a ? r + times * d->imm : (unsigned int) (regs[d->sr1] + d->imm));
+    if (a && b)
+      return n >= 16 ? 0 : Low16bits(r << n);
+    if (a || b)
+      return Low16bits(r + times * regs[a ? d->sr2 : d->sr1]);
+    return Low16bits(regs[d->sr1] + regs[d->sr2]);
+  case 0b0101:
+    return regs[d->sr1] & (d->imm_flag ? Low16bits(d->imm) : regs[d->sr2]);
+  case 0b1001:
+    return a ? (n & 1 ? Low16bits(~r) : r) : Low16bits(~regs[d->sr1]);
+  default:
+    return Low16bits(address + 1 + d->imm);	/* LEA */
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : loop_run                                        */
+/*                                                             */
+/* Purpose   : Run the marked BR at the PC, and with it as     */
+/*             many iterations of its loop as fit in limit     */
+/*             intructions. Returns how many were executed.    */
+/*                                                             */
+/***************************************************************/
+int loop_run(lc3_machine *m, int limit) {
+  System_Latches *l = &m->CURRENT_LATCHES;
+  Decoded_Intruction d;
+  Loop loop;
+  int pc = l->PC, regs[8], value, last, more, n, i;
+
+  decode_intruction(m->MEMORY[pc], &d);
+  if (!loop_shape(m, pc, &d, &loop)) {
+    decode_drop(m, pc);	/* the body changed since decode() */
+    step_decoded(m, &d);
+    return 1;
+  }
+  if (m->RECORD != NULL || m->TRACE != NULL || m->TIMING != NULL || m->DEBUG != NULL ||
+      !((d.nzp & 4 && l->N) || (d.nzp & 2 && l->Z) || (d.nzp & 1 && l->P))) {
+    step_decoded(m, &d);
+    return 1;
+  }
+
+  if (loop.LENGTH == 0) {
+    m->intruction_COUNT += limit;	/* spins on the BR */
+    if (m->PROFILE != NULL)
+      profile_loop(m, pc, pc, limit - 1, FALSE);
+    return limit;
+  }
+
+  /* Rc after the first iteration, and how many more follow it. */
+  value = x_to_32(Low16bits(l->REGS[loop.COUNTER] + loop.STEP), 16);
+  last = d.nzp & 2 ? 0 : loop.STEP < 0 ? 1 : -1;	/* the last Rc that loops */
+  if (loop.STEP < 0)
+    more = value >= last ? (value - last) / -loop.STEP + 1 : 0;
+  else
+    more = value <= last ? (last - value) / loop.STEP + 1 : 0;
+
+  /* The BR, then n iterations of the body and its BR. */
+  n = (limit - 1) / (loop.LENGTH + 1);
+  if (n > more + 1)
+    n = more + 1;
+  if (n == 0) {
+    step_decoded(m, &d);
+    return 1;
+  }
+
+  for (i = 0; i < 8; i++)
+    regs[i] = l->REGS[i];
+  for (i = 0; i < loop.LENGTH - 1; i++)
+    l->REGS[loop.BODY[i].dr] = loop_closed(&loop.BODY[i], loop.TARGET + i, regs, n);
+  value = Low16bits(regs[loop.COUNTER] + (unsigned int) n * loop.STEP);
+  l->REGS[loop.COUNTER] = value;
+  l->N = (value & 0x8000) != 0;
+  l->Z = value == 0;
+  l->P = !l->N && !l->Z;
+  l->PC = n == more + 1 ? Low16bits(pc + 1) : loop.TARGET;
+
+  m->NEXT_LATCHES = *l;
+  m->intruction_COUNT += 1 + n * (loop.LENGTH + 1);
+  if (m->PROFILE != NULL)
+    profile_loop(m, loop.TARGET, pc, n, n == more + 1);
+  if (m->ENGINE == LC3_ENGINE_JIT_CHECK)
+    jit_reset(m);	/* its JIT side missed the skip */
+  return 1 + n * (loop.LENGTH + 1);
+}
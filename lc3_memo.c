@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Subroutine memoization                                      */
+/*                                                             */
+/*   With memoization on, decode() marks JSR and JSRR as       */
+/*   OP_STOP and the engine leaves each call to memo_run().    */
+/*   The first calls of a routine run one intruction at a      */
+/*   time, loops loop_run() can skip aside, while              */
+/*   memo_record() notes what they depend on: the registers    */
+/*   and condition codes read before being written, and every  */
+/*   word read, the intructions fetched included. A call that  */
+/*   gets back through JMP R7 without storing, trapping or     */
+/*   touching the device page is remembered as those inputs    */
+/*   and what it left: the registers it wrote, the condition   */
+/*   codes, the PC it returned to and how many intructions it  */
+/*   took. The call site is an input too, since the return     */
+/*   address the JSR puts in R7 comes from it.                 */
+/*                                                             */
+/*   Running the same code from the same registers over the    */
+/*   same words does the same thing, so a later call whose     */
+/*   inputs all match an entry gets its outcome applied and    */
+/*   its intructions added to intruction_COUNT in one go.      */
+/*   Code rewritten since is caught by the fetched words in    */
+/*   the read set. A routine that writes memory, traps, or     */
+/*   keeps missing is given up on and its calls run as usual.  */
+/*   Recording, tracing, the timing model, breakpoints and the */
+/*   profile see every intruction, so with any of them on      */
+/*   calls just run.                                           */
+/*                                                             */
+/***************************************************************/
+
+#define MEMO_ENTRIES 16	/* outcomes kept per routine */
+#define MEMO_READS   64	/* words one remembered call may read */
+#define MEMO_TRIES   64	/* misses beyond the hits before giving up */
+#define MEMO_LENGTH  (1 << 16)	/* longest call remembered, in intructions */
+#define MEMO_CC      (1 << LC_3_REGS)	/* the condition codes, in register masks */
+
+typedef struct Memo_Read_Struct {
+  uint16_t address, value;
+} Memo_Read;
+
+typedef struct Memo_Entry_Struct {
+  int VALID;
+  int CALL;		/* PC of the JSR or JSRR, so R7 and the return match */
+  int INPUTS;		/* registers and MEMO_CC read before written */
+  int IN[LC_3_REGS], IN_CC;
+  int OUTPUTS;		/* registers and MEMO_CC written */
+  int OUT[LC_3_REGS], OUT_CC, OUT_PC;
+  int LENGTH;		/* intructions, the JSR included */
+  int READS;
+  Memo_Read READ[MEMO_READS];
+} Memo_Entry;
+
+typedef struct Memo_Routine_Struct {
+  int GIVEN_UP;
+  int HITS, MISSES;
+  int NEXT;		/* entry replaced next */
+  Memo_Entry ENTRY[MEMO_ENTRIES];
+} Memo_Routine;
+
+struct Memo_Struct {
+  Memo_Routine *ROUTINE[WORDS_IN_MEM];	/* by entry PC, NULL until called */
+  unsigned int SEEN[WORDS_IN_MEM];	/* GENERATION once read by this call */
+  unsigned int GENERATION;
+  lc3_memo_stats STATS;
+};
+
+static int cc_of(const System_Latches *l) {
+  return (l->N << 2) | (l->Z << 1) | l->P;
+}
+
+static void routines_free(Memo *memo) {
+  int i;
+
+  for (i = 0; i < WORDS_IN_MEM; i++) {
+    free(memo->ROUTINE[i]);
+    memo->ROUTINE[i] = NULL;
+  }
+}
+
+int memo_stops_at(lc3_machine *m, int address, const Decoded_Intruction *d) {
+  Memo_Routine *r;
+
+  if (m->MEMO == NULL || d->opcode != 0b0100)
+    return FALSE;
+  if (!d->imm_flag)
+    return TRUE;	/* JSRR: the target is known when it runs */
+  r = m->MEMO->ROUTINE[Low16bits(address + 1 + d->imm)];
+  return r == NULL || !r->GIVEN_UP;
+}
+
+static void give_up(lc3_machine *m, Memo_Routine *r, int call) {
+  r->GIVEN_UP = TRUE;
+  m->MEMO->STATS.given_up++;
+  decode_drop(m, call);	/* drop the mark */
+}
+
+/* Whether a call from the machine as it is would do what e did. */
+static int memo_matches(lc3_machine *m, const Memo_Entry *e) {
+  System_Latches *l = &m->CURRENT_LATCHES;
+  int i;
+
+  if (l->PC != e->CALL)
+    return FALSE;
+  for (i = 0; i < LC_3_REGS; i++)
+    if ((e->INPUTS & (1 << i)) && l->REGS[i] != e->IN[i])
+      return FALSE;
+  if ((e->INPUTS & MEMO_CC) && cc_of(l) != e->IN_CC)
+    return FALSE;
+  for (i = 0; i < e->READS; i++)
+    if (m->MEMORY[e->READ[i].address] != e->READ[i].value)
+      return FALSE;
+  return TRUE;
+}
+
+/* note_read() results, besides 0 for a word noted. */
+#define READ_FULL   1	/* the read set has no room left */
+#define READ_DEVICE 2	/* a device register, never remembered */
+
+/* Add the word at address to e's read set. */
+static int note_read(lc3_machine *m, Memo_Entry *e, int address) {
+  Memo *memo = m->MEMO;
+
+  address = Low16bits(address);
+  if (IS_DEVICE(address))
+    return READ_DEVICE;
+  if (memo->SEEN[address] == memo->GENERATION)
+    return 0;
+  if (e->READS == MEMO_READS)
+    return READ_FULL;
+  memo->SEEN[address] = memo->GENERATION;
+  e->READ[e->READS].address = address;
+  e->READ[e->READS].value = m->MEMORY[address];
+  e->READS++;
+  return 0;
+}
+
+/* The words d at the PC reads, itself included. */
+static int note_reads(lc3_machine *m, Memo_Entry *e, const Decoded_Intruction *d) {
+  System_Latches *l = &m->CURRENT_LATCHES;
+  int next_pc = Low16bits(l->PC + 1), result;
+
+  if ((result = note_read(m, e, l->PC)) != 0)
+    return result;
+  switch (d->opcode) {
+  case 0b0010:
+    return note_read(m, e, next_pc + d->imm);
+  case 0b1010:
+    if ((result = note_read(m, e, next_pc + d->imm)) != 0)
+      return result;
+    return note_read(m, e, m->MEMORY[Low16bits(next_pc + d->imm)]);
+  case 0b0110:
+    return note_read(m, e, l->REGS[d->sr1] + d->imm);
+  default:
+    return 0;
+  }
+}
+
+/*
+ * Whether this call already ran the body of the loop the BR d at pc
+ * closes, so its first iteration noted every input the loop has and
+ * loop_run() may skip the rest.
+ */
+static int body_seen(lc3_machine *m, int pc, const Decoded_Intruction *d) {
+  int address;
+
+  for (address = pc + 1 + d->imm; address < pc; address++)
+    if (m->MEMO->SEEN[address] != m->MEMO->GENERATION)
+      return FALSE;
+  return TRUE;
+}
+
+/* The registers and MEMO_CC d writes. */
+static int writes(const Decoded_Intruction *d) {
+  switch (d->opcode) {
+  case 0b0001: case 0b0101: case 0b1001: case 0b0010: case 0b1010: case 0b0110:
+    return (1 << d->dr) | MEMO_CC;
+  case 0b1110:
+    return 1 << d->dr;
+  case 0b0100:
+    return 1 << 7;
+  default:
+    return 0;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : memo_record                                     */
+/*                                                             */
+/* Purpose   : Run the call d at the PC to routine r one       */
+/*             intruction at a time, at most limit of them,    */
+/*             and remember it if it returns with nothing that */
+/*             rules it out. Returns how many were executed.   */
+/*                                                             */
+/***************************************************************/
+static int memo_record(lc3_machine *m, Memo_Routine *r, Decoded_Intruction *d, int limit) {
+  Memo *memo = m->MEMO;
+  System_Latches *l = &m->CURRENT_LATCHES;
+  Memo_Entry e;
+  int call = l->PC, executed, written = 0, depth = -1, used, i;
+
+  if (++memo->GENERATION == 0) {
+    memset(memo->SEEN, 0, sizeof(memo->SEEN));
+    memo->GENERATION = 1;
+  }
+  e.INPUTS = 0;
+  e.READS = 0;
+
+  for (executed = 0; executed < limit && executed < MEMO_LENGTH && m->RUN_BIT; ) {
+    switch (d->opcode) {
+    case 0b0011: case 0b1011: case 0b0111: case 0b1000: case 0b1101: case 0b1111:
+      give_up(m, r, call);	/* stores, traps, RTI */
+      return executed;
+    default:
+      break;
+    }
+    switch (note_reads(m, &e, d)) {
+    case READ_FULL:
+      return executed;
+    case READ_DEVICE:
+      give_up(m, r, call);
+      return executed;
+    default:
+      break;
+    }
+
+    used = intruction_reads(d) & ~written;
+    if (d->opcode == 0b0000 && d->nzp != 0)
+      used |= MEMO_CC & ~written;
+    for (i = 0; i < LC_3_REGS; i++)
+      if (used & (1 << i))
+        e.IN[i] = l->REGS[i];
+    if (used & MEMO_CC)
+      e.IN_CC = cc_of(l);
+    e.INPUTS |= used;
+    written |= writes(d);
+
+    if (d->opcode == 0b0000 && loop_stops_at(m, l->PC, d) && body_seen(m, l->PC, d)) {
+      executed += loop_run(m, limit - executed);
+      decode_intruction(m->MEMORY[l->PC], d);
+      continue;
+    }
+    execute_decoded(m, d);
+    executed++;
+    if (d->opcode == 0b0100)
+      depth++;
+    else if (d->opcode == 0b1100 && d->sr1 == 7 && depth-- == 0)
+      break;
+    decode_intruction(m->MEMORY[l->PC], d);
+  }
+  if (depth >= 0)
+    return executed;	/* still inside the call */
+
+  e.VALID = TRUE;
+  e.CALL = call;
+  e.OUTPUTS = written;
+  for (i = 0; i < LC_3_REGS; i++)
+    e.OUT[i] = l->REGS[i];
+  e.OUT_CC = cc_of(l);
+  e.OUT_PC = l->PC;
+  e.LENGTH = executed;
+  r->ENTRY[r->NEXT] = e;
+  r->NEXT = (r->NEXT + 1) % MEMO_ENTRIES;
+  memo->STATS.remembered++;
+  return executed;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : memo_run                                        */
+/*                                                             */
+/* Purpose   : The marked JSR or JSRR at the PC: apply a       */
+/*             remembered outcome of the call if one matches   */
+/*             and fits in limit intructions, else run it and  */
+/*             try to remember it. Returns how many were       */
+/*             executed.                                       */
+/*                                                             */
+/***************************************************************/
+int memo_run(lc3_machine *m, int limit) {
+  Memo *memo = m->MEMO;
+  System_Latches *l = &m->CURRENT_LATCHES;
+  Decoded_Intruction d;
+  Memo_Routine *r;
+  Memo_Entry *e;
+  int pc = l->PC, target, executed, i, k;
+
+  decode_intruction(m->MEMORY[pc], &d);
+  target = Low16bits(d.imm_flag ? pc + 1 + d.imm : l->REGS[d.sr1]);
+  r = memo->ROUTINE[target];
+  if (r == NULL)
+    r = memo->ROUTINE[target] = calloc(1, sizeof(Memo_Routine));
+  if (r == NULL || r->GIVEN_UP || m->RECORD != NULL || m->TRACE != NULL ||
+      m->TIMING != NULL || m->DEBUG != NULL || m->PROFILE != NULL) {
+    step_decoded(m, &d);
+    return 1;
+  }
+
+  memo->STATS.calls++;
+  for (i = 0; i < MEMO_ENTRIES; i++) {
+    e = &r->ENTRY[i];
+    if (!e->VALID || !memo_matches(m, e))
+      continue;
+    if (e->LENGTH > limit)
+      break;	/* runs past the budget or the next event */
+    for (k = 0; k < LC_3_REGS; k++)
+      if (e->OUTPUTS & (1 << k))
+        l->REGS[k] = e->OUT[k];
+    if (e->OUTPUTS & MEMO_CC) {
+      l->N = (e->OUT_CC >> 2) & 1;
+      l->Z = (e->OUT_CC >> 1) & 1;
+      l->P = e->OUT_CC & 1;
+    }
+    l->PC = e->OUT_PC;
+    m->NEXT_LATCHES = *l;
+    m->intruction_COUNT += e->LENGTH;
+    r->HITS++;
+    memo->STATS.hits++;
+    memo->STATS.skipped += e->LENGTH;
+    if (m->ENGINE == LC3_ENGINE_JIT_CHECK)
+      jit_reset(m);	/* its JIT side missed the call */
+    return e->LENGTH;
+  }
+
+  r->MISSES++;
+  memo->STATS.misses++;
+  executed = memo_record(m, r, &d, limit);
+  if (!r->GIVEN_UP && r->MISSES - r->HITS > MEMO_TRIES)
+    give_up(m, r, pc);
+  if (m->ENGINE == LC3_ENGINE_JIT_CHECK)
+    jit_reset(m);
+  return executed;
+}
+
+void memo_reset(lc3_machine *m) {
+  if (m->MEMO == NULL)
+    return;
+  routines_free(m->MEMO);
+  memset(&m->MEMO->STATS, 0, sizeof(m->MEMO->STATS));
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_memo                                        */
+/*                                                             */
+/* Purpose   : Turn memoization on or off.                     */
+/*                                                             */
+/***************************************************************/
+int lc3_memo(lc3_machine *m, int on) {
+  if (on && m->MEMO == NULL) {
+    if ((m->MEMO = calloc(1, sizeof(Memo))) == NULL)
+      return LC3_ERR_NOMEM;
+    decode_reset(m);
+  } else if (!on && m->MEMO != NULL) {
+    routines_free(m->MEMO);
+    free(m->MEMO);
+    m->MEMO = NULL;
+    decode_reset(m);
+  }
+  return 0;
+}
+
+int lc3_memo_report(lc3_machine *m, lc3_memo_stats *stats) {
+  if (m->MEMO == NULL)
+    return -1;
+  *stats = m->MEMO->STATS;
+  return 0;
+}
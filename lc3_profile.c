@@ -0,0 +1,290 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Profiling engine                                            */
+/*                                                             */
+/*   The switch engine with counters: execute() hands every    */
+/*   intruction the handlers in lc3_core.c ran to              */
+/*   profile_count(), their loads and stores come through      */
+/*   profile_access(), and loop_run() adds the iterations it   */
+/*   skips with profile_loop(). Per word it keeps executions,  */
+/*   BR taken/not taken, memory reads and writes, and JSR/JSRR */
+/*   calls to that target, and it marks the words reached by a */
+/*   control transfer as block leaders. Blocks and loops are   */
+/*   rebuilt from these counts when the report is written.     */
+/*                                                             */
+/***************************************************************/
+struct Profile_Struct {
+  unsigned long long EXEC[WORDS_IN_MEM];
+  unsigned long long TAKEN[WORDS_IN_MEM], NOT_TAKEN[WORDS_IN_MEM];
+  unsigned long long READS[WORDS_IN_MEM], WRITES[WORDS_IN_MEM];
+  unsigned long long CALLS[WORDS_IN_MEM];
+  unsigned long long OPCODES[16];
+  unsigned char LEADER[WORDS_IN_MEM];
+  int ENTERED;		/* the next intruction starts a block */
+};
+
+/* How many lines each ranked section of the report gets. */
+#define PROFILE_TOP 10
+
+static const char *OPCODE_NAMES[16] = {
+  "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+  "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP"
+};
+
+int profile_init(lc3_machine *m) {
+  m->PROFILE = calloc(1, sizeof(Profile));
+  if (m->PROFILE == NULL)
+    return FALSE;
+  m->PROFILE->ENTERED = TRUE;
+  return TRUE;
+}
+
+void profile_free(lc3_machine *m) {
+  free(m->PROFILE);
+  m->PROFILE = NULL;
+}
+
+void profile_reset(lc3_machine *m) {
+  if (m->PROFILE == NULL)
+    return;
+  memset(m->PROFILE, 0, sizeof(Profile));
+  m->PROFILE->ENTERED = TRUE;
+}
+
+static int is_control(int opcode) {
+  return opcode == 0b0000 || opcode == 0b1100 || opcode == 0b0100 || opcode == 0b1111 ||
+    opcode == 0b1000;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : profile_count                                   */
+/*                                                             */
+/* Purpose   : From execute(): count the intruction d that     */
+/*             just ran at the PC in CURRENT_LATCHES, with     */
+/*             the next PC in NEXT_LATCHES.                    */
+/*                                                             */
+/***************************************************************/
+void profile_count(lc3_machine *m, const Decoded_Intruction *d) {
+  Profile *p = m->PROFILE;
+  System_Latches *l = &m->CURRENT_LATCHES;
+  int pc = l->PC;
+
+  p->EXEC[pc]++;
+  p->OPCODES[d->opcode]++;
+  if (p->ENTERED)
+    p->LEADER[pc] = TRUE;
+  p->ENTERED = is_control(d->opcode);
+
+  switch (d->opcode) {
+  case 0b0000:
+    if (((d->nzp & 4) && l->N) || ((d->nzp & 2) && l->Z) || ((d->nzp & 1) && l->P))
+      p->TAKEN[pc]++;
+    else
+      p->NOT_TAKEN[pc]++;
+    break;
+  case 0b0100:
+    p->CALLS[m->NEXT_LATCHES.PC]++;
+    break;
+  case 0b1111:
+    p->READS[d->imm]++;	/* the trap vector */
+    break;
+  default:
+    break;
+  }
+}
+
+/* From read_memory() and store_memory(): a load or store at address. */
+void profile_access(lc3_machine *m, int address, int write) {
+  if (write)
+    m->PROFILE->WRITES[Low16bits(address)]++;
+  else
+    m->PROFILE->READS[Low16bits(address)]++;
+}
+
+/*
+ * From loop_run(): the BR at pc ran, then n iterations of the body
+ * from target and the BR again, the last of them falling through
+ * if exits. Counted as if each had run.
+ */
+void profile_loop(lc3_machine *m, int target, int pc, int n, int exits) {
+  Profile *p = m->PROFILE;
+  Decoded_Intruction d;
+  int address;
+
+  for (address = target; address < pc; address++) {
+    decode_intruction(m->MEMORY[address], &d);
+    p->EXEC[address] += n;
+    p->OPCODES[d.opcode] += n;
+  }
+  p->EXEC[pc] += n + 1;
+  p->OPCODES[0b0000] += n + 1;
+  p->TAKEN[pc] += exits ? n : n + 1;
+  p->NOT_TAKEN[pc] += exits ? 1 : 0;
+  if (p->ENTERED)
+    p->LEADER[pc] = TRUE;
+  if (n > 0)
+    p->LEADER[target] = TRUE;
+  p->ENTERED = TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_profile_report                              */
+/*                                                             */
+/* Purpose   : Rank what the profiling engine counted. A block */
+/*             runs from a leader to the next control          */
+/*             intruction or leader; a loop is a BR taken back */
+/*             to or above itself, and its cost is everything  */
+/*             executed between target and branch.             */
+/*                                                             */
+/***************************************************************/
+typedef struct Profile_Line_Struct {
+  int start, end;
+  unsigned long long count, cost;
+} Profile_Line;
+
+static int compare_lines(const void *a, const void *b) {
+  const Profile_Line *x = a, *y = b;
+
+  if (x->cost != y->cost)
+    return x->cost < y->cost ? 1 : -1;
+  return x->start - y->start;
+}
+
+static unsigned long long executed_between(const Profile *p, int start, int end) {
+  unsigned long long sum = 0;
+  int pc;
+
+  for (pc = start; pc <= end; pc++)
+    sum += p->EXEC[pc];
+  return sum;
+}
+
+static double percent(unsigned long long part, unsigned long long total) {
+  return total ? 100.0 * part / total : 0.0;
+}
+
+int lc3_profile_report(lc3_machine *m, FILE *report) {
+  Profile *p = m->PROFILE;
+  Profile_Line *lines;
+  Decoded_Intruction d;
+  unsigned long long total = 0;
+  int pc, end, target, count, i;
+
+  if (p == NULL)
+    return -1;
+  lines = malloc(WORDS_IN_MEM * sizeof(Profile_Line));
+  if (lines == NULL)
+    return LC3_ERR_NOMEM;
+  for (i = 0; i < 16; i++)
+    total += p->OPCODES[i];
+
+  fprintf(report, "\nProfile : %llu intructions\n", total);
+  fprintf(report, "-------------------------------------\n");
+
+  fprintf(report, "Opcodes:\n");
+  for (i = 0; i < 16; i++) {
+    lines[i].start = i;
+    lines[i].cost = p->OPCODES[i];
+  }
+  qsort(lines, 16, sizeof(Profile_Line), compare_lines);
+  for (i = 0; i < 16 && lines[i].cost > 0; i++)
+    fprintf(report, "  %-4s %12llu  %5.1f%%\n", OPCODE_NAMES[lines[i].start],
+            lines[i].cost, percent(lines[i].cost, total));
+
+  /* Basic blocks, split at leaders and control intructions. */
+  count = 0;
+  for (pc = 0; pc < WORDS_IN_MEM; pc++) {
+    if (!p->LEADER[pc] || p->EXEC[pc] == 0)
+      continue;
+    for (end = pc; end + 1 < WORDS_IN_MEM && !p->LEADER[end + 1]; end++) {
+      decode_intruction(m->MEMORY[end], &d);
+      if (is_control(d.opcode))
+        break;
+    }
+    lines[count].start = pc;
+    lines[count].end = end;
+    lines[count].count = p->EXEC[pc];
+    lines[count].cost = executed_between(p, pc, end);
+    count++;
+  }
+  qsort(lines, count, sizeof(Profile_Line), compare_lines);
+  fprintf(report, "Hottest blocks:\n");
+  for (i = 0; i < count && i < PROFILE_TOP; i++)
+    fprintf(report, "  0x%.4x..0x%.4x : entered %llu, %llu intructions (%.1f%%)\n",
+            lines[i].start, lines[i].end, lines[i].count, lines[i].cost,
+            percent(lines[i].cost, total));
+
+  /* Loops, one per backward BR that was taken. */
+  count = 0;
+  for (pc = 0; pc < WORDS_IN_MEM; pc++) {
+    if (p->TAKEN[pc] == 0)
+      continue;
+    decode_intruction(m->MEMORY[pc], &d);
+    target = Low16bits(pc + 1 + d.imm);
+    if (d.opcode != 0b0000 || target > pc)
+      continue;
+    lines[count].start = target;
+    lines[count].end = pc;
+    lines[count].count = p->TAKEN[pc];
+    lines[count].cost = executed_between(p, target, pc);
+    count++;
+  }
+  qsort(lines, count, sizeof(Profile_Line), compare_lines);
+  fprintf(report, "Hottest loops:\n");
+  for (i = 0; i < count && i < PROFILE_TOP; i++)
+    fprintf(report, "  0x%.4x..0x%.4x : %llu iterations, %llu intructions (%.1f%%)\n",
+            lines[i].start, lines[i].end, lines[i].count, lines[i].cost,
+            percent(lines[i].cost, total));
+
+  /* Branches, by how often they were reached. */
+  count = 0;
+  for (pc = 0; pc < WORDS_IN_MEM; pc++)
+    if (p->TAKEN[pc] + p->NOT_TAKEN[pc] > 0) {
+      lines[count].start = pc;
+      lines[count].count = p->TAKEN[pc];
+      lines[count].cost = p->TAKEN[pc] + p->NOT_TAKEN[pc];
+      count++;
+    }
+  qsort(lines, count, sizeof(Profile_Line), compare_lines);
+  fprintf(report, "Branches:\n");
+  for (i = 0; i < count && i < PROFILE_TOP; i++)
+    fprintf(report, "  0x%.4x : taken %llu, not taken %llu\n",
+            lines[i].start, lines[i].count, lines[i].cost - lines[i].count);
+
+  count = 0;
+  for (pc = 0; pc < WORDS_IN_MEM; pc++)
+    if (p->CALLS[pc] > 0) {
+      lines[count].start = pc;
+      lines[count].cost = p->CALLS[pc];
+      count++;
+    }
+  qsort(lines, count, sizeof(Profile_Line), compare_lines);
+  fprintf(report, "Calls:\n");
+  for (i = 0; i < count && i < PROFILE_TOP; i++)
+    fprintf(report, "  0x%.4x : %llu calls\n", lines[i].start, lines[i].cost);
+
+  count = 0;
+  for (pc = 0; pc < WORDS_IN_MEM; pc++)
+    if (p->READS[pc] + p->WRITES[pc] > 0) {
+      lines[count].start = pc;
+      lines[count].count = p->READS[pc];
+      lines[count].cost = p->READS[pc] + p->WRITES[pc];
+      count++;
+    }
+  qsort(lines, count, sizeof(Profile_Line), compare_lines);
+  fprintf(report, "Memory:\n");
+  for (i = 0; i < count && i < PROFILE_TOP; i++)
+    fprintf(report, "  0x%.4x : %llu reads, %llu writes\n",
+            lines[i].start, lines[i].count, lines[i].cost - lines[i].count);
+  fprintf(report, "\n");
+
+  free(lines);
+  return 0;
+}
@@ -0,0 +1,580 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Record and replay                                           */
+/*                                                             */
+/*   While recording, every intruction runs through            */
+/*   record_step(), which keeps the CURRENT_LATCHES it started */
+/*   from and, once NEXT_LATCHES has been latched, logs only   */
+/*   what it overwrote: one 8-byte entry per register or       */
+/*   memory word that changed, with the old value, the PC and  */
+/*   the condition codes. An intruction that changes nothing  */
+/*   still gets one entry; a TRAP that sets R0 and R7 gets two,*/
+/*   the first flagged RECORD_MORE. Taking an interrupt is     */
+/*   logged the same way, as a group flagged RECORD_INTERRUPT  */
+/*   that is undone without counting an intruction.            */
+/*                                                             */
+/*   Entries fill fixed chunks that a writer thread appends to */
+/*   the log file, so the run only pays for the copy. The file */
+/*   is a 16-byte header ("LC3R", u16 version, u16 entry size, */
+/*   u64 first intruction count) followed by the entries in    */
+/*   host byte order.                                          */
+/*                                                             */
+/*   Stepping back undoes entries from the end of the log. A   */
+/*   snapshot is taken every RECORD_INTERVAL intructions, so a */
+/*   long step back restores the first snapshot at or after    */
+/*   its target and only undoes from there. Running on after a */
+/*   step back starts a new history from that point.           */
+/*                                                             */
+/***************************************************************/
+
+#define RECORD_VERSION     2
+#define RECORD_HEADER      16
+#define RECORD_CHUNK       (1 << 16)	/* entries per chunk */
+#define RECORD_CHUNKS      4		/* chunk buffers */
+#define RECORD_CACHE       4096		/* entries read back at a time */
+#define RECORD_INTERVAL    (1 << 20)	/* intructions between snapshots */
+#define RECORD_CHECKPOINTS 64		/* snapshots kept, thinned when full */
+
+#define RECORD_NONE 0	/* only the PC and condition codes */
+#define RECORD_REG  1	/* where is a register */
+#define RECORD_MEM  2	/* where is a memory address */
+#define RECORD_SSP  3	/* where is the old PSR, old the old SAVED_SSP */
+#define RECORD_USP  4	/* where is the old PSR, old the old SAVED_USP */
+#define RECORD_KIND 0x3F
+#define RECORD_INTERRUPT 0x40	/* interrupt entry, not an intruction */
+#define RECORD_MORE 0x80	/* the next entry is the same intruction */
+
+typedef struct Record_Entry_Struct {
+  uint16_t pc;		/* the intruction */
+  uint16_t where;
+  uint16_t old;		/* value before it ran */
+  uint8_t kind;		/* RECORD_ kind, RECORD_MORE */
+  uint8_t cc;		/* N/Z/P before it ran, as nzp */
+} Record_Entry;
+
+typedef struct Record_Checkpoint_Struct {
+  long long count;	/* intruction_COUNT when taken */
+  long long position;	/* log entries before it */
+  lc3_snapshot *snapshot;
+} Record_Checkpoint;
+
+struct Record_Struct {
+  int FD;
+  long long START;	/* intruction_COUNT when recording began */
+
+  /* Chunks: CHUNK[FILL] is being filled, the PENDING before it wait for the writer. */
+  Record_Entry *CHUNK[RECORD_CHUNKS];
+  long long BASE[RECORD_CHUNKS];	/* log position of each chunk's first entry */
+  int FILL, LENGTH, PENDING;
+  int WRITE_ERROR, QUIT;
+  pthread_t WRITER;
+  pthread_mutex_t LOCK;
+  pthread_cond_t WAKE, DONE;
+
+  /* Entries read back from the file. */
+  Record_Entry CACHE[RECORD_CACHE];
+  long long CACHE_BASE;
+  int CACHE_LENGTH;
+
+  Record_Checkpoint CHECKPOINTS[RECORD_CHECKPOINTS];
+  int CHECKPOINTS_TAKEN;
+  int INTERVAL;
+  long long NEXT_CHECKPOINT;
+};
+
+static long long record_end(Record *r) {
+  return r->BASE[r->FILL] + r->LENGTH;
+}
+
+static off_t entry_offset(long long position) {
+  return RECORD_HEADER + (off_t) position * sizeof(Record_Entry);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : record_writer                                   */
+/*                                                             */
+/* Purpose   : Writer thread: append full chunks to the file   */
+/*             in the order they were filled.                  */
+/*                                                             */
+/***************************************************************/
+static void *record_writer(void *arg) {
+  Record *r = arg;
+  size_t bytes = RECORD_CHUNK * sizeof(Record_Entry);
+  int chunk;
+
+  pthread_mutex_lock(&r->LOCK);
+  for (;;) {
+    while (r->PENDING == 0 && !r->QUIT)
+      pthread_cond_wait(&r->WAKE, &r->LOCK);
+    if (r->PENDING == 0)
+      break;
+    chunk = (r->FILL - r->PENDING + RECORD_CHUNKS) % RECORD_CHUNKS;
+    pthread_mutex_unlock(&r->LOCK);
+
+    if (pwrite(r->FD, r->CHUNK[chunk], bytes, entry_offset(r->BASE[chunk])) != (ssize_t) bytes)
+      r->WRITE_ERROR = TRUE;
+
+    pthread_mutex_lock(&r->LOCK);
+    r->PENDING--;
+    pthread_cond_broadcast(&r->DONE);
+  }
+  pthread_mutex_unlock(&r->LOCK);
+  return NULL;
+}
+
+/* Wait until every full chunk is in the file. */
+static void record_sync(Record *r) {
+  pthread_mutex_lock(&r->LOCK);
+  while (r->PENDING > 0)
+    pthread_cond_wait(&r->DONE, &r->LOCK);
+  pthread_mutex_unlock(&r->LOCK);
+}
+
+/* Hand the full chunk to the writer and move on to the next buffer. */
+static void record_flip(Record *r) {
+  long long end = record_end(r);
+
+  pthread_mutex_lock(&r->LOCK);
+  while (r->PENDING == RECORD_CHUNKS - 1)
+    pthread_cond_wait(&r->DONE, &r->LOCK);
+  r->PENDING++;
+  r->FILL = (r->FILL + 1) % RECORD_CHUNKS;
+  r->BASE[r->FILL] = end;
+  r->LENGTH = 0;
+  r->CACHE_LENGTH = 0;	/* may hold what the file had there before */
+  pthread_cond_signal(&r->WAKE);
+  pthread_mutex_unlock(&r->LOCK);
+}
+
+static void record_append(Record *r, const Record_Entry *e) {
+  r->CHUNK[r->FILL][r->LENGTH++] = *e;
+  if (r->LENGTH == RECORD_CHUNK)
+    record_flip(r);
+}
+
+/* The entry at position, from the chunk being filled or the file. */
+static int record_entry(Record *r, long long position, Record_Entry *e) {
+  long long base;
+  ssize_t got;
+
+  if (position >= r->BASE[r->FILL]) {
+    *e = r->CHUNK[r->FILL][position - r->BASE[r->FILL]];
+    return 0;
+  }
+  if (position < r->CACHE_BASE || position >= r->CACHE_BASE + r->CACHE_LENGTH) {
+    /* Stepping back reads backwards; fetch the block ending here. */
+    base = position - position % RECORD_CACHE;
+    got = pread(r->FD, r->CACHE, RECORD_CACHE * sizeof(Record_Entry), entry_offset(base));
+    if (got < (ssize_t) ((position - base + 1) * sizeof(Record_Entry)))
+      return -1;
+    r->CACHE_BASE = base;
+    r->CACHE_LENGTH = got / sizeof(Record_Entry);
+  }
+  *e = r->CACHE[position - r->CACHE_BASE];
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : record_truncate                                 */
+/*                                                             */
+/* Purpose   : Make position the end of the log, after a step  */
+/*             back, and drop the snapshots past it.           */
+/*                                                             */
+/***************************************************************/
+static void record_truncate(lc3_machine *m, Record *r, long long position) {
+  long long base;
+  int i, kept = 0;
+
+  if (position < r->BASE[r->FILL]) {
+    /* Reload the partial chunk the log now ends in. */
+    record_sync(r);
+    base = position - position % RECORD_CHUNK;
+    if (pread(r->FD, r->CHUNK[r->FILL], (position - base) * sizeof(Record_Entry),
+              entry_offset(base)) != (ssize_t) ((position - base) * sizeof(Record_Entry)))
+      r->WRITE_ERROR = TRUE;
+    r->BASE[r->FILL] = base;
+    r->CACHE_LENGTH = 0;
+  }
+  r->LENGTH = position - r->BASE[r->FILL];
+
+  for (i = 0; i < r->CHECKPOINTS_TAKEN; i++) {
+    if (r->CHECKPOINTS[i].count > m->intruction_COUNT)
+      lc3_snapshot_free(r->CHECKPOINTS[i].snapshot);
+    else
+      r->CHECKPOINTS[kept++] = r->CHECKPOINTS[i];
+  }
+  r->CHECKPOINTS_TAKEN = kept;
+  r->NEXT_CHECKPOINT = (kept > 0 ? r->CHECKPOINTS[kept - 1].count : r->START) + r->INTERVAL;
+}
+
+/* Snapshot the machine; when the table is full keep every other one. */
+static void record_checkpoint(lc3_machine *m, Record *r) {
+  Record_Checkpoint *c;
+  int i;
+
+  if (r->CHECKPOINTS_TAKEN == RECORD_CHECKPOINTS) {
+    for (i = 0; i < RECORD_CHECKPOINTS; i++)
+      if (i % 2 == 0)
+        lc3_snapshot_free(r->CHECKPOINTS[i].snapshot);
+      else
+        r->CHECKPOINTS[i / 2] = r->CHECKPOINTS[i];
+    r->CHECKPOINTS_TAKEN = RECORD_CHECKPOINTS / 2;
+    r->INTERVAL *= 2;
+  }
+  r->NEXT_CHECKPOINT = m->intruction_COUNT + r->INTERVAL;
+
+  c = &r->CHECKPOINTS[r->CHECKPOINTS_TAKEN];
+  c->snapshot = lc3_snapshot_take(m);
+  if (c->snapshot == NULL)
+    return;	/* stepping back is just slower */
+  c->count = m->intruction_COUNT;
+  c->position = record_end(r);
+  r->CHECKPOINTS_TAKEN++;
+}
+
+/* Start the entry of an intruction or interrupt at the PC. */
+static void record_begin(lc3_machine *m, Record_Entry *e, int kind) {
+  e->pc = m->CURRENT_LATCHES.PC;
+  e->cc = (m->CURRENT_LATCHES.N << 2) | (m->CURRENT_LATCHES.Z << 1) | m->CURRENT_LATCHES.P;
+  e->kind = kind;
+  e->where = e->old = 0;
+}
+
+/* Log one more overwritten value, chaining the entry before it. */
+static void record_change(Record *r, Record_Entry *e, int kind, int where, int old) {
+  if ((e->kind & RECORD_KIND) != RECORD_NONE) {
+    e->kind |= RECORD_MORE;
+    record_append(r, e);
+  }
+  e->kind = (e->kind & RECORD_INTERRUPT) | kind;
+  e->where = where;
+  e->old = old;
+}
+
+/*
+ * What an interrupt entry or an RTI may overwrite besides the PC and
+ * condition codes: the mode, both stack pointers and the two words
+ * below the supervisor stack.
+ */
+typedef struct Record_Mode_Struct {
+  int psr, ssp, usp, r6, stack;
+  int words[2];
+} Record_Mode;
+
+static void mode_before(lc3_machine *m, Record_Mode *s) {
+  s->psr = m->PSR;
+  s->ssp = m->SAVED_SSP;
+  s->usp = m->SAVED_USP;
+  s->r6 = m->CURRENT_LATCHES.REGS[6];
+  s->stack = (m->PSR & PSR_USER) ? m->SAVED_SSP : s->r6;
+  s->words[0] = m->MEMORY[Low16bits(s->stack - 1)];
+  s->words[1] = m->MEMORY[Low16bits(s->stack - 2)];
+}
+
+static void mode_after(lc3_machine *m, Record *r, Record_Entry *e, const Record_Mode *s) {
+  int k, address;
+
+  if (m->PSR != s->psr || m->SAVED_SSP != s->ssp)
+    record_change(r, e, RECORD_SSP, s->psr, s->ssp);
+  if (m->SAVED_USP != s->usp)
+    record_change(r, e, RECORD_USP, s->psr, s->usp);
+  for (k = 0; k < 2; k++) {
+    address = Low16bits(s->stack - 1 - k);
+    if (m->MEMORY[address] != s->words[k])
+      record_change(r, e, RECORD_MEM, address, s->words[k]);
+  }
+  if (m->CURRENT_LATCHES.REGS[6] != s->r6)
+    record_change(r, e, RECORD_REG, 6, s->r6);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : record_step                                     */
+/*                                                             */
+/* Purpose   : Execute one decoded intruction and log what it  */
+/*             overwrote.                                      */
+/*                                                             */
+/***************************************************************/
+void record_step(lc3_machine *m, Decoded_Intruction *d) {
+  Record *r = m->RECORD;
+  Record_Entry e;
+  Record_Mode mode;
+  int target = store_target(m, d), regs[2], old[2], n = 0, k;
+
+  record_begin(m, &e, RECORD_NONE);
+  if (target >= 0 && !is_device_register(target)) {
+    e.kind = RECORD_MEM;
+    e.where = target;
+    e.old = m->MEMORY[target];
+  }
+
+  /* The registers it may write. */
+  switch (d->opcode) {
+  case 0b0001: case 0b0101: case 0b1001: case 0b0010:
+  case 0b1010: case 0b0110: case 0b1110:
+    regs[n++] = d->dr;
+    break;
+  case 0b0100:
+    regs[n++] = 7;
+    break;
+  case 0b1111:
+    regs[n++] = 0;
+    regs[n++] = 7;
+    break;
+  case 0b1000:
+    mode_before(m, &mode);
+    break;
+  }
+  for (k = 0; k < n; k++)
+    old[k] = m->CURRENT_LATCHES.REGS[regs[k]];
+
+  execute_decoded(m, d);
+
+  for (k = 0; k < n; k++)
+    if (m->CURRENT_LATCHES.REGS[regs[k]] != old[k])
+      record_change(r, &e, RECORD_REG, regs[k], old[k]);
+  if (d->opcode == 0b1000)
+    mode_after(m, r, &e, &mode);
+  record_append(r, &e);
+  if (m->intruction_COUNT >= r->NEXT_CHECKPOINT)
+    record_checkpoint(m, r);
+}
+
+/* interrupt_enter() at the PC, logged as a group of its own. */
+void record_interrupt(lc3_machine *m, int vector, int priority) {
+  Record_Entry e;
+  Record_Mode mode;
+
+  record_begin(m, &e, RECORD_INTERRUPT);
+  mode_before(m, &mode);
+  interrupt_enter(m, &m->CURRENT_LATCHES, vector, priority, m->CURRENT_LATCHES.PC);
+  mode_after(m, m->RECORD, &e, &mode);
+  record_append(m->RECORD, &e);
+}
+
+/* The engine while recording: the switch engine through record_step(). */
+int record_run(lc3_machine *m, int num_cycles) {
+  Decoded_Intruction *d;
+  int executed;
+
+  for (executed = 0; executed < num_cycles && m->RUN_BIT && m->intruction_COUNT < m->NEXT_EVENT;
+       executed++) {
+    d = DECODED_AT(m, m->CURRENT_LATCHES.PC);
+    if (!d->valid)
+      decode(m, m->CURRENT_LATCHES.PC, m->MEMORY[m->CURRENT_LATCHES.PC], d);
+    if (d->opcode == OP_STOP)
+      break;
+    record_step(m, d);
+  }
+  return executed;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_record / lc3_record_stop                    */
+/*                                                             */
+/* Purpose   : Start logging to a new file, and finish it.     */
+/*                                                             */
+/***************************************************************/
+int lc3_record(lc3_machine *m, const char *filename) {
+  unsigned char header[RECORD_HEADER] = { 'L', 'C', '3', 'R' };
+  Record *r;
+  int i;
+
+  lc3_record_stop(m);
+  r = calloc(1, sizeof(Record));
+  if (r == NULL)
+    return LC3_ERR_NOMEM;
+  for (i = 0; i < RECORD_CHUNKS; i++)
+    if ((r->CHUNK[i] = malloc(RECORD_CHUNK * sizeof(Record_Entry))) == NULL)
+      goto nomem;
+
+  r->FD = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (r->FD < 0) {
+    for (i = 0; i < RECORD_CHUNKS; i++)
+      free(r->CHUNK[i]);
+    free(r);
+    return LC3_ERR_OPEN;
+  }
+  r->START = m->intruction_COUNT;
+  header[4] = RECORD_VERSION;
+  header[6] = sizeof(Record_Entry);
+  header[8] = r->START & 0xFF;
+  header[9] = (r->START >> 8) & 0xFF;
+  header[10] = (r->START >> 16) & 0xFF;
+  header[11] = (r->START >> 24) & 0xFF;
+  header[12] = (r->START >> 32) & 0xFF;
+  header[13] = (r->START >> 40) & 0xFF;
+  header[14] = (r->START >> 48) & 0xFF;
+  header[15] = (r->START >> 56) & 0xFF;
+  if (pwrite(r->FD, header, RECORD_HEADER, 0) != RECORD_HEADER)
+    r->WRITE_ERROR = TRUE;
+
+  r->INTERVAL = RECORD_INTERVAL;
+  r->NEXT_CHECKPOINT = r->START + r->INTERVAL;
+  pthread_mutex_init(&r->LOCK, NULL);
+  pthread_cond_init(&r->WAKE, NULL);
+  pthread_cond_init(&r->DONE, NULL);
+  if (pthread_create(&r->WRITER, NULL, record_writer, r) != 0) {
+    close(r->FD);
+    goto nomem;
+  }
+  m->RECORD = r;
+  return 0;
+
+nomem:
+  for (i = 0; i < RECORD_CHUNKS; i++)
+    free(r->CHUNK[i]);
+  free(r);
+  return LC3_ERR_NOMEM;
+}
+
+int lc3_record_stop(lc3_machine *m) {
+  Record *r = m->RECORD;
+  size_t bytes;
+  int i, status;
+
+  if (r == NULL)
+    return 0;
+  pthread_mutex_lock(&r->LOCK);
+  r->QUIT = TRUE;
+  pthread_cond_signal(&r->WAKE);
+  pthread_mutex_unlock(&r->LOCK);
+  pthread_join(r->WRITER, NULL);
+
+  /* The partial chunk, then drop anything left from a longer history. */
+  bytes = r->LENGTH * sizeof(Record_Entry);
+  if (pwrite(r->FD, r->CHUNK[r->FILL], bytes, entry_offset(r->BASE[r->FILL])) != (ssize_t) bytes ||
+      ftruncate(r->FD, entry_offset(record_end(r))) != 0)
+    r->WRITE_ERROR = TRUE;
+  if (close(r->FD) != 0)
+    r->WRITE_ERROR = TRUE;
+  status = r->WRITE_ERROR ? LC3_ERR_OPEN : 0;
+
+  for (i = 0; i < r->CHECKPOINTS_TAKEN; i++)
+    lc3_snapshot_free(r->CHECKPOINTS[i].snapshot);
+  for (i = 0; i < RECORD_CHUNKS; i++)
+    free(r->CHUNK[i]);
+  pthread_mutex_destroy(&r->LOCK);
+  pthread_cond_destroy(&r->WAKE);
+  pthread_cond_destroy(&r->DONE);
+  free(r);
+  m->RECORD = NULL;
+  return status;
+}
+
+/*
+ * Undo the intruction or interrupt entry whose entries end at
+ * *position, moving it back over them. Returns FALSE if there is
+ * nothing left to undo.
+ */
+static int record_undo(lc3_machine *m, Record *r, long long *position) {
+  Record_Entry e, before;
+
+  if (*position == 0)
+    return FALSE;
+  do {
+    if (record_entry(r, --*position, &e) != 0)
+      return FALSE;
+    switch (e.kind & RECORD_KIND) {
+    case RECORD_REG:
+      m->CURRENT_LATCHES.REGS[e.where] = e.old;
+      break;
+    case RECORD_MEM:
+      write_memory(m, e.where, e.old);
+      break;
+    case RECORD_SSP:
+      m->PSR = e.where;
+      m->SAVED_SSP = e.old;
+      break;
+    case RECORD_USP:
+      m->PSR = e.where;
+      m->SAVED_USP = e.old;
+      break;
+    }
+  } while (*position > 0 && record_entry(r, *position - 1, &before) == 0 &&
+           (before.kind & RECORD_MORE));
+
+  m->CURRENT_LATCHES.PC = e.pc;
+  m->CURRENT_LATCHES.N = (e.cc >> 2) & 1;
+  m->CURRENT_LATCHES.Z = (e.cc >> 1) & 1;
+  m->CURRENT_LATCHES.P = e.cc & 1;
+  if (!(e.kind & RECORD_INTERRUPT))
+    m->intruction_COUNT--;
+  return TRUE;
+}
+
+/* Whether the entries ending at position are an interrupt entry. */
+static int record_at_interrupt(Record *r, long long position) {
+  Record_Entry e;
+
+  return position > 0 && record_entry(r, position - 1, &e) == 0 &&
+    (e.kind & RECORD_INTERRUPT);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : record_back                                     */
+/*                                                             */
+/* Purpose   : Step back up to n intructions, or with          */
+/*             at_break until the PC is on a breakpoint that   */
+/*             holds. Returns how many were undone.            */
+/*                                                             */
+/***************************************************************/
+static int record_back(lc3_machine *m, long long n, int at_break) {
+  Record *r = m->RECORD;
+  Record_Checkpoint *c = NULL;
+  long long position;
+  long long from = m->intruction_COUNT, target;
+  int i;
+
+  if (r == NULL)
+    return 0;
+  record_sync(r);	/* entries before the current chunk come from the file */
+  position = record_end(r);
+  target = from - r->START < n ? r->START : from - n;
+
+  /* Far back: start from the first snapshot at or after the target. */
+  if (!at_break) {
+    for (i = r->CHECKPOINTS_TAKEN - 1; i >= 0 && r->CHECKPOINTS[i].count >= target; i--)
+      c = &r->CHECKPOINTS[i];
+    if (c != NULL && c->count < from && lc3_snapshot_restore(m, c->snapshot) == 0)
+      position = c->position;
+  }
+
+  /* An interrupt taken at the target is undone too, as lc3_run() takes it. */
+  while ((m->intruction_COUNT > target || record_at_interrupt(r, position)) &&
+         record_undo(m, r, &position))
+    if (at_break && debug_reverse_stop(m))
+      break;
+  record_truncate(m, r, position);
+
+  m->NEXT_LATCHES = m->CURRENT_LATCHES;
+  if (m->intruction_COUNT < from)
+    m->RUN_BIT = TRUE;
+  events_rewind(m);
+  jit_reset(m);
+  return from - m->intruction_COUNT;
+}
+
+int lc3_rstep(lc3_machine *m, int n) {
+  return record_back(m, n, FALSE);
+}
+
+int lc3_rcontinue(lc3_machine *m) {
+  return record_back(m, m->intruction_COUNT, TRUE);
+}
+
+int lc3_recording(lc3_machine *m) {
+  return m->RECORD != NULL;
+}
@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Scheduler                                                   */
+/*                                                             */
+/*   Many machines on the caller's thread. Runnable machines   */
+/*   wait in a FIFO threaded through NEXT; the one at the head */
+/*   gets lc3_run() for a quantum and goes to the tail unless  */
+/*   it halted, used up its budget or stopped to wait for      */
+/*   input. A waiting machine is parked, off the queue, until  */
+/*   lc3_sched_feed() or lc3_sched_end() gives it something to */
+/*   read, so nothing is spent polling an idle session.        */
+/*                                                             */
+/*   Time is the scheduler's CLOCK, the intructions all its    */
+/*   machines have run, so the statistics come out the same on */
+/*   any host. READY_AT is when a machine last joined the      */
+/*   queue, for the dispatch latency; FED_AT when input woke   */
+/*   it, for the wake latency; SINCE when it last became       */
+/*   runnable, for the RUNNABLE clock its fair share is taken  */
+/*   of.                                                       */
+/*                                                             */
+/***************************************************************/
+
+typedef struct Sched_Entry_Struct {
+  lc3_machine *MACHINE;
+  long long LIMIT;	/* lc3_count() at which its budget is used up, or -1 */
+  int NEXT;		/* next in the run queue, or -1 */
+  long long READY_AT, FED_AT, SINCE;
+  lc3_sched_machine STATS;
+} Sched_Entry;
+
+struct lc3_sched {
+  Sched_Entry *ENTRY;
+  int COUNT, ROOM;
+  int HEAD, TAIL;	/* run queue, -1 when empty */
+  int QUANTUM;
+  long long CLOCK;
+  long long DISPATCH_SUM, WAKE_SUM;	/* for the means */
+  lc3_sched_stats STATS;
+};
+
+lc3_sched *lc3_sched_create(int quantum) {
+  lc3_sched *s;
+
+  if (quantum < 1)
+    return NULL;
+  if ((s = calloc(1, sizeof(lc3_sched))) == NULL)
+    return NULL;
+  s->HEAD = s->TAIL = -1;
+  s->QUANTUM = quantum;
+  return s;
+}
+
+void lc3_sched_destroy(lc3_sched *s) {
+  if (s == NULL)
+    return;
+  free(s->ENTRY);
+  free(s);
+}
+
+static void sched_queue(lc3_sched *s, int id) {
+  Sched_Entry *e = &s->ENTRY[id];
+
+  e->STATS.state = LC3_SCHED_READY;
+  e->READY_AT = s->CLOCK;
+  e->NEXT = -1;
+  if (s->TAIL < 0)
+    s->HEAD = id;
+  else
+    s->ENTRY[s->TAIL].NEXT = id;
+  s->TAIL = id;
+}
+
+/* Off the queue for good or until woken: close its runnable stretch. */
+static void sched_leave(lc3_sched *s, int id, int state) {
+  Sched_Entry *e = &s->ENTRY[id];
+
+  e->STATS.state = state;
+  e->STATS.runnable += s->CLOCK - e->SINCE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_sched_add                                   */
+/*                                                             */
+/* Purpose   : Give the machine a queued console and put it at */
+/*             the back of the run queue. Returns its id.      */
+/*                                                             */
+/***************************************************************/
+int lc3_sched_add(lc3_sched *s, lc3_machine *m, int budget) {
+  Sched_Entry *e;
+  int id, status;
+
+  if (s->COUNT == s->ROOM) {
+    e = realloc(s->ENTRY, (s->ROOM * 2 + 16) * sizeof(Sched_Entry));
+    if (e == NULL)
+      return LC3_ERR_NOMEM;
+    s->ENTRY = e;
+    s->ROOM = s->ROOM * 2 + 16;
+  }
+  if ((status = lc3_console_queue(m)) != 0)
+    return status;
+
+  id = s->COUNT++;
+  e = &s->ENTRY[id];
+  memset(e, 0, sizeof(Sched_Entry));
+  e->MACHINE = m;
+  e->LIMIT = budget >= 0 ? lc3_count(m) + budget : -1;
+  e->FED_AT = -1;
+  e->SINCE = s->CLOCK;
+  if (lc3_halted(m))
+    sched_leave(s, id, LC3_SCHED_HALTED);
+  else if (e->LIMIT == lc3_count(m))
+    sched_leave(s, id, LC3_SCHED_BUDGET);
+  else
+    sched_queue(s, id);
+  return id;
+}
+
+/* A parked machine got something to read. */
+static void sched_wake(lc3_sched *s, int id) {
+  Sched_Entry *e = &s->ENTRY[id];
+
+  if (e->STATS.state != LC3_SCHED_PARKED || lc3_console_starved(e->MACHINE))
+    return;
+  s->STATS.wakes++;
+  e->FED_AT = s->CLOCK;
+  e->SINCE = s->CLOCK;
+  sched_queue(s, id);
+}
+
+int lc3_sched_feed(lc3_sched *s, int id, const char *data, int length) {
+  int n;
+
+  if (id < 0 || id >= s->COUNT)
+    return 0;
+  n = lc3_console_feed(s->ENTRY[id].MACHINE, data, length);
+  sched_wake(s, id);
+  return n;
+}
+
+void lc3_sched_end(lc3_sched *s, int id) {
+  if (id < 0 || id >= s->COUNT)
+    return;
+  lc3_console_end(s->ENTRY[id].MACHINE);
+  sched_wake(s, id);
+}
+
+/* Fold one dispatch of e into the latency figures. */
+static void sched_dispatched(lc3_sched *s, Sched_Entry *e) {
+  long long wait = s->CLOCK - e->READY_AT;
+
+  s->STATS.dispatches++;
+  s->DISPATCH_SUM += wait;
+  if (wait > s->STATS.dispatch_max)
+    s->STATS.dispatch_max = wait;
+  if (wait > e->STATS.dispatch_max)
+    e->STATS.dispatch_max = wait;
+  if (e->FED_AT >= 0) {
+    wait = s->CLOCK - e->FED_AT;
+    s->STATS.woken++;
+    s->WAKE_SUM += wait;
+    if (wait > s->STATS.wake_max)
+      s->STATS.wake_max = wait;
+    e->FED_AT = -1;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_sched_run                                   */
+/*                                                             */
+/* Purpose   : Hand out quanta round-robin until the queue is  */
+/*             empty or budget intructions have run. Returns   */
+/*             how many machines are still runnable.           */
+/*                                                             */
+/***************************************************************/
+int lc3_sched_run(lc3_sched *s, long long budget) {
+  long long start = s->CLOCK;
+  Sched_Entry *e;
+  int id, quantum, n, ready;
+
+  while (s->HEAD >= 0 && s->CLOCK - start < budget) {
+    id = s->HEAD;
+    e = &s->ENTRY[id];
+    if ((s->HEAD = e->NEXT) < 0)
+      s->TAIL = -1;
+
+    quantum = s->QUANTUM;
+    if (budget - (s->CLOCK - start) < quantum)
+      quantum = budget - (s->CLOCK - start);
+    if (e->LIMIT >= 0 && e->LIMIT - lc3_count(e->MACHINE) < quantum)
+      quantum = e->LIMIT - lc3_count(e->MACHINE);
+
+    sched_dispatched(s, e);
+    n = lc3_run(e->MACHINE, quantum);
+    s->CLOCK += n;
+    s->STATS.slices++;
+    e->STATS.slices++;
+    e->STATS.intructions += n;
+
+    if (lc3_halted(e->MACHINE)) {
+      sched_leave(s, id, LC3_SCHED_HALTED);
+    } else if (lc3_waiting(e->MACHINE) && lc3_console_starved(e->MACHINE)) {
+      sched_leave(s, id, LC3_SCHED_PARKED);
+      s->STATS.parks++;
+      e->STATS.parks++;
+    } else if (e->LIMIT >= 0 && lc3_count(e->MACHINE) >= e->LIMIT) {
+      sched_leave(s, id, LC3_SCHED_BUDGET);
+    } else {
+      sched_queue(s, id);
+    }
+  }
+
+  for (ready = 0, id = s->HEAD; id >= 0; id = s->ENTRY[id].NEXT)
+    ready++;
+  return ready;
+}
+
+/* Its runnable clock up to now, counting a stretch still open. */
+static long long sched_runnable(lc3_sched *s, const Sched_Entry *e) {
+  if (e->STATS.state == LC3_SCHED_READY)
+    return e->STATS.runnable + s->CLOCK - e->SINCE;
+  return e->STATS.runnable;
+}
+
+int lc3_sched_machine_report(lc3_sched *s, int id, lc3_sched_machine *stats) {
+  if (id < 0 || id >= s->COUNT)
+    return -1;
+  *stats = s->ENTRY[id].STATS;
+  stats->runnable = sched_runnable(s, &s->ENTRY[id]);
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_sched_report                                */
+/*                                                             */
+/* Purpose   : The totals, the latency means and Jain's index  */
+/*             (sum x)^2 / (n sum x^2) over each machine's     */
+/*             share x of the clock while it was runnable.     */
+/*                                                             */
+/***************************************************************/
+void lc3_sched_report(lc3_sched *s, lc3_sched_stats *stats) {
+  double x, sum = 0, squares = 0;
+  long long runnable;
+  int id, n = 0;
+
+  *stats = s->STATS;
+  stats->clock = s->CLOCK;
+  stats->machines = s->COUNT;
+  stats->ready = stats->parked = 0;
+  for (id = 0; id < s->COUNT; id++) {
+    if (s->ENTRY[id].STATS.state == LC3_SCHED_READY)
+      stats->ready++;
+    else if (s->ENTRY[id].STATS.state == LC3_SCHED_PARKED)
+      stats->parked++;
+    if ((runnable = sched_runnable(s, &s->ENTRY[id])) == 0)
+      continue;
+    x = (double) s->ENTRY[id].STATS.intructions / runnable;
+    sum += x;
+    squares += x * x;
+    n++;
+  }
+  stats->fairness = squares > 0 ? sum * sum / (n * squares) : 1.0;
+  stats->dispatch_mean = stats->dispatches ? (double) s->DISPATCH_SUM / stats->dispatches : 0;
+  stats->wake_mean = stats->woken ? (double) s->WAKE_SUM / stats->woken : 0;
+}
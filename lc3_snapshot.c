@@ -0,0 +1,363 @@
+#ifdef __linux__
+#define _GNU_SOURCE	/* memfd_create */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Snapshots                                                   */
+/*                                                             */
+/*   A snapshot keeps the machine's memory in an anonymous     */
+/*   file (a memfd on Linux, an unlinked temp file elsewhere)  */
+/*   holding only the dirty pages; the rest are holes and read */
+/*   as zero. The file is never written after it is taken.    */
+/*                                                             */
+/*   Only pages dirty in the machine or the snapshot can       */
+/*   differ, since clean pages are zero in both. Restore       */
+/*   copies those from a read-only mapping of the image; when  */
+/*   there are many it instead maps the image MAP_PRIVATE over */
+/*   MEMORY, and the kernel copies a page the first time the   */
+/*   machine stores to it. lc3_fork() always maps, so parent   */
+/*   and child share every page neither has written.           */
+/*                                                             */
+/***************************************************************/
+
+#define PAGE_BYTES (LC3_PAGE_WORDS * sizeof(uint16_t))
+
+/* Restores touching more pages than this remap instead of copying. */
+#define RESTORE_COPY_PAGES (PAGES_IN_MEM / 8)
+
+struct lc3_snapshot {
+  int FD;		/* memory image */
+  uint16_t *IMAGE;	/* the image, mapped read-only */
+  unsigned char DIRTY[PAGES_IN_MEM];
+  System_Latches LATCHES;
+  int RUN_BIT;
+  long long intruction_COUNT;
+  int PSR, SAVED_SSP, SAVED_USP;
+  int KBSR, KBDR, DSR, MCR, TSR, TIR;	/* device registers */
+  long long TIMER_START;
+};
+
+/* An empty file with no name, or -1. */
+static int image_file(void) {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  return memfd_create("lc3-snapshot", MFD_CLOEXEC);
+#else
+  char name[] = "/tmp/lc3-snapshot-XXXXXX";
+  int fd = mkstemp(name);
+
+  if (fd >= 0) unlink(name);
+  return fd;
+#endif
+}
+
+static lc3_snapshot *snapshot_new(void) {
+  lc3_snapshot *s = calloc(1, sizeof(lc3_snapshot));
+
+  if (s == NULL)
+    return NULL;
+  s->IMAGE = MAP_FAILED;
+  s->FD = image_file();
+  if (s->FD < 0) {
+    free(s);
+    return NULL;
+  }
+  if (ftruncate(s->FD, MEMORY_BYTES) != 0) {
+    lc3_snapshot_free(s);
+    return NULL;
+  }
+  return s;
+}
+
+/* Map the image once its pages are written; FALSE on failure. */
+static int snapshot_seal(lc3_snapshot *s) {
+  s->IMAGE = mmap(NULL, MEMORY_BYTES, PROT_READ, MAP_SHARED, s->FD, 0);
+  return s->IMAGE != MAP_FAILED;
+}
+
+void lc3_snapshot_free(lc3_snapshot *s) {
+  if (s == NULL)
+    return;
+  if (s->IMAGE != MAP_FAILED)
+    munmap(s->IMAGE, MEMORY_BYTES);
+  close(s->FD);	/* machines mapping the image keep it alive */
+  free(s);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_snapshot_take                               */
+/*                                                             */
+/* Purpose   : Copy the dirty pages, the latches and the       */
+/*             device registers out of a machine.              */
+/*                                                             */
+/***************************************************************/
+lc3_snapshot *lc3_snapshot_take(lc3_machine *m) {
+  lc3_snapshot *s = snapshot_new();
+  int page;
+
+  if (s == NULL)
+    return NULL;
+  for (page = 0; page < PAGES_IN_MEM; page++)
+    if (m->DIRTY[page] &&
+        pwrite(s->FD, &m->MEMORY[page << PAGE_SHIFT], PAGE_BYTES,
+               (off_t) page * PAGE_BYTES) != (ssize_t) PAGE_BYTES) {
+      lc3_snapshot_free(s);
+      return NULL;
+    }
+  if (!snapshot_seal(s)) {
+    lc3_snapshot_free(s);
+    return NULL;
+  }
+
+  memcpy(s->DIRTY, m->DIRTY, sizeof(s->DIRTY));
+  s->LATCHES = m->CURRENT_LATCHES;
+  s->RUN_BIT = m->RUN_BIT;
+  s->intruction_COUNT = m->intruction_COUNT;
+  s->PSR = m->PSR;
+  s->SAVED_SSP = m->SAVED_SSP;
+  s->SAVED_USP = m->SAVED_USP;
+  s->KBSR = m->KBSR;
+  s->KBDR = m->KBDR;
+  s->DSR = m->DSR;
+  s->MCR = m->MCR;
+  s->TSR = m->TSR;
+  s->TIR = m->TIR;
+  s->TIMER_START = m->TIMER_START;
+  return s;
+}
+
+/* Put the snapshot's image under MEMORY, copy-on-write. */
+static int snapshot_map(lc3_machine *m, const lc3_snapshot *s) {
+  if (mmap(m->MEMORY, MEMORY_BYTES, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_FIXED, s->FD, 0) == MAP_FAILED)
+    return LC3_ERR_NOMEM;
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_snapshot_restore                            */
+/*                                                             */
+/* Purpose   : Put a machine back in the state a snapshot      */
+/*             recorded. Pending events are not kept; they are */
+/*             scheduled again from the device registers.      */
+/*                                                             */
+/***************************************************************/
+int lc3_snapshot_restore(lc3_machine *m, const lc3_snapshot *s) {
+  int page, i, base, pages = 0;
+
+  for (page = 0; page < PAGES_IN_MEM; page++)
+    if (m->DIRTY[page] || s->DIRTY[page])
+      pages++;
+  if (pages > RESTORE_COPY_PAGES && snapshot_map(m, s) != 0)
+    return LC3_ERR_NOMEM;
+
+  for (page = 0; page < PAGES_IN_MEM; page++) {
+    if (!m->DIRTY[page] && !s->DIRTY[page])
+      continue;
+    base = page << PAGE_SHIFT;
+    if (pages <= RESTORE_COPY_PAGES)
+      memcpy(&m->MEMORY[base], &s->IMAGE[base], PAGE_BYTES);
+    for (i = 0; i < LC3_PAGE_WORDS; i++)
+      decode_drop(m, base + i);
+  }
+  memcpy(m->DIRTY, s->DIRTY, sizeof(m->DIRTY));
+
+  m->CURRENT_LATCHES = s->LATCHES;
+  m->NEXT_LATCHES = s->LATCHES;
+  m->RUN_BIT = s->RUN_BIT;
+  m->intruction_COUNT = s->intruction_COUNT;
+  m->PSR = s->PSR;
+  m->SAVED_SSP = s->SAVED_SSP;
+  m->SAVED_USP = s->SAVED_USP;
+  m->KBSR = s->KBSR;
+  m->KBDR = s->KBDR;
+  m->DSR = s->DSR;
+  m->MCR = s->MCR;
+  m->TSR = s->TSR;
+  m->TIR = s->TIR;
+  m->TIMER_START = s->TIMER_START;
+  event_cancel(m, EVENT_TIMER);
+  event_cancel(m, EVENT_KEYBOARD);
+  events_rewind(m);
+  jit_reset(m);
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_fork                                        */
+/*                                                             */
+/* Purpose   : Snapshot the parent and map the image under     */
+/*             both machines. The parent's memory is unchanged */
+/*             by the remap, so its decodes and JIT code stay. */
+/*                                                             */
+/***************************************************************/
+lc3_machine *lc3_fork(lc3_machine *parent) {
+  lc3_snapshot *s = lc3_snapshot_take(parent);
+  lc3_machine *child;
+
+  if (s == NULL)
+    return NULL;
+  child = lc3_create(parent->ENGINE);
+  if (child == NULL || snapshot_map(parent, s) != 0 ||
+      lc3_snapshot_restore(child, s) != 0) {
+    lc3_destroy(child);
+    child = NULL;
+  }
+  lc3_snapshot_free(s);
+  return child;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_snapshot_save / lc3_snapshot_load           */
+/*                                                             */
+/* Purpose   : Move a snapshot through a file. The layout is   */
+/*             all little-endian:                              */
+/*                                                             */
+/*               "LC3SNAP1"                                    */
+/*               u32 PC, N, Z, P, R0..R7                       */
+/*               u64 count                                     */
+/*               u32 run bit                                   */
+/*               u32 PSR (mode and priority), saved SSP, USP   */
+/*               u32 KBSR, KBDR, DSR, MCR, TSR, TIR            */
+/*               u64 TIMER_START                               */
+/*               u8  dirty flag per page                       */
+/*               u16 words of each dirty page, in page order   */
+/*                                                             */
+/***************************************************************/
+static const char SNAPSHOT_MAGIC[8] = "LC3SNAP1";
+
+static void put_u32(FILE *f, unsigned int v) {
+  putc(v & 0xFF, f); putc((v >> 8) & 0xFF, f);
+  putc((v >> 16) & 0xFF, f); putc((v >> 24) & 0xFF, f);
+}
+
+static int get_u32(FILE *f, int *v) {
+  unsigned char b[4];
+
+  if (fread(b, 1, 4, f) != 4)
+    return FALSE;
+  *v = (int) (b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int) b[3] << 24));
+  return TRUE;
+}
+
+static void put_u64(FILE *f, unsigned long long v) {
+  put_u32(f, v & 0xFFFFFFFF);
+  put_u32(f, v >> 32);
+}
+
+static int get_u64(FILE *f, long long *v) {
+  int low, high;
+
+  if (!get_u32(f, &low) || !get_u32(f, &high))
+    return FALSE;
+  *v = (long long) ((unsigned long long) (unsigned int) high << 32 | (unsigned int) low);
+  return TRUE;
+}
+
+int lc3_snapshot_save(const lc3_snapshot *s, const char *filename) {
+  uint16_t words[LC3_PAGE_WORDS];
+  FILE *f;
+  int page, i, k, status = 0;
+
+  f = fopen(filename, "wb");
+  if (f == NULL)
+    return LC3_ERR_OPEN;
+
+  fwrite(SNAPSHOT_MAGIC, 1, sizeof(SNAPSHOT_MAGIC), f);
+  put_u32(f, s->LATCHES.PC);
+  put_u32(f, s->LATCHES.N);
+  put_u32(f, s->LATCHES.Z);
+  put_u32(f, s->LATCHES.P);
+  for (k = 0; k < LC_3_REGS; k++)
+    put_u32(f, s->LATCHES.REGS[k]);
+  put_u64(f, s->intruction_COUNT);
+  put_u32(f, s->RUN_BIT);
+  put_u32(f, s->PSR);
+  put_u32(f, s->SAVED_SSP);
+  put_u32(f, s->SAVED_USP);
+  put_u32(f, s->KBSR);
+  put_u32(f, s->KBDR);
+  put_u32(f, s->DSR);
+  put_u32(f, s->MCR);
+  put_u32(f, s->TSR);
+  put_u32(f, s->TIR);
+  put_u64(f, s->TIMER_START);
+  fwrite(s->DIRTY, 1, sizeof(s->DIRTY), f);
+
+  for (page = 0; page < PAGES_IN_MEM && status == 0; page++) {
+    if (!s->DIRTY[page])
+      continue;
+    if (pread(s->FD, words, PAGE_BYTES, (off_t) page * PAGE_BYTES) != (ssize_t) PAGE_BYTES)
+      status = LC3_ERR_NOMEM;
+    for (i = 0; i < LC3_PAGE_WORDS; i++) {
+      putc(words[i] & 0xFF, f);
+      putc(words[i] >> 8, f);
+    }
+  }
+
+  if (ferror(f))
+    status = LC3_ERR_OPEN;
+  if (fclose(f) != 0 && status == 0)
+    status = LC3_ERR_OPEN;
+  return status;
+}
+
+int lc3_snapshot_load(const char *filename, lc3_snapshot **snapshot) {
+  unsigned char bytes[PAGE_BYTES];
+  uint16_t words[LC3_PAGE_WORDS];
+  char magic[sizeof(SNAPSHOT_MAGIC)];
+  lc3_snapshot *s;
+  FILE *f;
+  int page, i, k, ok;
+
+  *snapshot = NULL;
+  f = fopen(filename, "rb");
+  if (f == NULL)
+    return LC3_ERR_OPEN;
+  s = snapshot_new();
+  if (s == NULL) {
+    fclose(f);
+    return LC3_ERR_NOMEM;
+  }
+
+  ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+    memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+  ok = ok && get_u32(f, &s->LATCHES.PC) && get_u32(f, &s->LATCHES.N) &&
+    get_u32(f, &s->LATCHES.Z) && get_u32(f, &s->LATCHES.P);
+  for (k = 0; k < LC_3_REGS; k++)
+    ok = ok && get_u32(f, &s->LATCHES.REGS[k]);
+  ok = ok && get_u64(f, &s->intruction_COUNT) && get_u32(f, &s->RUN_BIT);
+  ok = ok && get_u32(f, &s->PSR) && get_u32(f, &s->SAVED_SSP) && get_u32(f, &s->SAVED_USP);
+  ok = ok && get_u32(f, &s->KBSR) && get_u32(f, &s->KBDR) && get_u32(f, &s->DSR) &&
+    get_u32(f, &s->MCR) && get_u32(f, &s->TSR) && get_u32(f, &s->TIR) &&
+    get_u64(f, &s->TIMER_START);
+  ok = ok && fread(s->DIRTY, 1, sizeof(s->DIRTY), f) == sizeof(s->DIRTY);
+
+  for (page = 0; ok && page < PAGES_IN_MEM; page++) {
+    if (!s->DIRTY[page])
+      continue;
+    ok = fread(bytes, 1, sizeof(bytes), f) == sizeof(bytes);
+    for (i = 0; i < LC3_PAGE_WORDS; i++)
+      words[i] = bytes[2 * i] | (bytes[2 * i + 1] << 8);
+    ok = ok && pwrite(s->FD, words, PAGE_BYTES, (off_t) page * PAGE_BYTES) == (ssize_t) PAGE_BYTES;
+  }
+  fclose(f);
+
+  if (!ok || !snapshot_seal(s)) {
+    lc3_snapshot_free(s);
+    return LC3_ERR_FORMAT;
+  }
+  *snapshot = s;
+  return 0;
+}
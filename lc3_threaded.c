@@ -0,0 +1,183 @@
+#include <string.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Threaded engine                                             */
+/*                                                             */
+/*   Runs straight off the DECODED table with the architectural*/
+/*   state held in a local Threaded_State for the whole call,  */
+/*   so nothing goes through CURRENT_LATCHES/NEXT_LATCHES until*/
+/*   the run ends. With GCC/Clang dispatch is a single         */
+/*   indirect goto through a table of labels by opcode; other  */
+/*   compilers call through a table of op functions.           */
+/*   LDI/LDR/STI/STR whose address is in the device page run   */
+/*   the op's stop statement instead, leaving it to            */
+/*   engine_run().                                             */
+/*                                                             */
+/***************************************************************/
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define THREADED_COMPUTED_GOTO 1
+#endif
+
+typedef struct Threaded_State_Struct {
+  int PC, N, Z, P;
+  int REGS[LC_3_REGS];
+  int DEVICE;		/* an op function met the device page */
+} Threaded_State;
+
+#define T_SETCC(s, value) do {			\
+    int v_ = (value);				\
+    (s).N = (v_ & 0x8000) != 0;			\
+    (s).Z = v_ == 0;				\
+    (s).P = !(s).N && !(s).Z;			\
+  } while (0)
+
+/* Op bodies; (s).PC already points past the intruction. */
+#define T_ADD(m, s, d) do {						\
+    (s).REGS[(d)->dr] = Low16bits((s).REGS[(d)->sr1] +		\
+      ((d)->imm_flag ? (d)->imm : (s).REGS[(d)->sr2]));		\
+    T_SETCC(s, (s).REGS[(d)->dr]);					\
+  } while (0)
+#define T_AND(m, s, d) do {						\
+    (s).REGS[(d)->dr] = Low16bits((s).REGS[(d)->sr1] &		\
+      ((d)->imm_flag ? (d)->imm : (s).REGS[(d)->sr2]));		\
+    T_SETCC(s, (s).REGS[(d)->dr]);					\
+  } while (0)
+#define T_BR(m, s, d) do {							\
+    if ((((d)->nzp & 4) && (s).N) || (((d)->nzp & 2) && (s).Z) ||	\
+        (((d)->nzp & 1) && (s).P))					\
+      (s).PC = Low16bits((s).PC + (d)->imm);				\
+  } while (0)
+#define T_JMP(m, s, d) ((s).PC = (s).REGS[(d)->sr1])
+#define T_JSR(m, s, d) do {						\
+    int base_ = (s).REGS[(d)->sr1];					\
+    (s).REGS[7] = (s).PC;						\
+    (s).PC = (d)->imm_flag ? Low16bits((s).PC + (d)->imm) : base_;	\
+  } while (0)
+#define T_LOAD(m, s, d, address) do {					\
+    (s).REGS[(d)->dr] = Low16bits((m)->MEMORY[address]);		\
+    T_SETCC(s, (s).REGS[(d)->dr]);					\
+  } while (0)
+#define T_CHECKED(stop, address, op) do {				\
+    int a_ = (address);							\
+    if (IS_DEVICE(a_)) stop; else op;					\
+  } while (0)
+#define T_LD(m, s, d)  T_LOAD(m, s, d, Low16bits((s).PC + (d)->imm))
+#define T_LDI(m, s, d, stop) \
+  T_CHECKED(stop, (m)->MEMORY[Low16bits((s).PC + (d)->imm)], T_LOAD(m, s, d, a_))
+#define T_LDR(m, s, d, stop) \
+  T_CHECKED(stop, Low16bits((s).REGS[(d)->sr1] + (d)->imm), T_LOAD(m, s, d, a_))
+#define T_LEA(m, s, d) ((s).REGS[(d)->dr] = Low16bits((s).PC + (d)->imm))
+#define T_NOT(m, s, d) do {						\
+    (s).REGS[(d)->dr] = Low16bits(~(s).REGS[(d)->sr1]);		\
+    T_SETCC(s, (s).REGS[(d)->dr]);					\
+  } while (0)
+#define T_ST(m, s, d)  write_memory(m, (s).PC + (d)->imm, (s).REGS[(d)->dr])
+#define T_STI(m, s, d, stop) \
+  T_CHECKED(stop, (m)->MEMORY[Low16bits((s).PC + (d)->imm)], write_memory(m, a_, (s).REGS[(d)->dr]))
+#define T_STR(m, s, d, stop) \
+  T_CHECKED(stop, Low16bits((s).REGS[(d)->sr1] + (d)->imm), write_memory(m, a_, (s).REGS[(d)->dr]))
+#define T_TRAP(m, s, d) ((s).PC = trap(m, (d)->imm, (s).REGS, (s).PC))
+
+#ifndef THREADED_COMPUTED_GOTO
+static void t_add(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)  { T_ADD(m, *s, d); }
+static void t_and(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)  { T_AND(m, *s, d); }
+static void t_br(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)   { T_BR(m, *s, d); }
+static void t_jmp(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)  { T_JMP(m, *s, d); }
+static void t_jsr(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)  { T_JSR(m, *s, d); }
+static void t_ld(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)   { T_LD(m, *s, d); }
+static void t_ldi(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)  { T_LDI(m, *s, d, s->DEVICE = TRUE); }
+static void t_ldr(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)  { T_LDR(m, *s, d, s->DEVICE = TRUE); }
+static void t_lea(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)  { T_LEA(m, *s, d); }
+static void t_not(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)  { T_NOT(m, *s, d); }
+static void t_st(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)   { T_ST(m, *s, d); }
+static void t_sti(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)  { T_STI(m, *s, d, s->DEVICE = TRUE); }
+static void t_str(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d)  { T_STR(m, *s, d, s->DEVICE = TRUE); }
+static void t_trap(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d) { T_TRAP(m, *s, d); }
+static void t_nop(lc3_machine *m, Threaded_State *s, Decoded_Intruction *d) { }
+
+static void (* const THREADED_OPS[16])(lc3_machine *, Threaded_State *, Decoded_Intruction *) = {
+  t_br, t_add, t_ld, t_st, t_jsr, t_and, t_ldr, t_str,
+  t_nop, t_not, t_ldi, t_sti, t_jmp, t_nop, t_lea, t_trap
+};
+#endif
+
+int threaded_run(lc3_machine *m, int num_cycles){
+  Threaded_State s;
+  Decoded_Intruction *d;
+  int executed = 0;
+
+  s.PC = m->CURRENT_LATCHES.PC;
+  s.N = m->CURRENT_LATCHES.N;
+  s.Z = m->CURRENT_LATCHES.Z;
+  s.P = m->CURRENT_LATCHES.P;
+  memcpy(s.REGS, m->CURRENT_LATCHES.REGS, sizeof(s.REGS));
+  s.DEVICE = FALSE;
+
+#ifdef THREADED_COMPUTED_GOTO
+  static void *labels[17] = {
+    &&op_br, &&op_add, &&op_ld, &&op_st, &&op_jsr, &&op_and, &&op_ldr, &&op_str,
+    &&op_nop, &&op_not, &&op_ldi, &&op_sti, &&op_jmp, &&op_nop, &&op_lea, &&op_trap,
+    &&op_stop
+  };
+
+#define DISPATCH() do {						\
+    if (executed == num_cycles) goto done;			\
+    d = DECODED_AT(m, s.PC);					\
+    if (!d->valid) decode(m, s.PC, m->MEMORY[s.PC], d);		\
+    s.PC = Low16bits(s.PC + 1);					\
+    executed++;							\
+    goto *labels[d->opcode];					\
+  } while (0)
+
+  DISPATCH();
+op_add:  T_ADD(m, s, d);  DISPATCH();
+op_and:  T_AND(m, s, d);  DISPATCH();
+op_br:   T_BR(m, s, d);   DISPATCH();
+op_jmp:  T_JMP(m, s, d);  DISPATCH();
+op_jsr:  T_JSR(m, s, d);  DISPATCH();
+op_ld:   T_LD(m, s, d);   DISPATCH();
+op_ldi:  T_LDI(m, s, d, goto op_stop);  DISPATCH();
+op_ldr:  T_LDR(m, s, d, goto op_stop);  DISPATCH();
+op_lea:  T_LEA(m, s, d);  DISPATCH();
+op_not:  T_NOT(m, s, d);  DISPATCH();
+op_st:   T_ST(m, s, d);   DISPATCH();
+op_sti:  T_STI(m, s, d, goto op_stop);  DISPATCH();
+op_str:  T_STR(m, s, d, goto op_stop);  DISPATCH();
+op_trap: T_TRAP(m, s, d); if (!m->RUN_BIT) goto done; DISPATCH();
+op_nop:  DISPATCH();
+op_stop:
+  s.PC = Low16bits(s.PC - 1);	/* stop in front of it, uncounted */
+  executed--;
+#undef DISPATCH
+done:
+#else
+  while (executed < num_cycles) {
+    d = DECODED_AT(m, s.PC);
+    if (!d->valid) decode(m, s.PC, m->MEMORY[s.PC], d);
+    if (d->opcode == OP_STOP)
+      break;
+    s.PC = Low16bits(s.PC + 1);
+    executed++;
+    THREADED_OPS[d->opcode](m, &s, d);
+    if (s.DEVICE) {
+      s.PC = Low16bits(s.PC - 1);	/* stop in front of it, uncounted */
+      executed--;
+      break;
+    }
+    if (!m->RUN_BIT)
+      break;
+  }
+#endif
+
+  m->CURRENT_LATCHES.PC = s.PC;
+  m->CURRENT_LATCHES.N = s.N;
+  m->CURRENT_LATCHES.Z = s.Z;
+  m->CURRENT_LATCHES.P = s.P;
+  memcpy(m->CURRENT_LATCHES.REGS, s.REGS, sizeof(s.REGS));
+  m->NEXT_LATCHES = m->CURRENT_LATCHES;
+  m->intruction_COUNT += executed;
+  return executed;
+}
@@ -0,0 +1,302 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Timing model                                                */
+/*                                                             */
+/*   A pass over the intructions as they run, next to the      */
+/*   machine rather than in it: while TIMING is set            */
+/*   engine_run() steps every intruction through               */
+/*   step_observed(), which shows it to timing_step() before   */
+/*   it runs. The machine state is read, never written, so     */
+/*   every count the machine keeps is the same with the model  */
+/*   on or off, and the engines carry no trace of it.          */
+/*                                                             */
+/*   timing_step() works out from the latches what the         */
+/*   intruction will do: the word it fetches, the addresses it */
+/*   will load or store, whether it jumps. Each access goes    */
+/*   through a cache, a set of WAYS lines per set replaced     */
+/*   least recently used first, and a miss costs the cache's   */
+/*   miss_penalty. LOADED is the register the intruction just  */
+/*   before loaded, for the load-use stall.                    */
+/*                                                             */
+/***************************************************************/
+
+/* Caches bigger than this many lines are not worth modelling. */
+#define CACHE_LINES_MAX (1 << 16)
+
+typedef struct Cache_Struct {
+  lc3_cache_config CONFIG;
+  int *LINE;		/* sets x ways line numbers, -1 when empty */
+  unsigned long long *USED;	/* CLOCK at each line's last access */
+  unsigned long long CLOCK;
+} Cache;
+
+struct Timing_Struct {
+  lc3_timing_config CONFIG;
+  Cache ICACHE, DCACHE;
+  int LOADED;		/* register the last intruction loaded, or -1 */
+  lc3_timing_stats STATS;
+};
+
+void lc3_timing_default(lc3_timing_config *config) {
+  config->branch_penalty = 2;
+  config->load_use_penalty = 1;
+  config->device_penalty = 20;
+  config->icache.sets = 64;
+  config->icache.ways = 2;
+  config->icache.line_words = 4;
+  config->icache.miss_penalty = 10;
+  config->dcache.sets = 64;
+  config->dcache.ways = 4;
+  config->dcache.line_words = 4;
+  config->dcache.miss_penalty = 10;
+}
+
+static int cache_valid(const lc3_cache_config *c) {
+  if (c->sets == 0)
+    return c->miss_penalty >= 0;
+  return c->sets > 0 && c->ways > 0 && c->line_words > 0 && c->miss_penalty >= 0 &&
+    c->sets <= CACHE_LINES_MAX / c->ways;
+}
+
+static void cache_clear(Cache *c) {
+  int i;
+
+  for (i = 0; i < c->CONFIG.sets * c->CONFIG.ways; i++) {
+    c->LINE[i] = -1;
+    c->USED[i] = 0;
+  }
+  c->CLOCK = 0;
+}
+
+static int cache_init(Cache *c, const lc3_cache_config *config) {
+  int lines = config->sets * config->ways;
+
+  c->CONFIG = *config;
+  if (lines == 0)
+    return TRUE;
+  c->LINE = malloc(lines * sizeof(c->LINE[0]));
+  c->USED = malloc(lines * sizeof(c->USED[0]));
+  if (c->LINE == NULL || c->USED == NULL)
+    return FALSE;
+  cache_clear(c);
+  return TRUE;
+}
+
+/* Whether the word at address is in the cache; on a miss its line comes in. */
+static int cache_hit(Cache *c, int address) {
+  int line = address / c->CONFIG.line_words, base, way, victim = 0;
+
+  if (c->CONFIG.sets == 0)
+    return TRUE;
+  base = (line % c->CONFIG.sets) * c->CONFIG.ways;
+  c->CLOCK++;
+  for (way = 0; way < c->CONFIG.ways; way++) {
+    if (c->LINE[base + way] == line) {
+      c->USED[base + way] = c->CLOCK;
+      return TRUE;
+    }
+    if (c->USED[base + way] < c->USED[base + victim])
+      victim = way;
+  }
+  c->LINE[base + victim] = line;
+  c->USED[base + victim] = c->CLOCK;
+  return FALSE;
+}
+
+static void fetch(Timing *t, int pc) {
+  t->STATS.icache_accesses++;
+  if (!cache_hit(&t->ICACHE, pc)) {
+    t->STATS.icache_misses++;
+    t->STATS.icache_stalls += t->CONFIG.icache.miss_penalty;
+    t->STATS.cycles += t->CONFIG.icache.miss_penalty;
+  }
+}
+
+/* A load or store of the word at address. */
+static void data(Timing *t, int address) {
+  address = Low16bits(address);
+  if (IS_DEVICE(address)) {
+    t->STATS.device_accesses++;
+    t->STATS.device_stalls += t->CONFIG.device_penalty;
+    t->STATS.cycles += t->CONFIG.device_penalty;
+    return;
+  }
+  t->STATS.dcache_accesses++;
+  if (!cache_hit(&t->DCACHE, address)) {
+    t->STATS.dcache_misses++;
+    t->STATS.dcache_stalls += t->CONFIG.dcache.miss_penalty;
+    t->STATS.cycles += t->CONFIG.dcache.miss_penalty;
+  }
+}
+
+static void jump(Timing *t) {
+  t->STATS.taken++;
+  t->STATS.branch_stalls += t->CONFIG.branch_penalty;
+  t->STATS.cycles += t->CONFIG.branch_penalty;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : timing_step                                     */
+/*                                                             */
+/* Purpose   : Charge the intruction d at the PC, which is     */
+/*             about to run, to the pipeline and the caches.   */
+/*                                                             */
+/***************************************************************/
+void timing_step(lc3_machine *m, const Decoded_Intruction *d) {
+  Timing *t = m->TIMING;
+  System_Latches *l = &m->CURRENT_LATCHES;
+  int next_pc = Low16bits(l->PC + 1), address;
+
+  t->STATS.intructions++;
+  t->STATS.cycles++;
+  fetch(t, l->PC);
+
+  if (t->LOADED >= 0 &&
+      ((intruction_reads(d) & (1 << t->LOADED)) || (d->opcode == 0b0000 && d->nzp != 0))) {
+    t->STATS.load_use_stalls += t->CONFIG.load_use_penalty;
+    t->STATS.cycles += t->CONFIG.load_use_penalty;
+  }
+  t->LOADED = -1;
+
+  switch (d->opcode) {
+  case 0b0000:
+    if ((d->nzp & 4 && l->N) || (d->nzp & 2 && l->Z) || (d->nzp & 1 && l->P))
+      jump(t);
+    break;
+  case 0b0010:
+    data(t, next_pc + d->imm);
+    t->LOADED = d->dr;
+    break;
+  case 0b1010:
+    address = Low16bits(next_pc + d->imm);
+    data(t, address);
+    data(t, m->MEMORY[address]);
+    t->LOADED = d->dr;
+    break;
+  case 0b0110:
+    data(t, l->REGS[d->sr1] + d->imm);
+    t->LOADED = d->dr;
+    break;
+  case 0b1011:
+    data(t, next_pc + d->imm);	/* the pointer */
+    data(t, store_target(m, d));
+    break;
+  case 0b0011: case 0b0111:
+    data(t, store_target(m, d));
+    break;
+  case 0b0100: case 0b1100:
+    jump(t);
+    break;
+  case 0b1000:
+    if (!(m->PSR & PSR_USER)) {
+      data(t, l->REGS[6]);
+      data(t, l->REGS[6] + 1);
+    }
+    jump(t);
+    break;
+  case 0b1111:
+    if (m->MEMORY[d->imm] != 0) {
+      data(t, d->imm);	/* the trap vector table */
+      jump(t);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/* The interrupt just taken: two pushes and a jump to the handler. */
+void timing_interrupt(lc3_machine *m) {
+  Timing *t = m->TIMING;
+
+  data(t, m->CURRENT_LATCHES.REGS[6]);
+  data(t, m->CURRENT_LATCHES.REGS[6] + 1);
+  jump(t);
+  t->LOADED = -1;
+}
+
+/* The engine while the model is on: the switch engine through step_observed(). */
+int timing_run(lc3_machine *m, int num_cycles) {
+  Decoded_Intruction *d;
+  int executed;
+
+  for (executed = 0; executed < num_cycles && m->RUN_BIT && m->intruction_COUNT < m->NEXT_EVENT;
+       executed++) {
+    d = DECODED_AT(m, m->CURRENT_LATCHES.PC);
+    if (!d->valid)
+      decode(m, m->CURRENT_LATCHES.PC, m->MEMORY[m->CURRENT_LATCHES.PC], d);
+    if (d->opcode == OP_STOP)
+      break;
+    step_observed(m, d);
+  }
+  return executed;
+}
+
+void timing_reset(lc3_machine *m) {
+  Timing *t = m->TIMING;
+
+  if (t == NULL)
+    return;
+  if (t->ICACHE.LINE != NULL)
+    cache_clear(&t->ICACHE);
+  if (t->DCACHE.LINE != NULL)
+    cache_clear(&t->DCACHE);
+  t->LOADED = -1;
+  memset(&t->STATS, 0, sizeof(t->STATS));
+}
+
+static void timing_free(Timing *t) {
+  free(t->ICACHE.LINE);
+  free(t->ICACHE.USED);
+  free(t->DCACHE.LINE);
+  free(t->DCACHE.USED);
+  free(t);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_timing                                      */
+/*                                                             */
+/* Purpose   : Put a fresh model with this configuration on    */
+/*             the machine, or take it off for NULL.           */
+/*                                                             */
+/***************************************************************/
+int lc3_timing(lc3_machine *m, const lc3_timing_config *config) {
+  Timing *t;
+
+  if (config != NULL && (config->branch_penalty < 0 || config->load_use_penalty < 0 ||
+                         config->device_penalty < 0 || !cache_valid(&config->icache) ||
+                         !cache_valid(&config->dcache)))
+    return LC3_ERR_FORMAT;
+  if (m->TIMING != NULL) {
+    timing_free(m->TIMING);
+    m->TIMING = NULL;
+  }
+  if (config == NULL)
+    return 0;
+
+  t = calloc(1, sizeof(Timing));
+  if (t == NULL)
+    return LC3_ERR_NOMEM;
+  t->CONFIG = *config;
+  t->LOADED = -1;
+  if (!cache_init(&t->ICACHE, &config->icache) || !cache_init(&t->DCACHE, &config->dcache)) {
+    timing_free(t);
+    return LC3_ERR_NOMEM;
+  }
+  m->TIMING = t;
+  return 0;
+}
+
+int lc3_timing_report(lc3_machine *m, lc3_timing_stats *stats) {
+  if (m->TIMING == NULL)
+    return -1;
+  *stats = m->TIMING->STATS;
+  return 0;
+}
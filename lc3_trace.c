@@ -0,0 +1,491 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Execution traces                                            */
+/*                                                             */
+/*   While tracing, every intruction runs through trace_step() */
+/*   and leaves one 10-byte entry: its PC and word, the        */
+/*   register or memory word it wrote and the value, and the   */
+/*   condition codes after it. A TRAP or RTI that writes two   */
+/*   registers gets two entries, the first flagged             */
+/*   LC3_TRACE_MORE; taking an interrupt is an entry of its    */
+/*   own. The run only copies entries into a ring of chunks    */
+/*   owned by the machine, so each thread running a traced     */
+/*   machine fills its own; a writer thread per trace takes    */
+/*   the full chunks and appends them to the file.             */
+/*                                                             */
+/*   The file is a 24-byte header ("LC3T", u16 version, u16    */
+/*   entry size, u64 first intruction count, u32 flags, u32    */
+/*   0). Plain traces follow with the entries in host byte     */
+/*   order. With LC3_TRACE_PACKED the writer squeezes each     */
+/*   entry into 1-9 little-endian bytes: a tag byte, then only */
+/*   what can't be predicted -- the PC when it isn't the one   */
+/*   after the last intruction, the word when it isn't what    */
+/*   was last seen at that PC, and the register or address and */
+/*   value written. Straight-line ALU code packs into 4 bytes  */
+/*   an intruction, branches into 1.                           */
+/*                                                             */
+/***************************************************************/
+
+#define TRACE_VERSION 1
+#define TRACE_HEADER  24
+#define TRACE_CHUNK   (1 << 16)	/* entries per chunk */
+#define TRACE_CHUNKS  4		/* chunk buffers in the ring */
+#define TRACE_PACKED_MAX 9	/* bytes of the longest packed entry */
+
+/* Packed tag byte: kind, LC3_TRACE_MORE, condition codes, and what is left out. */
+#define TAG_KIND      0x03
+#define TAG_MORE      0x04
+#define TAG_CC_SHIFT  3	/* 0 none, 1 N, 2 Z, 3 P */
+#define TAG_SAME_PC   0x20
+#define TAG_SAME_WORD 0x40
+
+typedef struct Trace_Entry_Struct {
+  uint16_t pc;
+  uint16_t intruction;	/* 0 for an interrupt */
+  uint16_t where;	/* register, address, or interrupt vector */
+  uint16_t value;	/* written there, or the handler's address */
+  uint8_t kind;		/* LC3_TRACE_ kind, LC3_TRACE_MORE */
+  uint8_t cc;		/* N/Z/P after it ran, as nzp */
+} Trace_Entry;
+
+/* What both ends of a packed trace predict from the entries so far. */
+typedef struct Trace_Code_Struct {
+  int NEXT_PC;
+  uint16_t WORD[WORDS_IN_MEM];	/* the word last seen at each PC */
+  unsigned char SEEN[WORDS_IN_MEM];
+} Trace_Code;
+
+struct Trace_Struct {
+  int FD;
+  int FLAGS;
+
+  /* Ring: CHUNK[FILL] is being filled, the PENDING before it wait for the writer. */
+  Trace_Entry *CHUNK[TRACE_CHUNKS];
+  int FILL, LENGTH, PENDING;
+  int WRITE_ERROR, QUIT;
+  pthread_t WRITER;
+  pthread_mutex_t LOCK;
+  pthread_cond_t WAKE, DONE;
+
+  /* The writer's side of packing. */
+  unsigned char *PACKED;
+  Trace_Code CODE;
+};
+
+struct lc3_trace_reader {
+  FILE *FILE;
+  int FLAGS;
+  long long START;
+  Trace_Code CODE;
+};
+
+static void code_reset(Trace_Code *c) {
+  c->NEXT_PC = -1;
+  memset(c->SEEN, 0, sizeof(c->SEEN));
+}
+
+/* Take in one more entry, and so where the next one should be. */
+static void code_update(Trace_Code *c, const Trace_Entry *e) {
+  if ((e->kind & LC3_TRACE_KIND) == LC3_TRACE_INTERRUPT) {
+    c->NEXT_PC = e->value;
+    return;
+  }
+  c->WORD[e->pc] = e->intruction;
+  c->SEEN[e->pc] = TRUE;
+  c->NEXT_PC = e->kind & LC3_TRACE_MORE ? e->pc : Low16bits(e->pc + 1);
+}
+
+static int cc_code(int cc) {
+  return cc & 4 ? 1 : cc & 2 ? 2 : cc & 1 ? 3 : 0;
+}
+
+static unsigned char *put16(unsigned char *p, int value) {
+  p[0] = value & 0xFF;
+  p[1] = (value >> 8) & 0xFF;
+  return p + 2;
+}
+
+/* Pack one entry at p; returns the end of it. */
+static unsigned char *trace_pack(Trace_Code *c, const Trace_Entry *e, unsigned char *p) {
+  unsigned char *tag = p++;
+  int kind = e->kind & LC3_TRACE_KIND;
+
+  *tag = kind | (e->kind & LC3_TRACE_MORE) | cc_code(e->cc) << TAG_CC_SHIFT;
+  if (e->pc == c->NEXT_PC)
+    *tag |= TAG_SAME_PC;
+  else
+    p = put16(p, e->pc);
+  if (kind == LC3_TRACE_INTERRUPT || (c->SEEN[e->pc] && c->WORD[e->pc] == e->intruction))
+    *tag |= TAG_SAME_WORD;
+  else
+    p = put16(p, e->intruction);
+  if (kind == LC3_TRACE_REG)
+    *p++ = e->where;
+  else if (kind != LC3_TRACE_NONE)
+    p = put16(p, e->where);
+  if (kind != LC3_TRACE_NONE)
+    p = put16(p, e->value);
+  code_update(c, e);
+  return p;
+}
+
+static int write_all(int fd, const void *buffer, size_t bytes) {
+  const char *p = buffer;
+  ssize_t n;
+
+  while (bytes > 0) {
+    if ((n = write(fd, p, bytes)) <= 0)
+      return -1;
+    p += n;
+    bytes -= n;
+  }
+  return 0;
+}
+
+/* Append length entries of a chunk to the file, packed or not. */
+static void trace_write(Trace *t, const Trace_Entry *entries, int length) {
+  unsigned char *p = t->PACKED;
+  int i;
+
+  if (!(t->FLAGS & LC3_TRACE_PACKED)) {
+    if (write_all(t->FD, entries, length * sizeof(Trace_Entry)) != 0)
+      t->WRITE_ERROR = TRUE;
+    return;
+  }
+  for (i = 0; i < length; i++)
+    p = trace_pack(&t->CODE, &entries[i], p);
+  if (write_all(t->FD, t->PACKED, p - t->PACKED) != 0)
+    t->WRITE_ERROR = TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : trace_writer                                    */
+/*                                                             */
+/* Purpose   : Writer thread: append full chunks to the file   */
+/*             in the order they were filled.                  */
+/*                                                             */
+/***************************************************************/
+static void *trace_writer(void *arg) {
+  Trace *t = arg;
+  int chunk;
+
+  pthread_mutex_lock(&t->LOCK);
+  for (;;) {
+    while (t->PENDING == 0 && !t->QUIT)
+      pthread_cond_wait(&t->WAKE, &t->LOCK);
+    if (t->PENDING == 0)
+      break;
+    chunk = (t->FILL - t->PENDING + TRACE_CHUNKS) % TRACE_CHUNKS;
+    pthread_mutex_unlock(&t->LOCK);
+
+    trace_write(t, t->CHUNK[chunk], TRACE_CHUNK);
+
+    pthread_mutex_lock(&t->LOCK);
+    t->PENDING--;
+    pthread_cond_broadcast(&t->DONE);
+  }
+  pthread_mutex_unlock(&t->LOCK);
+  return NULL;
+}
+
+/* Hand the full chunk to the writer and move on to the next buffer. */
+static void trace_flip(Trace *t) {
+  pthread_mutex_lock(&t->LOCK);
+  while (t->PENDING == TRACE_CHUNKS - 1)
+    pthread_cond_wait(&t->DONE, &t->LOCK);
+  t->PENDING++;
+  t->FILL = (t->FILL + 1) % TRACE_CHUNKS;
+  t->LENGTH = 0;
+  pthread_cond_signal(&t->WAKE);
+  pthread_mutex_unlock(&t->LOCK);
+}
+
+static void trace_append(Trace *t, Trace_Entry *e, int kind, int where, int value) {
+  e->kind = kind;
+  e->where = where;
+  e->value = value;
+  t->CHUNK[t->FILL][t->LENGTH++] = *e;
+  if (t->LENGTH == TRACE_CHUNK)
+    trace_flip(t);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : trace_step                                      */
+/*                                                             */
+/* Purpose   : Execute one decoded intruction, recorded too if */
+/*             recording, and trace what it wrote.             */
+/*                                                             */
+/***************************************************************/
+void trace_step(lc3_machine *m, Decoded_Intruction *d) {
+  Trace *t = m->TRACE;
+  Trace_Entry e;
+  int target = store_target(m, d), old[8], regs[2], n = 0, k;
+
+  e.pc = m->CURRENT_LATCHES.PC;
+  e.intruction = d->intruction;
+  memcpy(old, m->CURRENT_LATCHES.REGS, sizeof(old));
+
+  if (m->RECORD != NULL)
+    record_step(m, d);
+  else
+    execute_decoded(m, d);
+  e.cc = (m->CURRENT_LATCHES.N << 2) | (m->CURRENT_LATCHES.Z << 1) | m->CURRENT_LATCHES.P;
+
+  /* The registers it wrote: its DR always, the others if they changed. */
+  switch (d->opcode) {
+  case 0b0001: case 0b0101: case 0b1001: case 0b0010:
+  case 0b1010: case 0b0110: case 0b1110:
+    regs[n++] = d->dr;
+    break;
+  case 0b0100:
+    regs[n++] = 7;
+    break;
+  case 0b1111:
+    if (m->CURRENT_LATCHES.REGS[0] != old[0])
+      regs[n++] = 0;
+    if (m->CURRENT_LATCHES.REGS[7] != old[7])
+      regs[n++] = 7;
+    break;
+  case 0b1000:
+    if (m->CURRENT_LATCHES.REGS[6] != old[6])
+      regs[n++] = 6;
+    break;
+  }
+
+  if (target >= 0)
+    trace_append(t, &e, LC3_TRACE_MEM, target, m->CURRENT_LATCHES.REGS[d->dr]);
+  else if (n == 0)
+    trace_append(t, &e, LC3_TRACE_NONE, 0, 0);
+  for (k = 0; k < n; k++)
+    trace_append(t, &e, LC3_TRACE_REG | (k + 1 < n ? LC3_TRACE_MORE : 0), regs[k],
+                 m->CURRENT_LATCHES.REGS[regs[k]]);
+}
+
+/* The interrupt just taken at pc, through vector. */
+void trace_interrupt(lc3_machine *m, int vector, int pc) {
+  Trace_Entry e;
+
+  e.pc = pc;
+  e.intruction = 0;
+  e.cc = (m->CURRENT_LATCHES.N << 2) | (m->CURRENT_LATCHES.Z << 1) | m->CURRENT_LATCHES.P;
+  trace_append(m->TRACE, &e, LC3_TRACE_INTERRUPT, vector, m->CURRENT_LATCHES.PC);
+}
+
+/* The engine while tracing: the switch engine through trace_step(). */
+int trace_run(lc3_machine *m, int num_cycles) {
+  Decoded_Intruction *d;
+  int executed;
+
+  for (executed = 0; executed < num_cycles && m->RUN_BIT && m->intruction_COUNT < m->NEXT_EVENT;
+       executed++) {
+    d = DECODED_AT(m, m->CURRENT_LATCHES.PC);
+    if (!d->valid)
+      decode(m, m->CURRENT_LATCHES.PC, m->MEMORY[m->CURRENT_LATCHES.PC], d);
+    if (d->opcode == OP_STOP)
+      break;
+    trace_step(m, d);
+  }
+  return executed;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_trace / lc3_trace_stop                      */
+/*                                                             */
+/* Purpose   : Start tracing to a new file, and finish it.     */
+/*                                                             */
+/***************************************************************/
+static void trace_free(Trace *t) {
+  int i;
+
+  for (i = 0; i < TRACE_CHUNKS; i++)
+    free(t->CHUNK[i]);
+  free(t->PACKED);
+  free(t);
+}
+
+int lc3_trace(lc3_machine *m, const char *filename, int flags) {
+  unsigned char header[TRACE_HEADER] = { 'L', 'C', '3', 'T' };
+  Trace *t;
+  int i;
+
+  lc3_trace_stop(m);
+  t = calloc(1, sizeof(Trace));
+  if (t == NULL)
+    return LC3_ERR_NOMEM;
+  for (i = 0; i < TRACE_CHUNKS; i++)
+    if ((t->CHUNK[i] = malloc(TRACE_CHUNK * sizeof(Trace_Entry))) == NULL)
+      goto nomem;
+  if ((flags & LC3_TRACE_PACKED) &&
+      (t->PACKED = malloc(TRACE_CHUNK * TRACE_PACKED_MAX)) == NULL)
+    goto nomem;
+
+  t->FD = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (t->FD < 0) {
+    trace_free(t);
+    return LC3_ERR_OPEN;
+  }
+  t->FLAGS = flags;
+  code_reset(&t->CODE);
+  put16(header + 4, TRACE_VERSION);
+  put16(header + 6, sizeof(Trace_Entry));
+  for (i = 0; i < 8; i++)
+    header[8 + i] = (m->intruction_COUNT >> 8 * i) & 0xFF;
+  put16(header + 16, flags);
+  if (write_all(t->FD, header, TRACE_HEADER) != 0)
+    t->WRITE_ERROR = TRUE;
+
+  pthread_mutex_init(&t->LOCK, NULL);
+  pthread_cond_init(&t->WAKE, NULL);
+  pthread_cond_init(&t->DONE, NULL);
+  if (pthread_create(&t->WRITER, NULL, trace_writer, t) != 0) {
+    close(t->FD);
+    goto nomem;
+  }
+  m->TRACE = t;
+  return 0;
+
+nomem:
+  trace_free(t);
+  return LC3_ERR_NOMEM;
+}
+
+int lc3_trace_stop(lc3_machine *m) {
+  Trace *t = m->TRACE;
+  int status;
+
+  if (t == NULL)
+    return 0;
+  pthread_mutex_lock(&t->LOCK);
+  t->QUIT = TRUE;
+  pthread_cond_signal(&t->WAKE);
+  pthread_mutex_unlock(&t->LOCK);
+  pthread_join(t->WRITER, NULL);
+
+  trace_write(t, t->CHUNK[t->FILL], t->LENGTH);	/* the partial chunk */
+  if (close(t->FD) != 0)
+    t->WRITE_ERROR = TRUE;
+  status = t->WRITE_ERROR ? LC3_ERR_OPEN : 0;
+
+  pthread_mutex_destroy(&t->LOCK);
+  pthread_cond_destroy(&t->WAKE);
+  pthread_cond_destroy(&t->DONE);
+  trace_free(t);
+  m->TRACE = NULL;
+  return status;
+}
+
+int lc3_tracing(lc3_machine *m) {
+  return m->TRACE != NULL;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : lc3_trace_open / lc3_trace_next                 */
+/*                                                             */
+/* Purpose   : Read a trace back, one entry at a time.         */
+/*                                                             */
+/***************************************************************/
+static int get16(FILE *f) {
+  int low = getc(f), high = getc(f);
+
+  return high == EOF ? -1 : low | high << 8;
+}
+
+lc3_trace_reader *lc3_trace_open(const char *filename) {
+  unsigned char header[TRACE_HEADER];
+  lc3_trace_reader *r;
+  FILE *f = fopen(filename, "rb");
+  int i;
+
+  if (f == NULL)
+    return NULL;
+  if (fread(header, 1, TRACE_HEADER, f) != TRACE_HEADER || memcmp(header, "LC3T", 4) != 0 ||
+      (header[4] | header[5] << 8) != TRACE_VERSION ||
+      (header[6] | header[7] << 8) != sizeof(Trace_Entry) ||
+      (r = malloc(sizeof(lc3_trace_reader))) == NULL) {
+    fclose(f);
+    return NULL;
+  }
+  r->FILE = f;
+  r->START = 0;
+  for (i = 7; i >= 0; i--)
+    r->START = r->START << 8 | header[8 + i];
+  r->FLAGS = header[16] | header[17] << 8;
+  code_reset(&r->CODE);
+  return r;
+}
+
+long long lc3_trace_start(lc3_trace_reader *r) {
+  return r->START;
+}
+
+/* Unpack the entry whose tag byte was just read; -1 if the file ends inside it. */
+static int trace_unpack(lc3_trace_reader *r, int tag, Trace_Entry *e) {
+  int kind = tag & TAG_KIND, cc = (tag >> TAG_CC_SHIFT) & 3, value;
+
+  e->kind = tag & (TAG_KIND | TAG_MORE);
+  e->cc = cc == 0 ? 0 : 1 << (3 - cc);
+  if ((value = tag & TAG_SAME_PC ? r->CODE.NEXT_PC : get16(r->FILE)) < 0)
+    return -1;
+  e->pc = value;
+  if (kind == LC3_TRACE_INTERRUPT)
+    value = 0;
+  else if ((value = tag & TAG_SAME_WORD ? r->CODE.WORD[e->pc] : get16(r->FILE)) < 0)
+    return -1;
+  e->intruction = value;
+  e->where = e->value = 0;
+  if (kind == LC3_TRACE_REG) {
+    if ((value = getc(r->FILE)) == EOF)
+      return -1;
+    e->where = value;
+  } else if (kind != LC3_TRACE_NONE) {
+    if ((value = get16(r->FILE)) < 0)
+      return -1;
+    e->where = value;
+  }
+  if (kind != LC3_TRACE_NONE) {
+    if ((value = get16(r->FILE)) < 0)
+      return -1;
+    e->value = value;
+  }
+  code_update(&r->CODE, e);
+  return 0;
+}
+
+int lc3_trace_next(lc3_trace_reader *r, lc3_trace_entry *entry) {
+  Trace_Entry e;
+  size_t got;
+  int tag;
+
+  if (r->FLAGS & LC3_TRACE_PACKED) {
+    if ((tag = getc(r->FILE)) == EOF)
+      return 0;
+    if (trace_unpack(r, tag, &e) != 0)
+      return -1;
+  } else if ((got = fread(&e, 1, sizeof(e), r->FILE)) != sizeof(e)) {
+    return got == 0 ? 0 : -1;
+  }
+  entry->pc = e.pc;
+  entry->intruction = e.intruction;
+  entry->kind = e.kind;
+  entry->where = e.where;
+  entry->value = e.value;
+  entry->cc = e.cc;
+  return 1;
+}
+
+void lc3_trace_close(lc3_trace_reader *r) {
+  fclose(r->FILE);
+  free(r);
+}
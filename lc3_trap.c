@@ -0,0 +1,228 @@
+#include <stdlib.h>
+
+#include "lc3_internal.h"
+
+/***************************************************************/
+/*                                                             */
+/* Native TRAP routines                                        */
+/*                                                             */
+/*   No OS image is loaded unless a program brings one, so     */
+/*   the trap vectors x20-x25 normally hold 0. For those       */
+/*   vectors TRAP runs a host version of the service routine   */
+/*   in one step instead of jumping to 0: R0 and R7 end as the */
+/*   real routine and its RET would leave them, the condition  */
+/*   codes are untouched. HALT turns the run bit (MCR[15])     */
+/*   off, as the real routine does, and leaves the PC at 0.    */
+/*   A nonzero vector means a guest routine is there: TRAP     */
+/*   saves the return address in R7 and jumps to it, so an OS  */
+/*   image loaded over the vectors takes over from the host.   */
+/*                                                             */
+/*   Output goes through the machine's console buffer and is   */
+/*   written out when it fills, before input is read, at HALT  */
+/*   and by lc3_console_flush().                               */
+/*                                                             */
+/*   Input comes from CONSOLE_IN, or after lc3_console_queue() */
+/*   from a ring the host fills, which never blocks: decode()  */
+/*   marks GETC and IN, and engine_step() stops in front of    */
+/*   one the ring can't serve yet with WAITING set, as a KBSR  */
+/*   read finding nothing does after the read.                 */
+/*                                                             */
+/***************************************************************/
+#define INPUT_RING 4096	/* a power of two */
+
+struct Input_Queue_Struct {
+  unsigned char RING[INPUT_RING];
+  unsigned HEAD, TAIL;	/* read and write counts */
+  int CLOSED;		/* no more is coming */
+};
+
+/*
+ * decode() marks GETC and IN only while there is a queue, so when one
+ * comes or goes their decodes are dropped to be redone. Only pages
+ * with decodes on them are looked at; a JIT decodes what it
+ * translates itself, so its translations all go.
+ */
+static void input_redecode(lc3_machine *m) {
+  Decoded_Intruction *d;
+  int page, i;
+
+  for (page = 0; page < PAGES_IN_MEM; page++) {
+    if (m->DECODED[page] == NULL)
+      continue;
+    for (i = 0; i < LC3_PAGE_WORDS; i++) {
+      d = &m->DECODED[page][i];
+      if (d->valid && d->intruction >> 12 == 0b1111 &&
+          ((d->intruction & 0xFF) == TRAP_GETC || (d->intruction & 0xFF) == TRAP_IN))
+        d->valid = FALSE;
+    }
+  }
+  jit_reset(m);
+}
+
+static void input_free(lc3_machine *m) {
+  if (m->INPUT == NULL)
+    return;
+  free(m->INPUT);
+  m->INPUT = NULL;
+  m->WAITING = FALSE;
+  input_redecode(m);	/* drop the GETC/IN marks */
+}
+
+void lc3_console(lc3_machine *m, FILE *input, FILE *output) {
+  lc3_console_flush(m);
+  if (input != m->CONSOLE_IN || m->INPUT != NULL)
+    keyboard_free(m);	/* its thread reads the old input */
+  input_free(m);
+  m->CONSOLE_IN = input;
+  m->CONSOLE_OUT = output;
+}
+
+int lc3_console_queue(lc3_machine *m) {
+  if (m->INPUT != NULL)
+    return 0;
+  if ((m->INPUT = calloc(1, sizeof(Input_Queue))) == NULL)
+    return LC3_ERR_NOMEM;
+  keyboard_free(m);
+  input_redecode(m);
+  return 0;
+}
+
+int lc3_console_feed(lc3_machine *m, const char *data, int length) {
+  Input_Queue *q = m->INPUT;
+  int n;
+
+  if (q == NULL || q->CLOSED)
+    return 0;
+  for (n = 0; n < length && q->TAIL - q->HEAD < INPUT_RING; n++)
+    q->RING[q->TAIL++ % INPUT_RING] = (unsigned char) data[n];
+  return n;
+}
+
+void lc3_console_end(lc3_machine *m) {
+  if (m->INPUT != NULL)
+    m->INPUT->CLOSED = TRUE;
+}
+
+/* Whether a GETC or IN now would find nothing to read. */
+int lc3_console_starved(lc3_machine *m) {
+  Input_Queue *q = m->INPUT;
+
+  return q != NULL && !q->CLOSED && q->TAIL == q->HEAD && !(m->KBSR & 0x8000);
+}
+
+int lc3_waiting(lc3_machine *m) {
+  return m->WAITING;
+}
+
+/* The next queued character, or -1 when there is none. */
+int input_take(lc3_machine *m) {
+  Input_Queue *q = m->INPUT;
+
+  if (q->TAIL == q->HEAD)
+    return -1;
+  return q->RING[q->HEAD++ % INPUT_RING];
+}
+
+/* Whether decode() should mark d: a GETC or IN reading the queue. */
+int input_stops_at(lc3_machine *m, const Decoded_Intruction *d) {
+  return m->INPUT != NULL && d->opcode == 0b1111 &&
+    (d->imm == TRAP_GETC || d->imm == TRAP_IN);
+}
+
+void lc3_console_flush(lc3_machine *m) {
+  if (m->CONSOLE_OUT != NULL && m->OUTPUT_LENGTH > 0) {
+    fwrite(m->OUTPUT, 1, m->OUTPUT_LENGTH, m->CONSOLE_OUT);
+    fflush(m->CONSOLE_OUT);
+  }
+  m->OUTPUT_LENGTH = 0;
+}
+
+void console_put(lc3_machine *m, int c) {
+  if (m->CONSOLE_OUT == NULL)
+    return;
+  if (m->OUTPUT_LENGTH == CONSOLE_BUFFER)
+    lc3_console_flush(m);
+  m->OUTPUT[m->OUTPUT_LENGTH++] = (char) c;
+}
+
+/* The next input character, or 0 at end of input. */
+static int console_get(lc3_machine *m) {
+  int c;
+
+  lc3_console_flush(m);	/* show any prompt first */
+  if (m->INPUT != NULL) {
+    if (m->KBSR & 0x8000) {
+      m->KBSR &= ~0x8000;
+      return m->KBDR;
+    }
+    return (c = input_take(m)) < 0 ? 0 : c;	/* empty only once closed */
+  }
+  if (m->KEYBOARD != NULL)
+    return keyboard_getc(m);	/* the keyboard thread owns the input */
+  if (m->CONSOLE_IN == NULL || (c = getc(m->CONSOLE_IN)) == EOF)
+    return 0;
+  return c & 0xFF;
+}
+
+static int is_native_trap(lc3_machine *m, int vector) {
+  return vector >= TRAP_GETC && vector <= TRAP_HALT && m->MEMORY[vector] == 0;
+}
+
+/* Whether the TRAP d, about to run, would have to wait for input. */
+int input_blocks(lc3_machine *m, const Decoded_Intruction *d) {
+  return input_stops_at(m, d) && is_native_trap(m, d->imm) && lc3_console_starved(m);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : trap                                            */
+/*                                                             */
+/* Purpose   : Execute TRAP vector for any engine, given its   */
+/*             registers and the address after the TRAP.       */
+/*             Returns the new PC.                             */
+/*                                                             */
+/***************************************************************/
+int trap(lc3_machine *m, int vector, int regs[], int pc) {
+  const char *prompt;
+  int address, n;
+
+  if (!is_native_trap(m, vector)) {
+    regs[7] = pc;
+    return m->MEMORY[vector];
+  }
+
+  switch (vector) {
+  case TRAP_GETC:
+    regs[0] = console_get(m);
+    break;
+  case TRAP_OUT:
+    console_put(m, regs[0]);
+    break;
+  case TRAP_PUTS:
+    for (address = regs[0], n = 0; n < WORDS_IN_MEM && m->MEMORY[address] != 0; n++) {
+      console_put(m, m->MEMORY[address]);
+      address = Low16bits(address + 1);
+    }
+    break;
+  case TRAP_IN:
+    for (prompt = "Input a character> "; *prompt; prompt++)
+      console_put(m, *prompt);
+    regs[0] = console_get(m);
+    console_put(m, regs[0]);
+    console_put(m, '\n');
+    break;
+  case TRAP_PUTSP:
+    for (address = regs[0], n = 0; n < WORDS_IN_MEM && m->MEMORY[address] != 0; n++) {
+      console_put(m, m->MEMORY[address]);
+      if (m->MEMORY[address] >> 8)
+        console_put(m, m->MEMORY[address] >> 8);
+      address = Low16bits(address + 1);
+    }
+    break;
+  case TRAP_HALT:
+    m->RUN_BIT = FALSE;
+    return 0x0000;
+  }
+  regs[7] = pc;
+  return pc;
+}
@@ -1,100 +1,223 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lc3.h"
 
 /***************************************************************/
 /*                                                             */
 /* Files: isaprogram   LC-3 machine language program file     */
 /*                                                             */
+/*   Interactive shell over the simulator library (lc3.h).     */
+/*                                                             */
 /***************************************************************/
 
 /***************************************************************/
-/* These are the functions you'll have to write.               */
+/* The machine driven by the shell.                            */
 /***************************************************************/
-
-void process_intruction();
+lc3_machine *machine;
 
 /***************************************************************/
-/* A couple of useful definitions.                             */
+/* Where commands come from and where dumps go. A script (-s)  */
+/* runs without prompts and with big output buffers; -q drops  */
+/* the copy of each dump on stdout; -d picks the form of       */
+/* dumpsim.                                                    */
 /***************************************************************/
-#define FALSE 0
-#define TRUE  1
+#define DUMP_TEXT   0
+#define DUMP_JSON   1	/* one JSON object per line */
+#define DUMP_BINARY 2	/* "LC3D" u16 version, then tagged records */
 
-/***************************************************************/
-/* Use this to avoid overflowing 16 bits on the bus.           */
-/***************************************************************/
-#define Low16bits(x) ((x) & 0xFFFF)
+#define DUMP_VERSION 1
+#define OUTPUT_BUFFER (1 << 20)	/* stdio buffers of a script run */
+#define DUMP_BUFFER   (1 << 16)	/* text formatted before each write */
 
-/***************************************************************/
-/* Main memory.                                                */
-/***************************************************************/
-/* 
-  MEMORY[A] stores the word address A
-*/
-
-#define WORDS_IN_MEM    0x08000 
-int MEMORY[WORDS_IN_MEM];
+FILE *commands;
+int interactive = TRUE;
+int dump_screen = TRUE;
+int dump_format = DUMP_TEXT;
 
 /***************************************************************/
-
+/*                                                             */
+/* Procedure : help                                            */
+/*                                                             */
+/* Purpose   : Print out a list of commands                    */
+/*                                                             */
 /***************************************************************/
+void help() {                                                    
+  printf("----------------LC-3 ISIM Help-----------------------\n");
+  printf("go               -  run program to completion         \n");
+  printf("run n            -  execute program for n intructions\n");
+  printf("mdump low high   -  dump memory from low to high      \n");
+  printf("rdump            -  dump the register & bus values    \n");
+  printf("save file        -  write a snapshot of the machine   \n");
+  printf("restore file     -  go back to a saved snapshot       \n");
+  printf("profile          -  report hot spots (-e profile)     \n");
+  printf("break a [if c]   -  stop before a, if Rn op v or nzp  \n");
+  printf("watch a          -  stop after a store to a           \n");
+  printf("delete a         -  remove the break/watch at a       \n");
+  printf("record file|off  -  log execution so it can go back   \n");
+  printf("rstep n          -  go back n intructions (record)    \n");
+  printf("rcontinue        -  go back to the last breakpoint    \n");
+  printf("trace [packed] f -  trace every intruction to f, or off\n");
+  printf("?                -  display this help menu            \n");
+  printf("quit             -  exit the program                  \n\n");
+}
 
 /***************************************************************/
-/* LC-3 State info.                                           */
+/*                                                             */
+/* Procedure : skip_line                                       */
+/*                                                             */
+/* Purpose   : Drop the rest of the command line, so GETC and  */
+/*             IN read what is typed after it, not its newline.*/
+/*                                                             */
 /***************************************************************/
-#define LC_3_REGS 8
-
-int RUN_BIT;	/* run bit */
+void skip_line() {
+  int c;
 
+  while ((c = getc(commands)) != '\n' && c != EOF);
+}
 
-typedef struct System_Latches_Struct{
+/***************************************************************/
+/*                                                             */
+/* Procedure : stopped                                         */
+/*                                                             */
+/* Purpose   : Report a breakpoint or watchpoint that ended    */
+/*             the last run. Returns TRUE if there was one.    */
+/*                                                             */
+/***************************************************************/
+int stopped() {
+  lc3_stop stop;
+  System_Latches latches;
+
+  lc3_stopped(machine, &stop);
+  lc3_get_regs(machine, &latches);
+  if (stop.reason == LC3_STOP_BREAK)
+    printf("Breakpoint at 0x%.4x\n\n", stop.address);
+  else if (stop.reason == LC3_STOP_WATCH)
+    printf("Watchpoint: MEMORY[0x%.4x] 0x%.4x -> 0x%.4x (PC 0x%.4x)\n\n",
+           stop.address, stop.old_value, stop.new_value, latches.PC);
+  return stop.reason != LC3_STOP_NONE;
+}
 
-  int PC,		/* program counter */
-    N,		/* n condition bit */
-    Z,		/* z condition bit */
-    P;		/* p condition bit */
-  int REGS[LC_3_REGS]; /* register file. */
-} System_Latches;
+/* What memoization (-m) saved, after a run that halted. */
+void memo_text(FILE *file) {
+  lc3_memo_stats memo;
 
-/* Data Structure for Latch */
+  if (lc3_memo_report(machine, &memo) != 0)
+    return;
+  fprintf(file, "Memo : %lld calls, %lld hits, %lld misses, %lld intructions skipped, %lld routines given up\n\n",
+          memo.calls, memo.hits, memo.misses, memo.skipped, memo.given_up);
+}
 
-System_Latches CURRENT_LATCHES, NEXT_LATCHES;
+static const char *opcode_names[16] = {
+  "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+  "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP"
+};
 
-/***************************************************************/
-/* A cycle counter.                                            */
-/***************************************************************/
-int intruction_COUNT;
+static const char *fuse_names[LC3_FUSE_KINDS] = {
+  NULL, "ADD+BR", "LDR+ADD", "AND+ADD", "LDR+ADD+BR"
+};
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : help                                            */
+/* Procedure : fuse_walk_text                                  */
 /*                                                             */
-/* Purpose   : Print out a list of commands                    */
+/* Purpose   : What the control flow walk for fusing (-f)      */
+/*             found: the code, its commonest pairs and        */
+/*             triples, and the sites fused.                   */
 /*                                                             */
 /***************************************************************/
-void help() {                                                    
-  printf("----------------LC-3 ISIM Help-----------------------\n");
-  printf("go               -  run program to completion         \n");
-  printf("run n            -  execute program for n intructions\n");
-  printf("mdump low high   -  dump memory from low to high      \n");
-  printf("rdump            -  dump the register & bus values    \n");
-  printf("?                -  display this help menu            \n");
-  printf("quit             -  exit the program                  \n\n");
+void fuse_walk_text(FILE *file) {
+  lc3_fuse_stats f;
+  int i, k;
+
+  if (lc3_fuse_report(machine, &f) != 0)
+    return;
+  fprintf(file, "Fuse : %d code words in %d blocks;", f.code_words, f.blocks);
+  for (k = 1; k < LC3_FUSE_KINDS; k++)
+    fprintf(file, " %s %d%s", fuse_names[k], f.sites[k], k + 1 < LC3_FUSE_KINDS ? "," : "\n");
+  fprintf(file, "       pairs:");
+  for (i = 0; i < LC3_FUSE_TOP && f.pairs[i][0] > 0; i++)
+    fprintf(file, " %s+%s %d", opcode_names[f.pairs[i][1]], opcode_names[f.pairs[i][2]],
+            f.pairs[i][0]);
+  fprintf(file, "\n       triples:");
+  for (i = 0; i < LC3_FUSE_TOP && f.triples[i][0] > 0; i++)
+    fprintf(file, " %s+%s+%s %d", opcode_names[f.triples[i][1]],
+            opcode_names[f.triples[i][2]], opcode_names[f.triples[i][3]], f.triples[i][0]);
+  fprintf(file, "\n\n");
+}
+
+/* How often each kind of superintruction ran (-f), after a run that halted. */
+void fuse_text(FILE *file) {
+  lc3_fuse_stats f;
+  int k;
+
+  if (lc3_fuse_report(machine, &f) != 0)
+    return;
+  fprintf(file, "Fused :");
+  for (k = 1; k < LC3_FUSE_KINDS; k++)
+    fprintf(file, " %s %lld%s", fuse_names[k], f.runs[k], k + 1 < LC3_FUSE_KINDS ? "," : "\n\n");
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : cycle                                           */
+/* Procedure : host_text                                       */
 /*                                                             */
-/* Purpose   : Execute a cycle                                 */
+/* Purpose   : What the last run command cost the host (-H),   */
+/*             per intruction overall and per sampled opcode,  */
+/*             then start the counts again.                    */
 /*                                                             */
 /***************************************************************/
-void cycle() {                                                
-
-  process_intruction();
-  CURRENT_LATCHES = NEXT_LATCHES;
-  intruction_COUNT++;
+void host_text(FILE *file) {
+  static const char *names[LC3_HOST_COUNTERS] = {
+    "cycles", "instructions", "branch misses", "cache misses"
+  };
+  lc3_hostperf_stats h;
+  long long samples = 0;
+  int op, k;
+
+  if (lc3_hostperf_report(machine, &h) != 0)
+    return;
+  lc3_hostperf_clear(machine);
+  if (h.source == LC3_HOST_TSC)
+    names[LC3_HOST_CYCLES] = "TSC ticks";
+  else if (h.source == LC3_HOST_CLOCK)
+    names[LC3_HOST_CYCLES] = "ns";
+
+  fprintf(file, "Host : %lld intructions", h.intructions);
+  for (k = 0; k < LC3_HOST_COUNTERS; k++)
+    if (h.have & (1 << k))
+      fprintf(file, ", %.2f %s", h.intructions ? (double) h.total[k] / h.intructions : 0.0,
+              names[k]);
+  fprintf(file, " per intruction\n");
+
+  for (op = 0; op < 16; op++)
+    samples += h.samples[op];
+  if (samples == 0) {
+    fprintf(file, "\n");
+    return;
+  }
+  fprintf(file, "       sampled  share      least");
+  for (k = 0; k < LC3_HOST_COUNTERS; k++)
+    if (h.have & (1 << k))
+      fprintf(file, " %14s", names[k]);
+  fprintf(file, "\n");
+  for (op = 0; op < 16; op++) {
+    if (h.samples[op] == 0)
+      continue;
+    fprintf(file, "  %-4s %8lld %5.1f%% %10llu", opcode_names[op], h.samples[op],
+            100.0 * h.samples[op] / samples, h.least[op][LC3_HOST_CYCLES]);
+    for (k = 0; k < LC3_HOST_COUNTERS; k++)
+      if (h.have & (1 << k))
+        fprintf(file, " %14.2f", (double) h.sampled[op][k] / h.samples[op]);
+    fprintf(file, "\n");
+  }
+  fprintf(file, "\n");
 }
 
 /***************************************************************/
@@ -105,21 +228,24 @@ void cycle() {
 /*                                                             */
 /***************************************************************/
 void run(int num_cycles) {                                      
-  int i;
-
-  if (RUN_BIT == FALSE) {
+  if (lc3_halted(machine)) {
     printf("Can't simulate, Simulator is halted\n\n");
     return;
   }
 
   printf("Simulating for %d cycles...\n\n", num_cycles);
-  for (i = 0; i < num_cycles; i++) {
-    if (CURRENT_LATCHES.PC == 0x0000) {
-	    RUN_BIT = FALSE;
-	    printf("Simulator halted\n\n");
-	    break;
-    }
-    cycle();
+  if (interactive)
+    fflush(stdout);
+  lc3_run(machine, num_cycles);
+  lc3_console_flush(machine);
+  host_text(stdout);
+  if (stopped())
+    return;
+  if (lc3_halted(machine)) {
+    printf("Simulator halted\n\n");
+    lc3_profile_report(machine, stdout);
+    memo_text(stdout);
+    fuse_text(stdout);
   }
 }
 
@@ -131,16 +257,89 @@ void run(int num_cycles) {
 /*                                                             */
 /***************************************************************/
 void go() {                                                     
-  if (RUN_BIT == FALSE) {
+  if (lc3_halted(machine)) {
     printf("Can't simulate, Simulator is halted\n\n");
     return;
   }
 
   printf("Simulating...\n\n");
-  while (CURRENT_LATCHES.PC != 0x0000)
-    cycle();
-  RUN_BIT = FALSE;
+  if (interactive)
+    fflush(stdout);
+  while (!lc3_halted(machine)) {
+    lc3_run(machine, INT_MAX);
+    lc3_console_flush(machine);
+    if (stopped()) {
+      host_text(stdout);
+      return;
+    }
+  }
+  host_text(stdout);
   printf("Simulator halted\n\n");
+  lc3_profile_report(machine, stdout);
+  memo_text(stdout);
+  fuse_text(stdout);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : dump text                                       */
+/*                                                             */
+/* Purpose   : Format dump lines into a buffer by hand and     */
+/*             write it in blocks, so big dumps cost neither a */
+/*             printf nor a stdio lock per line.               */
+/*                                                             */
+/***************************************************************/
+typedef struct Dump_Text_Struct {
+  FILE *file;
+  int length;
+  char text[DUMP_BUFFER];
+} Dump_Text;
+
+void dump_flush(Dump_Text *d) {
+  fwrite(d->text, 1, d->length, d->file);
+  d->length = 0;
+}
+
+void dump_string(Dump_Text *d, const char *s) {
+  while (*s)
+    d->text[d->length++] = *s++;
+}
+
+/* At least digits hex digits, as %.<digits>x. */
+void dump_hex(Dump_Text *d, int value, int digits) {
+  char digit[8];
+  int n = 0;
+
+  do {
+    digit[n++] = "0123456789abcdef"[value & 0xF];
+    value >>= 4;
+  } while (value != 0);
+  for (; n < digits; n++)
+    digit[n] = '0';
+  while (n > 0)
+    d->text[d->length++] = digit[--n];
+}
+
+void dump_decimal(Dump_Text *d, int value) {
+  char digit[12];
+  int n = 0;
+
+  if (value < 0) {
+    d->text[d->length++] = '-';
+    value = -value;
+  }
+  do {
+    digit[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  while (n > 0)
+    d->text[d->length++] = digit[--n];
+}
+
+/* Make room for one more line. */
+void dump_line(Dump_Text *d) {
+  if (d->length > DUMP_BUFFER - 128)
+    dump_flush(d);
 }
 
 /***************************************************************/ 
@@ -148,25 +347,94 @@ void go() {
 /* Procedure : mdump                                           */
 /*                                                             */
 /* Purpose   : Dump a word-aligned region of memory to the     */
-/*             output file.                                    */
+/*             output file. Pages never written are all zero   */
+/*             and get one line each.                          */
 /*                                                             */
 /***************************************************************/
-void mdump(FILE * dumpsim_file, int start, int stop) {          
-  int address; /* this is a address */
+int untouched_until(int address, int stop) {
+  int last = address | (LC3_PAGE_WORDS - 1);
 
-  printf("\nMemory content [0x%.4x..0x%.4x] :\n", start, stop);
-  printf("-------------------------------------\n");
-  for (address = start ; address <= stop ; address++)
-    printf("  0x%.4x (%d) : 0x%.2x\n", address , address , MEMORY[address]);
-  printf("\n");
+  if (lc3_mem_touched(machine, address))
+    return -1;
+  return last < stop ? last : stop;
+}
+
+/* The text form, each line indented by indent. */
+void mdump_text(FILE *file, const char *indent, int start, int stop) {
+  static Dump_Text d;
+  int address, last;
+
+  d.file = file;
+  dump_string(&d, "\nMemory content [0x");
+  dump_hex(&d, start, 4);
+  dump_string(&d, "..0x");
+  dump_hex(&d, stop, 4);
+  dump_string(&d, "] :\n-------------------------------------\n");
+  for (address = start ; address <= stop ; address++) {
+    dump_line(&d);
+    dump_string(&d, indent);
+    dump_string(&d, "0x");
+    dump_hex(&d, address, 4);
+    if ((last = untouched_until(address, stop)) >= 0) {
+      dump_string(&d, "..0x");
+      dump_hex(&d, last, 4);
+      dump_string(&d, " : 0x00 (untouched)\n");
+      address = last;
+    } else {
+      dump_string(&d, " (");
+      dump_decimal(&d, address);
+      dump_string(&d, ") : 0x");
+      dump_hex(&d, lc3_read_mem(machine, address), 2);
+      dump_string(&d, "\n");
+    }
+  }
+  dump_string(&d, "\n");
+  dump_flush(&d);
+}
+
+void put16(FILE *file, int value) {
+  putc(value & 0xFF, file);
+  putc((value >> 8) & 0xFF, file);
+}
 
-  /* dump the memory contents into the dumpsim file */
-  fprintf(dumpsim_file, "\nMemory content [0x%.4x..0x%.4x] :\n", start, stop);
-  fprintf(dumpsim_file, "-------------------------------------\n");
-  for (address = start ; address <= stop ; address++)
-    fprintf(dumpsim_file, " 0x%.4x (%d) : 0x%.2x\n", address , address , MEMORY[address]);
-  fprintf(dumpsim_file, "\n");
-  fflush(dumpsim_file);
+void mdump(FILE * dumpsim_file, int start, int stop) {          
+  static Dump_Text d;
+  int address;
+
+  if (dump_screen)
+    mdump_text(stdout, "  ", start, stop);
+
+  switch (dump_format) {
+  case DUMP_JSON:
+    d.file = dumpsim_file;
+    dump_string(&d, "{\"mdump\": {\"start\": ");
+    dump_decimal(&d, start);
+    dump_string(&d, ", \"stop\": ");
+    dump_decimal(&d, stop);
+    dump_string(&d, ", \"memory\": [");
+    for (address = start ; address <= stop ; address++) {
+      dump_line(&d);
+      if (address > start)
+        dump_string(&d, ", ");
+      dump_decimal(&d, lc3_read_mem(machine, address));
+    }
+    dump_string(&d, "]}}\n");
+    dump_flush(&d);
+    break;
+  case DUMP_BINARY:
+    putc('M', dumpsim_file);
+    put16(dumpsim_file, start);
+    put16(dumpsim_file, stop);
+    for (address = start ; address <= stop ; address++)
+      put16(dumpsim_file, lc3_read_mem(machine, address));
+    break;
+  default:
+    /* dump the memory contents into the dumpsim file */
+    mdump_text(dumpsim_file, " ", start, stop);
+    break;
+  }
+  if (interactive)
+    fflush(dumpsim_file);
 }
 
 /***************************************************************/
@@ -177,74 +445,361 @@ void mdump(FILE * dumpsim_file, int start, int stop) {
 /*             output file.                                    */
 /*                                                             */
 /***************************************************************/
+/* The timing model's counts, when it is on (-t). */
+void timing_text(FILE *file, const lc3_timing_stats *t) {
+  fprintf(file, "Cycles            : %lld\n", t->cycles);
+  fprintf(file, "CPI               : %.3f\n",
+          t->intructions ? (double) t->cycles / t->intructions : 0.0);
+  fprintf(file, "Stalls            : branch %lld  load-use %lld  icache %lld  dcache %lld  device %lld\n",
+          t->branch_stalls, t->load_use_stalls, t->icache_stalls, t->dcache_stalls, t->device_stalls);
+  fprintf(file, "I-cache           : %lld accesses  %lld misses  %.2f%%\n", t->icache_accesses,
+          t->icache_misses, t->icache_accesses ? 100.0 * t->icache_misses / t->icache_accesses : 0.0);
+  fprintf(file, "D-cache           : %lld accesses  %lld misses  %.2f%%\n", t->dcache_accesses,
+          t->dcache_misses, t->dcache_accesses ? 100.0 * t->dcache_misses / t->dcache_accesses : 0.0);
+}
+
+void rdump_text(FILE *file, long long intruction_COUNT, System_Latches *CURRENT_LATCHES) {
+  lc3_timing_stats timing;
+  int k;
+
+  fprintf(file, "\nCurrent register/bus values :\n");
+  fprintf(file, "-------------------------------------\n");
+  fprintf(file, "intruction Count : %lld\n", intruction_COUNT);
+  fprintf(file, "PC                : 0x%.4x\n", CURRENT_LATCHES->PC);
+  fprintf(file, "CCs: N = %d  Z = %d  P = %d\n", CURRENT_LATCHES->N, CURRENT_LATCHES->Z, CURRENT_LATCHES->P);
+  fprintf(file, "Registers:\n");
+  for (k = 0; k < LC_3_REGS; k++)
+    fprintf(file, "%d: 0x%.4x\n", k, CURRENT_LATCHES->REGS[k]);
+  if (lc3_timing_report(machine, &timing) == 0)
+    timing_text(file, &timing);
+  fprintf(file, "\n");
+}
+
 void rdump(FILE * dumpsim_file) {                               
+  System_Latches CURRENT_LATCHES;
+  lc3_timing_stats timing;
+  long long intruction_COUNT = lc3_count(machine);
   int k; 
 
-  printf("\nCurrent register/bus values :\n");
-  printf("-------------------------------------\n");
-  printf("intruction Count : %d\n", intruction_COUNT);
-  printf("PC                : 0x%.4x\n", CURRENT_LATCHES.PC);
-  printf("CCs: N = %d  Z = %d  P = %d\n", CURRENT_LATCHES.N, CURRENT_LATCHES.Z, CURRENT_LATCHES.P);
-  printf("Registers:\n");
-  for (k = 0; k < LC_3_REGS; k++)
-    printf("%d: 0x%.4x\n", k, CURRENT_LATCHES.REGS[k]);
-  printf("\n");
+  lc3_get_regs(machine, &CURRENT_LATCHES);
+
+  if (dump_screen)
+    rdump_text(stdout, intruction_COUNT, &CURRENT_LATCHES);
 
   /* dump the state information into the dumpsim file */
-  fprintf(dumpsim_file, "\nCurrent register/bus values :\n");
-  fprintf(dumpsim_file, "-------------------------------------\n");
-  fprintf(dumpsim_file, "intruction Count : %d\n", intruction_COUNT);
-  fprintf(dumpsim_file, "PC                : 0x%.4x\n", CURRENT_LATCHES.PC);
-  fprintf(dumpsim_file, "CCs: N = %d  Z = %d  P = %d\n", CURRENT_LATCHES.N, CURRENT_LATCHES.Z, CURRENT_LATCHES.P);
-  fprintf(dumpsim_file, "Registers:\n");
-  for (k = 0; k < LC_3_REGS; k++)
-    fprintf(dumpsim_file, "%d: 0x%.4x\n", k, CURRENT_LATCHES.REGS[k]);
-  fprintf(dumpsim_file, "\n");
-  fflush(dumpsim_file);
+  switch (dump_format) {
+  case DUMP_JSON:
+    fprintf(dumpsim_file, "{\"rdump\": {\"count\": %lld, \"pc\": %d, \"n\": %d, \"z\": %d, \"p\": %d, \"regs\": [",
+            intruction_COUNT, CURRENT_LATCHES.PC, CURRENT_LATCHES.N, CURRENT_LATCHES.Z, CURRENT_LATCHES.P);
+    for (k = 0; k < LC_3_REGS; k++)
+      fprintf(dumpsim_file, k ? ", %d" : "%d", CURRENT_LATCHES.REGS[k]);
+    fprintf(dumpsim_file, "]");
+    if (lc3_timing_report(machine, &timing) == 0)
+      fprintf(dumpsim_file, ", \"timing\": {\"cycles\": %lld, \"intructions\": %lld, \"taken\": %lld, "
+              "\"stalls\": {\"branch\": %lld, \"load_use\": %lld, \"icache\": %lld, \"dcache\": %lld, "
+              "\"device\": %lld}, \"icache\": {\"accesses\": %lld, \"misses\": %lld}, "
+              "\"dcache\": {\"accesses\": %lld, \"misses\": %lld}, \"device_accesses\": %lld}",
+              timing.cycles, timing.intructions, timing.taken, timing.branch_stalls,
+              timing.load_use_stalls, timing.icache_stalls, timing.dcache_stalls, timing.device_stalls,
+              timing.icache_accesses, timing.icache_misses, timing.dcache_accesses,
+              timing.dcache_misses, timing.device_accesses);
+    fprintf(dumpsim_file, "}}\n");
+    break;
+  case DUMP_BINARY:
+    putc('R', dumpsim_file);
+    for (k = 0; k < 64; k += 16)
+      put16(dumpsim_file, (intruction_COUNT >> k) & 0xFFFF);
+    put16(dumpsim_file, CURRENT_LATCHES.PC);
+    putc((CURRENT_LATCHES.N << 2) | (CURRENT_LATCHES.Z << 1) | CURRENT_LATCHES.P, dumpsim_file);
+    for (k = 0; k < LC_3_REGS; k++)
+      put16(dumpsim_file, CURRENT_LATCHES.REGS[k]);
+    break;
+  default:
+    rdump_text(dumpsim_file, intruction_COUNT, &CURRENT_LATCHES);
+    break;
+  }
+  if (interactive)
+    fflush(dumpsim_file);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : profile                                         */
+/*                                                             */
+/* Purpose   : Dump the profile so far to the output file.     */
+/*             go and run print it by themselves at HALT.      */
+/*                                                             */
+/***************************************************************/
+void profile(FILE * dumpsim_file) {
+  if (lc3_profile_report(machine, stdout) != 0) {
+    printf("Not profiling, start the simulator with -e profile\n\n");
+    return;
+  }
+  if (dump_format != DUMP_TEXT)
+    return;	/* the report is text only */
+  lc3_profile_report(machine, dumpsim_file);
+  if (interactive)
+    fflush(dumpsim_file);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : save / restore                                  */
+/*                                                             */
+/* Purpose   : Write the machine state to a snapshot file, or  */
+/*             replace it with one read back.                  */
+/*                                                             */
+/***************************************************************/
+void save(char *filename) {
+  lc3_snapshot *snapshot = lc3_snapshot_take(machine);
+
+  if (snapshot == NULL || lc3_snapshot_save(snapshot, filename) != 0)
+    printf("Error: Can't save snapshot to %s\n\n", filename);
+  else
+    printf("Saved snapshot to %s\n\n", filename);
+  lc3_snapshot_free(snapshot);
+}
+
+void restore(char *filename) {
+  lc3_snapshot *snapshot;
+
+  if (lc3_snapshot_load(filename, &snapshot) != 0 ||
+      lc3_snapshot_restore(machine, snapshot) != 0)
+    printf("Error: Can't restore snapshot from %s\n\n", filename);
+  else
+    printf("Restored snapshot from %s\n\n", filename);
+  lc3_snapshot_free(snapshot);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : parse_condition                                 */
+/*                                                             */
+/* Purpose   : Read "if Rn op value" or "if nzp" from the rest */
+/*             of a break command. Returns 0, or -1 if it is   */
+/*             neither.                                        */
+/*                                                             */
+/***************************************************************/
+int parse_condition(char *text, lc3_condition *cond) {
+  static const char *ops[] = { "==", "!=", "<", "<=", ">", ">=" };
+  char op[4], flags[8];
+  int reg, value, k;
+
+  if (sscanf(text, " if R%d %3s %i", &reg, op, &value) == 3 ||
+      sscanf(text, " if r%d %3s %i", &reg, op, &value) == 3) {
+    for (k = 0; k < 6 && strcmp(op, ops[k]) != 0; k++);
+    if (reg < 0 || reg >= LC_3_REGS || k == 6)
+      return -1;
+    cond->reg = reg;
+    cond->op = k;
+    cond->value = value;
+    return 0;
+  }
+  if (sscanf(text, " if %7s", flags) == 1 && strspn(flags, "nzpNZP") == strlen(flags)) {
+    cond->reg = LC3_COND_CC;
+    cond->op = LC3_EQ;
+    cond->value = (strpbrk(flags, "nN") ? 4 : 0) | (strpbrk(flags, "zZ") ? 2 : 0) |
+                  (strpbrk(flags, "pP") ? 1 : 0);
+    return 0;
+  }
+  return -1;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : breakpoint / watchpoint / delete                */
+/*                                                             */
+/* Purpose   : Arm or remove stops for go and run.             */
+/*                                                             */
+/***************************************************************/
+void breakpoint(int address, char *rest) {
+  lc3_condition cond;
+  int conditional = strspn(rest, " \t\n") != strlen(rest);
+
+  if (conditional && parse_condition(rest, &cond) != 0) {
+    printf("Error: condition is \"if Rn op value\" (== != < <= > >=) or \"if nzp\"\n\n");
+    return;
+  }
+  if (lc3_break(machine, address, conditional ? &cond : NULL) != 0)
+    printf("Error: Can't set breakpoint\n\n");
+  else
+    printf("Breakpoint set at 0x%.4x\n\n", address & 0xFFFF);
+}
+
+void watchpoint(int address) {
+  if (lc3_watch(machine, address) != 0)
+    printf("Error: Can't set watchpoint\n\n");
+  else
+    printf("Watchpoint set at 0x%.4x\n\n", address & 0xFFFF);
+}
+
+void delete(int address) {
+  lc3_clear(machine, address);
+  printf("Deleted break/watch at 0x%.4x\n\n", address & 0xFFFF);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : record / rstep / rcontinue                      */
+/*                                                             */
+/* Purpose   : Start or stop recording, and step back through  */
+/*             the recording.                                  */
+/*                                                             */
+/***************************************************************/
+void record(char *filename) {
+  if (strcmp(filename, "off") == 0) {
+    if (!lc3_recording(machine))
+      printf("Not recording\n\n");
+    else if (lc3_record_stop(machine) != 0)
+      printf("Error: Can't write the whole recording\n\n");
+    else
+      printf("Recording stopped\n\n");
+  } else if (lc3_record(machine, filename) != 0)
+    printf("Error: Can't record to %s\n\n", filename);
+  else
+    printf("Recording to %s\n\n", filename);
+}
+
+void rstep(int n, int to_break) {
+  int undone;
+
+  if (!lc3_recording(machine)) {
+    printf("Can't go back, not recording\n\n");
+    return;
+  }
+  undone = to_break ? lc3_rcontinue(machine) : lc3_rstep(machine, n);
+  printf("Went back %d intructions\n\n", undone);
+  stopped();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : trace                                           */
+/*                                                             */
+/* Purpose   : Start or stop tracing.                          */
+/*                                                             */
+/***************************************************************/
+void trace(char *filename, int flags) {
+  if (strcmp(filename, "off") == 0) {
+    if (!lc3_tracing(machine))
+      printf("Not tracing\n\n");
+    else if (lc3_trace_stop(machine) != 0)
+      printf("Error: Can't write the whole trace\n\n");
+    else
+      printf("Tracing stopped\n\n");
+  } else if (lc3_trace(machine, filename, flags) != 0)
+    printf("Error: Can't trace to %s\n\n", filename);
+  else
+    printf("Tracing to %s\n\n", filename);
 }
 
 /***************************************************************/
 /*                                                             */
 /* Procedure : get_command                                     */
 /*                                                             */
-/* Purpose   : Read a command from standard input.             */  
+/* Purpose   : Read a command from standard input, or from the */
+/*             script.                                         */
 /*                                                             */
 /***************************************************************/
 void get_command(FILE * dumpsim_file) {                         
   char buffer[20];
+  char filename[256], rest[256];
   int start, stop, cycles;
 
-  printf("LC-3-SIM> ");
+  if (interactive)
+    printf("LC-3-SIM> ");
 
-  scanf("%s", buffer);
-  printf("\n");
+  if (fscanf(commands, "%19s", buffer) != 1) {
+    fclose(dumpsim_file);
+    exit(0);	/* end of the script */
+  }
+  if (interactive)
+    printf("\n");
 
   switch(buffer[0]) {
   case 'G':
   case 'g':
+    skip_line();
     go();
     break;
 
+  case 'B':
+  case 'b':
+    fscanf(commands, "%i", &start);
+    if (fgets(rest, sizeof(rest), commands) == NULL)
+      rest[0] = '\0';
+    breakpoint(start, rest);
+    break;
+
+  case 'D':
+  case 'd':
+    fscanf(commands, "%i", &start);
+    delete(start);
+    break;
+
   case 'M':
   case 'm':
-    scanf("%i %i", &start, &stop);
+    fscanf(commands, "%i %i", &start, &stop);
     mdump(dumpsim_file, start, stop);
     break;
 
+  case 'P':
+  case 'p':
+    profile(dumpsim_file);
+    break;
+
+  case 'S':
+  case 's':
+    fscanf(commands, "%255s", filename);
+    save(filename);
+    break;
+
+  case 'W':
+  case 'w':
+    fscanf(commands, "%i", &start);
+    watchpoint(start);
+    break;
+
+  case 'T':
+  case 't':
+    fscanf(commands, "%255s", filename);
+    if (strcmp(filename, "packed") == 0) {
+      fscanf(commands, "%255s", filename);
+      trace(filename, LC3_TRACE_PACKED);
+    } else
+      trace(filename, 0);
+    break;
+
   case '?':
     help();
     break;
   case 'Q':
   case 'q':
     printf("Bye.\n");
+    fclose(dumpsim_file);
     exit(0);
 
   case 'R':
   case 'r':
-    if (buffer[1] == 'd' || buffer[1] == 'D')
+    if (strcmp(buffer, "record") == 0) {
+	    fscanf(commands, "%255s", filename);
+	    record(filename);
+    }
+    else if (strcmp(buffer, "rstep") == 0) {
+	    fscanf(commands, "%d", &cycles);
+	    rstep(cycles, FALSE);
+    }
+    else if (strcmp(buffer, "rcontinue") == 0)
+	    rstep(0, TRUE);
+    else if (buffer[1] == 'd' || buffer[1] == 'D')
 	    rdump(dumpsim_file);
+    else if (buffer[1] == 'e' || buffer[1] == 'E') {
+	    fscanf(commands, "%255s", filename);
+	    restore(filename);
+    }
     else {
-	    scanf("%d", &cycles);
+	    fscanf(commands, "%d", &cycles);
+	    skip_line();
 	    run(cycles);
     }
     break;
@@ -257,62 +812,72 @@ void get_command(FILE * dumpsim_file) {
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : init_memory                                     */
+/* Procedure : timing                                          */
 /*                                                             */
-/* Purpose   : Zero out the memory array                       */
+/* Purpose   : Turn the timing model on from a -t spec:        */
+/*             "default", or comma-separated changes to it --  */
+/*             branch=n, loaduse=n, device=n, icache=SxWxL,    */
+/*             dcache=SxWxL (sets x ways x line words, or 0    */
+/*             for none), imiss=n and dmiss=n.                 */
 /*                                                             */
 /***************************************************************/
-void init_memory() {                                           
-  int i;
-
-  for (i=0; i < WORDS_IN_MEM; i++) {
-    MEMORY[i] = 0;
-  }
-}
-
-/**************************************************************/
-/*                                                            */
-/* Procedure : load_program                                   */
-/*                                                            */
-/* Purpose   : Load program and service routines into mem.    */
-/*                                                            */
-/**************************************************************/
-void load_program(char *program_filename) {                   
-  FILE * prog;
-  int ii, word, program_base;
-
-  /* Open program file. */
-  prog = fopen(program_filename, "r");
-  if (prog == NULL) {
-    printf("Error: Can't open program file %s\n", program_filename);
-    exit(-1);
+void timing(const char *spec) {
+  lc3_timing_config config;
+  lc3_cache_config *cache;
+  const char *whole = spec;
+  char key[16];
+  int value, length;
+
+  lc3_timing_default(&config);
+  while (strcmp(spec, "default") != 0 && *spec != '\0') {
+    length = 0;
+    if (sscanf(spec, "%15[a-z]=%n", key, &length) != 1 || length == 0)
+      goto bad;
+    spec += length;
+    if (strcmp(key, "icache") == 0 || strcmp(key, "dcache") == 0) {
+      cache = key[0] == 'i' ? &config.icache : &config.dcache;
+      if (sscanf(spec, "%dx%dx%d%n", &cache->sets, &cache->ways, &cache->line_words, &length) != 3) {
+        if (sscanf(spec, "%d%n", &value, &length) != 1 || value != 0)
+          goto bad;
+        cache->sets = 0;
+      }
+    } else {
+      if (sscanf(spec, "%d%n", &value, &length) != 1)
+        goto bad;
+      if (strcmp(key, "branch") == 0)
+        config.branch_penalty = value;
+      else if (strcmp(key, "loaduse") == 0)
+        config.load_use_penalty = value;
+      else if (strcmp(key, "device") == 0)
+        config.device_penalty = value;
+      else if (strcmp(key, "imiss") == 0)
+        config.icache.miss_penalty = value;
+      else if (strcmp(key, "dmiss") == 0)
+        config.dcache.miss_penalty = value;
+      else
+        goto bad;
+    }
+    spec += length;
+    if (*spec == ',')
+      spec++;
+    else if (*spec != '\0')
+      goto bad;
   }
 
-  /* Read in the program. */
-  if (fscanf(prog, "%x\n", &word) != EOF)
-    program_base = word ;
-  else {
-    printf("Error: Program file is empty\n");
+  switch (lc3_timing(machine, &config)) {
+  case 0:
+    return;
+  case LC3_ERR_NOMEM:
+    printf("Error: Out of memory\n");
     exit(-1);
+  default:
+    printf("Error: Can't model timing %s\n", whole);
+    exit(1);
   }
-
-  ii = 0;
-  while (fscanf(prog, "%x\n", &word) != EOF) {
-    /* Make sure it fits. */
-    if (program_base + ii >= WORDS_IN_MEM) {
-	    printf("Error: Program file %s is too long to fit in memory. %x\n",
-             program_filename, ii);
-	    exit(-1);
-    }
-
-    /* Write the word to memory array. */
-    MEMORY[program_base + ii] = word;
-    ii++;
-  }
-
-  if (CURRENT_LATCHES.PC == 0) CURRENT_LATCHES.PC = program_base;
-
-  printf("Read %d words from program into memory.\n\n", ii);
+bad:
+  printf("Error: bad timing spec at %s (branch=n,loaduse=n,device=n,icache=SxWxL,dcache=SxWxL,imiss=n,dmiss=n)\n",
+         spec);
+  exit(1);
 }
 
 /************************************************************/
@@ -323,316 +888,280 @@ void load_program(char *program_filename) {
 /*             and set up initial state of the machine.     */
 /*                                                          */
 /************************************************************/
-void initialize(char *program_filename, int num_prog_files) { 
-  int i;
+void initialize(char *program_filenames[], int num_prog_files, int engine) { 
+  int i, words;
+
+  machine = lc3_create(engine);
+  if (machine == NULL) {
+    printf("Error: Out of memory\n");
+    exit(-1);
+  }
+  if (lc3_engine(machine) != engine)
+    printf("JIT not available on this host, using the threaded engine\n\n");
 
-  init_memory();
   for ( i = 0; i < num_prog_files; i++ ) {
-    load_program(program_filename);
-    while(*program_filename++ != '\0');
+    words = lc3_load(machine, program_filenames[i]);
+    if (words == LC3_ERR_OPEN) {
+      printf("Error: Can't open program file %s\n", program_filenames[i]);
+      exit(-1);
+    }
+    if (words == LC3_ERR_EMPTY) {
+      printf("Error: Program file is empty\n");
+      exit(-1);
+    }
+    if (words == LC3_ERR_TOO_LONG) {
+      printf("Error: Program file %s is too long to fit in memory.\n",
+             program_filenames[i]);
+      exit(-1);
+    }
+    if (words == LC3_ERR_FORMAT) {
+      printf("Error: Program image %s is corrupt\n", program_filenames[i]);
+      exit(-1);
+    }
+    if (words == LC3_ERR_NOMEM) {
+      printf("Error: Out of memory\n");
+      exit(-1);
+    }
+    printf("Read %d words from program into memory.\n\n", words);
   }
-  CURRENT_LATCHES.Z = 1;  
-  NEXT_LATCHES = CURRENT_LATCHES;
-    
-  RUN_BIT = TRUE;
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : main                                            */
+/* Procedure : batch                                           */
+/*                                                             */
+/* Purpose   : Run every program file (directories contribute  */
+/*             their *.hex and *.img files) on its own machine,*/
+/*             without the shell, and write one report line    */
+/*             each. With a quantum they share one thread      */
+/*             under the scheduler.                            */
 /*                                                             */
 /***************************************************************/
-int main(int argc, char *argv[]) {                              
-  FILE * dumpsim_file;
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *) a, *(char *const *) b);
+}
 
-  /* Error Checking */
-  if (argc < 2) {
-    printf("Error: usage: %s <program_file_1> <program_file_2> ...\n",
-           argv[0]);
-    exit(1);
+void batch(char *paths[], int num_paths, char *report_filename,
+           int engine, int budget, int threads, int quantum) {
+  char **programs = NULL, *name;
+  int count = 0, room = 0, i, first, length;
+  lc3_batch_result *results;
+  lc3_sched_stats stats;
+  struct dirent *entry;
+  struct stat st;
+  FILE *report;
+  DIR *dir;
+
+  for (i = 0; i < num_paths; i++) {
+    first = count;
+    if (stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+      if ((dir = opendir(paths[i])) == NULL) {
+        printf("Error: Can't open directory %s\n", paths[i]);
+        exit(-1);
+      }
+      while ((entry = readdir(dir)) != NULL) {
+        length = strlen(entry->d_name);
+        if (length < 5 || (strcmp(entry->d_name + length - 4, ".hex") != 0 &&
+                           strcmp(entry->d_name + length - 4, ".img") != 0))
+          continue;
+        name = malloc(strlen(paths[i]) + length + 2);
+        sprintf(name, "%s/%s", paths[i], entry->d_name);
+        if (count == room)
+          programs = realloc(programs, (room = room * 2 + 16) * sizeof(char *));
+        programs[count++] = name;
+      }
+      closedir(dir);
+      qsort(programs + first, count - first, sizeof(char *), compare_names);
+    } else {
+      if (count == room)
+        programs = realloc(programs, (room = room * 2 + 16) * sizeof(char *));
+      programs[count++] = strdup(paths[i]);
+    }
   }
 
-  printf("LC-3 Simulator\n\n");
-
-  initialize(argv[1], argc - 1);
-
-  if ( (dumpsim_file = fopen( "dumpsim", "w" )) == NULL ) {
-    printf("Error: Can't open dumpsim file\n");
+  if ((report = fopen(report_filename, "w")) == NULL) {
+    printf("Error: Can't open report file %s\n", report_filename);
     exit(-1);
   }
-
-  while (1)
-    get_command(dumpsim_file);
-    
+  results = calloc(count, sizeof(lc3_batch_result));
+  if (count > 0 && (results == NULL ||
+      (quantum > 0 ? lc3_batch_sched(programs, count, engine, budget, quantum, results, &stats)
+                   : lc3_batch_run(programs, count, engine, budget, threads, results)) != 0)) {
+    printf("Error: Can't start the batch\n");
+    exit(-1);
+  }
+  lc3_batch_report(report, programs, count, results);
+  fclose(report);
+  if (quantum > 0) {
+    printf("Ran %d programs on one thread, %d-intruction quanta, report in %s\n",
+           count, quantum, report_filename);
+    if (count > 0)
+      printf("%lld intructions in %lld slices, %lld parks, fairness %.3f\n"
+             "dispatch latency mean %.1f max %lld, wake latency mean %.1f max %lld\n",
+             stats.clock, stats.slices, stats.parks, stats.fairness,
+             stats.dispatch_mean, stats.dispatch_max, stats.wake_mean, stats.wake_max);
+  } else
+    printf("Ran %d programs on %d threads, report in %s\n",
+           count, threads, report_filename);
+
+  for (i = 0; i < count; i++)
+    free(programs[i]);
+  free(programs);
+  free(results);
 }
 
 /***************************************************************/
-/* Do not modify the above code.
-   You are allowed to use the following global variables in your
-   code. These are defined above.
-
-   MEMORY
-
-   CURRENT_LATCHES
-   NEXT_LATCHES
-
-   You may define your own local/global variables and functions.
-   You may use the functions to get at the control bits defined
-   above.
-
-   Begin your code here 	  			       */
-
+/*                                                             */
+/* Procedure : main                                            */
+/*                                                             */
 /***************************************************************/
+int main(int argc, char *argv[]) {                              
+  FILE * dumpsim_file;
+  int first = 1, engine = LC3_ENGINE_SWITCH;
+  char *report_filename = NULL, *image_filename = NULL, *script_filename = NULL;
+  char *timing_spec = NULL;
+  int memo = FALSE, fuse = FALSE, host_period = 0;
+  int budget = 100000000, threads = sysconf(_SC_NPROCESSORS_ONLN), quantum = 0;
+
+  /* Options */
+  while (first + 1 < argc && argv[first][0] == '-') {
+    if (strcmp(argv[first], "-e") == 0) {
+      if (strcmp(argv[first + 1], "switch") == 0)
+        engine = LC3_ENGINE_SWITCH;
+      else if (strcmp(argv[first + 1], "threaded") == 0)
+        engine = LC3_ENGINE_THREADED;
+      else if (strcmp(argv[first + 1], "inplace") == 0)
+        engine = LC3_ENGINE_INPLACE;
+      else if (strcmp(argv[first + 1], "jit") == 0)
+        engine = LC3_ENGINE_JIT;
+      else if (strcmp(argv[first + 1], "jit-check") == 0)
+        engine = LC3_ENGINE_JIT_CHECK;
+      else if (strcmp(argv[first + 1], "profile") == 0)
+        engine = LC3_ENGINE_PROFILE;
+      else {
+        printf("Error: unknown engine %s (switch, threaded, inplace, jit, jit-check, profile)\n",
+               argv[first + 1]);
+        exit(1);
+      }
+    } else if (strcmp(argv[first], "-b") == 0) {
+      report_filename = argv[first + 1];
+    } else if (strcmp(argv[first], "-c") == 0) {
+      image_filename = argv[first + 1];
+    } else if (strcmp(argv[first], "-n") == 0) {
+      budget = atoi(argv[first + 1]);
+    } else if (strcmp(argv[first], "-j") == 0) {
+      threads = atoi(argv[first + 1]);
+    } else if (strcmp(argv[first], "-S") == 0) {
+      quantum = atoi(argv[first + 1]);
+      if (quantum < 1) {
+        printf("Error: quantum must be at least 1\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[first], "-s") == 0) {
+      script_filename = argv[first + 1];
+    } else if (strcmp(argv[first], "-t") == 0) {
+      timing_spec = argv[first + 1];
+    } else if (strcmp(argv[first], "-H") == 0) {
+      host_period = atoi(argv[first + 1]);
+      if (host_period < 1) {
+        printf("Error: sampling period must be at least 1\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[first], "-m") == 0) {
+      memo = TRUE;
+      first++;
+      continue;
+    } else if (strcmp(argv[first], "-f") == 0) {
+      fuse = TRUE;
+      first++;
+      continue;
+    } else if (strcmp(argv[first], "-q") == 0) {
+      dump_screen = FALSE;
+      first++;
+      continue;
+    } else if (strcmp(argv[first], "-d") == 0) {
+      if (strcmp(argv[first + 1], "text") == 0)
+        dump_format = DUMP_TEXT;
+      else if (strcmp(argv[first + 1], "json") == 0)
+        dump_format = DUMP_JSON;
+      else if (strcmp(argv[first + 1], "binary") == 0)
+        dump_format = DUMP_BINARY;
+      else {
+        printf("Error: unknown dumpsim format %s (text, json, binary)\n", argv[first + 1]);
+        exit(1);
+      }
+    } else {
+      break;
+    }
+    first += 2;
+  }
 
-int x_to_32 (int x, int n) {
-    return (x << (32 - n)) >> (32 - n);
-}
+  /* Error Checking */
+  if (argc <= first) {
+    printf("Error: usage: %s [-e engine] [-t timing] [-m] [-f] [-H period] [-s script [-q] [-d format]] <program_file_1> <program_file_2> ...\n",
+           argv[0]);
+    printf("       %s [-e engine] -b report [-j threads | -S quantum] [-n budget] <program_file_or_dir> ...\n",
+           argv[0]);
+    printf("       %s -c image <hex_file_1> <hex_file_2> ...\n", argv[0]);
+    exit(1);
+  }
 
-int fetch(){
-  int insturction = MEMORY[CURRENT_LATCHES.PC];
-  NEXT_LATCHES.PC = CURRENT_LATCHES.PC + 1;
-  return insturction; 
-}
+  if (image_filename != NULL) {
+    if (lc3_image_convert(&argv[first], argc - first, image_filename) != 0) {
+      printf("Error: Can't convert to %s\n", image_filename);
+      exit(1);
+    }
+    printf("Wrote %d program files to %s\n", argc - first, image_filename);
+    exit(0);
+  }
 
-void Set_Condition_Code(int dr){
-  int value = CURRENT_LATCHES.REGS[dr];
-  int sign = (value & 0x8000) >> 15;
-  if (value == 0){
-    NEXT_LATCHES.N = 0;
-    NEXT_LATCHES.Z = 1;
-    NEXT_LATCHES.P = 0;
+  if (report_filename != NULL) {
+    batch(&argv[first], argc - first, report_filename, engine, budget, threads, quantum);
+    exit(0);
   }
-  else if (sign){
-    NEXT_LATCHES.N = 1;
-    NEXT_LATCHES.Z = 0;
-    NEXT_LATCHES.P = 0;
+
+  commands = stdin;
+  if (script_filename != NULL) {
+    if (strcmp(script_filename, "-") != 0 && (commands = fopen(script_filename, "r")) == NULL) {
+      printf("Error: Can't open script %s\n", script_filename);
+      exit(1);
+    }
+    interactive = FALSE;
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER);
+  } else
+    printf("LC-3 Simulator\n\n");
+
+  initialize(&argv[first], argc - first, engine);
+  if (timing_spec != NULL)
+    timing(timing_spec);
+  if (memo && lc3_memo(machine, TRUE) != 0) {
+    printf("Error: Out of memory\n");
+    exit(-1);
   }
-  else {
-    NEXT_LATCHES.N = 0;
-    NEXT_LATCHES.Z = 0;
-    NEXT_LATCHES.P = 1;
+  if (host_period > 0 && lc3_hostperf(machine, host_period) != 0) {
+    printf("Error: Out of memory\n");
+    exit(-1);
+  }
+  if (fuse) {
+    if (lc3_fuse(machine, TRUE) != 0) {
+      printf("Error: Out of memory\n");
+      exit(-1);
+    }
+    fuse_walk_text(stdout);
   }
-}
 
-void ADD(int intruction){
-  int dr = intruction & 0x0E00 >> 9; 
-  int sr1 = intruction & 0x01C0 >> 6;
-  int sr2 = intruction & 0x0007;
-  int imm_flag = (intruction & 0x0020) >> 5;
-  int imm5 = intruction & 0x001F;
-  imm5 = x_to_32(imm5, 5);
-  
-  if (imm_flag) {
-    NEXT_LATCHES.REGS[dr] = CURRENT_LATCHES.REGS[sr1] + imm5;
-    NEXT_LATCHES.REGS[dr] = Low16bits(NEXT_LATCHES.REGS[dr]);
-  } else {
-    NEXT_LATCHES.REGS[dr] = CURRENT_LATCHES.REGS[sr1] + CURRENT_LATCHES.REGS[sr2];
-    NEXT_LATCHES.REGS[dr] = Low16bits(NEXT_LATCHES.REGS[dr]);
+  if ( (dumpsim_file = fopen( "dumpsim", dump_format == DUMP_BINARY ? "wb" : "w" )) == NULL ) {
+    printf("Error: Can't open dumpsim file\n");
+    exit(-1);
   }
-  Set_Condition_Code(dr);
-}
-
-void AND(int intruction){
-  int dr = (intruction & 0x0E00) >> 9; 
-  int sr1 = (intruction & 0x01C0) >> 6;
-  int sr2 = (intruction & 0x0007);
-  int imm_flag = (intruction & 0x0020) >> 5;
-  int imm5 = (intruction & 0x001F);
-  imm5 = x_to_32(imm5, 5);
-  
-  if (imm_flag) {
-    NEXT_LATCHES.REGS[dr] = CURRENT_LATCHES.REGS[sr1] & imm5;
-    NEXT_LATCHES.REGS[dr] = Low16bits(NEXT_LATCHES.REGS[dr]);
-  } else {
-    NEXT_LATCHES.REGS[dr] = CURRENT_LATCHES.REGS[sr1] & CURRENT_LATCHES.REGS[sr2];
-    NEXT_LATCHES.REGS[dr] = Low16bits(NEXT_LATCHES.REGS[dr]);
-  }
-  
-  Set_Condition_Code(dr);
-}
-
-void BR(int intruction){
-  int n = (intruction & 0x0800) >> 11;
-  int z = (intruction & 0x0400) >> 10;
-  int p = (intruction & 0x0200) >> 9;
-  int offset = intruction & 0x01FF;
-  offset = x_to_32(offset, 9);
-  
-  if ((n && CURRENT_LATCHES.N) || (z && CURRENT_LATCHES.Z) || (p && CURRENT_LATCHES.P)){
-    NEXT_LATCHES.PC = NEXT_LATCHES.PC + offset;
-  }
-}
-
-void JMP(int intruction){
-  int base_r = (intruction & 0x01C0) >> 6;
-  NEXT_LATCHES.PC = CURRENT_LATCHES.REGS[base_r];
-}
-
-void JSR(int intruction){
-  int long_flag = (intruction & 0x0800) >> 11;
-  int base_r = (intruction & 0x01C0) >> 6;
-  int offset = (intruction & 0x07FF);
-  offset = x_to_32(offset, 11);
-  
-  NEXT_LATCHES.REGS[7] = NEXT_LATCHES.PC;
-  
-  if (long_flag){
-    NEXT_LATCHES.PC = NEXT_LATCHES.PC + offset;
-  } else {
-    NEXT_LATCHES.PC = CURRENT_LATCHES.REGS[base_r];
-  }
-}
-
-void LD(int intruction){
-  int dr = (intruction & 0x0E00) >> 9;
-  int offset = (intruction & 0x01FF);
-  offset = x_to_32(offset, 9);
-  int address = CURRENT_LATCHES.PC + offset;
-  
-  NEXT_LATCHES.REGS[dr] = MEMORY[address];
-  NEXT_LATCHES.REGS[dr] = Low16bits(NEXT_LATCHES.REGS[dr]);
-  Set_Condition_Code(dr);
-}
-
-void LDI(int intruction){
-  int dr = (intruction & 0x0E00) >> 9;
-  int offset = (intruction & 0x01FF);
-  offset = x_to_32(offset, 9);
-  int address = MEMORY[CURRENT_LATCHES.PC + offset];
-  
-  NEXT_LATCHES.REGS[dr] = MEMORY[address];
-  NEXT_LATCHES.REGS[dr] = Low16bits(NEXT_LATCHES.REGS[dr]);
-  Set_Condition_Code(dr);
-}
-
-void LDR(int intruction){
-  int dr = (intruction & 0x0E00) >> 9;
-  int base_r = (intruction & 0x01C0) >> 6;
-  int offset = (intruction & 0x003F);
-  offset = x_to_32(offset, 6);
-  
-  NEXT_LATCHES.REGS[dr] = MEMORY[CURRENT_LATCHES.REGS[base_r] + offset];
-  NEXT_LATCHES.REGS[dr] = Low16bits(NEXT_LATCHES.REGS[dr]);
-  Set_Condition_Code(dr);
-}
-
-void LEA(int intruction){
-  int dr = (intruction & 0x0E00) >> 9;
-  int offset = (intruction & 0x01FF);
-  offset = x_to_32(offset, 9);
-  
-  NEXT_LATCHES.REGS[dr] = CURRENT_LATCHES.PC + offset;
-  NEXT_LATCHES.REGS[dr] = Low16bits(NEXT_LATCHES.REGS[dr]);
-  //Set_Condition_Code(dr);
-}
-
-void NOT(int intruction){
-  int dr = (intruction & 0x0E00) >> 9;
-  int sr = (intruction & 0x01C0) >> 6;
-  
-  NEXT_LATCHES.REGS[dr] = ~CURRENT_LATCHES.REGS[sr];
-  NEXT_LATCHES.REGS[dr] = Low16bits(NEXT_LATCHES.REGS[dr]);
-  Set_Condition_Code(dr);
-}
-
-void ST(int intruction){
-  int sr = (intruction & 0x0E00) >> 9;
-  int offset = (intruction & 0x01FF);
-  offset = x_to_32(offset, 9);
-  int address = CURRENT_LATCHES.PC + offset;
-  MEMORY[address] = CURRENT_LATCHES.REGS[sr];
-  MEMORY[address] = Low16bits(MEMORY[address]);
-}
-void STI(int intruction){
-  int sr = (intruction & 0x0E00) >> 9;
-  int offset = (intruction & 0x01FF);
-  offset = x_to_32(offset, 9);
-  int address = MEMORY[CURRENT_LATCHES.PC + offset];
-  
-  MEMORY[address] = CURRENT_LATCHES.REGS[sr];
-  MEMORY[address] = Low16bits(MEMORY[address]);
-}
-
-void STR(int intruction){
-  int sr = (intruction & 0x0E00) >> 9;
-  int base_r = (intruction & 0x01C0) >> 6;
-  int offset = (intruction & 0x003F);
-  offset = x_to_32(offset, 6);
-  
-  MEMORY[CURRENT_LATCHES.REGS[base_r] + offset] = CURRENT_LATCHES.REGS[sr];
-  MEMORY[CURRENT_LATCHES.REGS[base_r] + offset] = Low16bits(MEMORY[CURRENT_LATCHES.REGS[base_r] + offset]);
-}
-
-void TRAP(int intruction){
-  int trapvect8 = intruction & 0x00FF;
-  NEXT_LATCHES.PC = MEMORY[trapvect8];
-  
-}
-void execute(int opcode, int intruction){
-  switch (opcode){
-  case 0b0001:
-    ADD(intruction);
-    break;
-  case 0b0101:
-    AND(intruction);
-    break;
-  case 0b0000:
-    BR(intruction);
-    break;
-  case 0b1100:
-    JMP(intruction);
-    break;
-  case 0b0100:
-    JSR(intruction);
-    break;
-  case 0b0010:
-    LD(intruction);
-    break;
-  case 0b1010:
-    LDI(intruction);
-    break;
-  case 0b0110:
-    LDR(intruction);
-    break;
-  case 0b1110:
-    LEA(intruction);
-    break;
-  case 0b1001:
-    NOT(intruction);
-    break;
-  case 0b0011:
-    ST(intruction);
-    break;
-  case 0b1011:
-    STI(intruction);
-    break;
-  case 0b0111:
-    STR(intruction);
-    break;
-  case 0b1111:
-    TRAP(intruction);
-    break;
-  default:
-    break;
+  if (!interactive)
+    setvbuf(dumpsim_file, NULL, _IOFBF, OUTPUT_BUFFER);
+  if (dump_format == DUMP_BINARY) {
+    fwrite("LC3D", 1, 4, dumpsim_file);
+    put16(dumpsim_file, DUMP_VERSION);
   }
-}
-int decode(int intruction){
-  int opcode = (intruction & 0xF000) >> 12;
-  return opcode;
-}
 
-void process_intruction(){
-  /*  function: process_intruction
-   *  
-   *    Process one intruction at a time  
-   *       -Fetch one intruction
-   *       -Decode 
-   *       -Execute
-   *       -Update NEXT_LATCHES
-   */     
-  int intruction = fetch();
-  int opcode = decode(intruction);
-  execute(opcode, intruction);
-  CURRENT_LATCHES = NEXT_LATCHES;
+  while (1)
+    get_command(dumpsim_file);
+    
 }
-
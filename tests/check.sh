@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# check.sh : regression programs on every engine
+#
+#   Builds lc3sim, then runs each case below through the shell
+#   on every engine and compares the intruction count and R0-R7
+#   after its commands with what they must be. Every C file in
+#   tests/ is built against the library and run as well; each
+#   exits non-zero on a failure. Run from anywhere:
+#
+#     tests/check.sh [engine ...]
+#
+#   Exits 1 if anything failed.
+#
+
+TOP=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+ENGINES=${*:-"switch threaded inplace jit jit-check profile"}
+FAILED=0
+
+cc="${CC:-gcc} -O2 -Wall -pthread -I$TOP"
+$cc -o "$WORK/lc3sim" "$TOP/lc3sim.c" "$TOP"/lc3_*.c || exit 1
+
+# check name "programs" "commands" "count=N R0=0x.... ... R7=0x...."
+check() {
+  for engine in $ENGINES; do
+    got=$(cd "$WORK" && printf "$3rdump\nquit\n" |
+          ./lc3sim -e $engine $(for p in $2; do echo "$TOP/$p"; done) 2>&1 |
+          awk '/JIT check failed/ { bad = 1 }
+               /intruction Count/ { count = $4; regs = "" }
+               /^[0-7]: / { regs = regs " R" substr($1, 1, 1) "=" $2 }
+               END { print (bad ? "jit-check failed " : "") "count=" count regs }')
+    if [ "$got" != "$4" ]; then
+      echo "FAIL $1 ($engine)"
+      echo "  want $4"
+      echo "  got  $got"
+      FAILED=1
+    fi
+  done
+}
+
+check fibonacci "Fibonacci.hex" "go\n" \
+  "count=32 R0=0x0000 R1=0x0002 R2=0x0001 R3=0x0002 R4=0x0002 R5=0x0002 R6=0x0000 R7=0x0000"
+check fibon "Fibon.hex" "go\n" \
+  "count=41 R0=0x0000 R1=0x0003 R2=0x0002 R3=0x0003 R4=0x0003 R5=0x0003 R6=0x0000 R7=0x0000"
+check other "test_other.hex" "go\n" \
+  "count=8 R0=0x0000 R1=0xabcd R2=0x300b R3=0x0000 R4=0x0000 R5=0x0000 R6=0x0000 R7=0x3001"
+check shift "shifit_to_right.hex" "go\n" \
+  "count=254 R0=0x0000 R1=0xffff R2=0x0000 R3=0x8000 R4=0x0000 R5=0x0000 R6=0x0000 R7=0x0000"
+check fibonacci-run "Fibonacci.hex" "run 7\nrun 7\nrun 7\ngo\n" \
+  "count=32 R0=0x0000 R1=0x0002 R2=0x0001 R3=0x0002 R4=0x0002 R5=0x0002 R6=0x0000 R7=0x0000"
+check loops "tests/loops.hex" "go\n" \
+  "count=822189 R0=0x0007 R1=0x0000 R2=0x0000 R3=0x0000 R4=0xfe07 R5=0xffff R6=0x8e8c R7=0x3002"
+check loops-run "tests/loops.hex" "run 1000\nrun 12345\nrun 99999\ngo\n" \
+  "count=822189 R0=0x0007 R1=0x0000 R2=0x0000 R3=0x0000 R4=0xfe07 R5=0xffff R6=0x8e8c R7=0x3002"
+check smc "tests/smc.hex" "go\n" \
+  "count=32 R0=0x0006 R1=0x0004 R2=0x0000 R3=0x3000 R4=0x1022 R5=0x0000 R6=0x0000 R7=0x0000"
+check smc-watch "tests/smc.hex" "watch 0x3000\ngo\ngo\ngo\ngo\n" \
+  "count=32 R0=0x0006 R1=0x0004 R2=0x0000 R3=0x3000 R4=0x1022 R5=0x0000 R6=0x0000 R7=0x0000"
+check smc-record "tests/smc.hex" "run 3\nrecord smc.rec\nrun 8\nrecord off\ngo\n" \
+  "count=32 R0=0x0006 R1=0x0004 R2=0x0000 R3=0x3000 R4=0x1022 R5=0x0000 R6=0x0000 R7=0x0000"
+check fibonacci-record "Fibonacci.hex" "run 3\nrecord fibonacci.rec\nrun 8\nrecord off\ngo\n" \
+  "count=32 R0=0x0000 R1=0x0002 R2=0x0001 R3=0x0002 R4=0x0002 R5=0x0002 R6=0x0000 R7=0x0000"
+check smc-trace "tests/smc.hex" "run 3\ntrace smc.trace\nrun 8\ntrace off\ngo\n" \
+  "count=32 R0=0x0006 R1=0x0004 R2=0x0000 R3=0x3000 R4=0x1022 R5=0x0000 R6=0x0000 R7=0x0000"
+check fibonacci-trace "Fibonacci.hex" "run 3\ntrace fibonacci.trace\nrun 8\ntrace off\ngo\n" \
+  "count=32 R0=0x0000 R1=0x0002 R2=0x0001 R3=0x0002 R4=0x0002 R5=0x0002 R6=0x0000 R7=0x0000"
+
+# Past 2^31 intructions.
+check long "tests/long.hex" "go\n" \
+  "count=3221127170 R0=0x0000 R1=0x0000 R2=0x0000 R3=0x0001 R4=0x0000 R5=0x0000 R6=0x0000 R7=0x0000"
+
+for test in "$TOP"/tests/*.c; do
+  [ -f "$test" ] || continue
+  name=$(basename "$test" .c)
+  $cc -o "$WORK/$name" "$test" "$TOP"/lc3_*.c || { FAILED=1; continue; }
+  (cd "$WORK" && TOP="$TOP" "./$name") || { echo "FAIL $name"; FAILED=1; }
+done
+
+[ $FAILED = 0 ] && echo "all passed"
+exit $FAILED
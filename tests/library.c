@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3.h"
+
+/***************************************************************/
+/*                                                             */
+/* library : regression checks through the library interface   */
+/*                                                             */
+/*   Each check runs on every engine and compares the machine  */
+/*   with what it must hold. tests/check.sh builds and runs    */
+/*   this with TOP set to the top of the tree; it prints each  */
+/*   failure and exits 1 if there was one.                     */
+/*                                                             */
+/***************************************************************/
+
+static const char *engines[] = {
+  "switch", "threaded", "jit", "jit-check", "inplace", "profile"
+};
+#define ENGINES ((int) (sizeof(engines) / sizeof(engines[0])))
+
+static int failed;
+
+static void expect(const char *check, int engine, const char *what, int got, int want) {
+  if (got == want)
+    return;
+  printf("FAIL %s (%s): %s is 0x%.4x, not 0x%.4x\n", check, engines[engine], what, got, want);
+  failed = 1;
+}
+
+/* A fresh machine with the words at 0x3000 and the PC on them. */
+static lc3_machine *machine(int engine, const int words[], int count) {
+  lc3_machine *m = lc3_create(engine);
+  System_Latches latches;
+  int i;
+
+  lc3_console(m, NULL, NULL);
+  for (i = 0; i < count; i++)
+    lc3_write_mem(m, 0x3000 + i, words[i]);
+  lc3_get_regs(m, &latches);
+  latches.PC = 0x3000;
+  lc3_set_regs(m, &latches);
+  return m;
+}
+
+/* Runs shorter than a block, which the JIT leaves to the interpreter. */
+static void check_short_runs(int engine) {
+  static const int loop[] = {
+    0x1021,			/* ADD R0, R0, #1 */
+    0x3002,			/* ST R0, #2 */
+    0x0FFD			/* BRnzp #-3 */
+  };
+  lc3_machine *m = machine(engine, loop, 3);
+  System_Latches latches;
+  int i;
+
+  for (i = 0; i < 10; i++)
+    lc3_run(m, 4);
+  lc3_get_regs(m, &latches);
+  expect("short_runs", engine, "R0", latches.REGS[0], 14);
+  expect("short_runs", engine, "stored", lc3_read_mem(m, 0x3004), 13);
+  expect("short_runs", engine, "count", lc3_count(m), 40);
+  lc3_destroy(m);
+}
+
+/* lc3_write_mem() over a word the engine has already run. */
+static void check_write_mem(int engine) {
+  static const int loop[] = { 0x1021, 0x0FFE };	/* ADD R0, R0, #1; BRnzp #-2 */
+  lc3_machine *m = machine(engine, loop, 2);
+  System_Latches latches;
+
+  lc3_run(m, 10);
+  lc3_write_mem(m, 0x3000, 0x1022);	/* ADD R0, R0, #2 */
+  lc3_run(m, 10);
+  lc3_get_regs(m, &latches);
+  expect("write_mem", engine, "R0", latches.REGS[0], 15);
+  expect("write_mem", engine, "count", lc3_count(m), 20);
+  expect("write_mem", engine, "halted", lc3_halted(m), 0);
+  lc3_destroy(m);
+}
+
+/* Latches with none of N, Z and P set keep them until one is set. */
+static void check_no_flags(int engine) {
+  static const int leas[] = { 0xE201, 0xE201 };	/* LEA R1, #1; LEA R1, #1 */
+  lc3_machine *m = machine(engine, leas, 2);
+  System_Latches latches;
+
+  lc3_get_regs(m, &latches);
+  latches.N = latches.Z = latches.P = 0;
+  lc3_set_regs(m, &latches);
+  lc3_run(m, 2);
+  lc3_get_regs(m, &latches);
+  expect("no_flags", engine, "nzp", latches.N << 2 | latches.Z << 1 | latches.P, 0);
+  expect("no_flags", engine, "PC", latches.PC, 0x3002);
+  lc3_destroy(m);
+}
+
+/* An image loaded over code the engine has already run. */
+static void check_load_image(int engine) {
+  static const int loop[] = { 0x1021, 0x0FFE };	/* ADD R0, R0, #1; BRnzp #-2 */
+  char twos[4096];
+  char *hex_files[] = { twos };
+  lc3_machine *m = machine(engine, loop, 2);
+  const char *top = getenv("TOP");
+  System_Latches latches;
+
+  snprintf(twos, sizeof(twos), "%s/tests/twos.hex", top != NULL ? top : ".");
+  lc3_run(m, 10);
+  if (lc3_image_convert(hex_files, 1, "twos.img") < 0 || lc3_load(m, "twos.img") < 0) {
+    printf("FAIL load_image (%s): can't build or load twos.img\n", engines[engine]);
+    failed = 1;
+  }
+  lc3_run(m, 10);
+  lc3_get_regs(m, &latches);
+  expect("load_image", engine, "R0", latches.REGS[0], 15);
+  expect("load_image", engine, "count", lc3_count(m), 20);
+  lc3_destroy(m);
+}
+
+/* An image with a data segment away from the code, in lanes. */
+static void check_lanes_image(void) {
+  char fibonacci[4096], data[4096];
+  char *hex_files[] = { fibonacci, data };
+  lc3_machine *m = lc3_create(LC3_ENGINE_SWITCH);
+  lc3_lanes *l = lc3_lanes_create(LC3_LANES);
+  const char *top = getenv("TOP");
+  int lane, address;
+
+  snprintf(fibonacci, sizeof(fibonacci), "%s/Fibonacci.hex", top != NULL ? top : ".");
+  snprintf(data, sizeof(data), "%s/tests/data.hex", top != NULL ? top : ".");
+  if (lc3_image_convert(hex_files, 2, "lanes.img") < 0 ||
+      lc3_load(m, "lanes.img") < 0 || lc3_lanes_load(l, "lanes.img") < 0) {
+    printf("FAIL lanes_image: can't build or load lanes.img\n");
+    failed = 1;
+  } else {
+    for (lane = 0; lane < LC3_LANES; lane++)
+      for (address = 0x3000; address < 0x4002; address++)
+        if (lc3_lanes_read_mem(l, lane, address) != lc3_read_mem(m, address)) {
+          printf("FAIL lanes_image (lane %d): MEMORY[0x%.4x] is 0x%.4x, not 0x%.4x\n", lane,
+                 address, lc3_lanes_read_mem(l, lane, address), lc3_read_mem(m, address));
+          failed = 1;
+          break;
+        }
+  }
+  lc3_lanes_destroy(l);
+  lc3_destroy(m);
+}
+
+/* Run to HALT; the registers and count go in latches and *count. */
+static void finish(lc3_machine *m, System_Latches *latches, int *count) {
+  lc3_run(m, 100000);
+  lc3_get_regs(m, latches);
+  *count = lc3_count(m);
+}
+
+/* The timer keeps its interval and phase through a snapshot. */
+static void check_snapshot_timer(int engine) {
+  char timer[4096];
+  lc3_machine *m = lc3_create(engine), *copy = lc3_create(engine), *loaded = lc3_create(engine);
+  lc3_snapshot *s = NULL, *file = NULL;
+  System_Latches want, got;
+  const char *top = getenv("TOP");
+  char what[32];
+  int want_count, got_count, k;
+
+  snprintf(timer, sizeof(timer), "%s/tests/timer.hex", top != NULL ? top : ".");
+  lc3_console(m, NULL, NULL);
+  lc3_console(copy, NULL, NULL);
+  lc3_console(loaded, NULL, NULL);
+  if (lc3_load(m, timer) >= 0) {
+    lc3_run(m, 150);	/* between the first two ticks */
+    s = lc3_snapshot_take(m);
+  }
+  if (s == NULL || lc3_snapshot_save(s, "timer.snap") != 0 ||
+      lc3_snapshot_load("timer.snap", &file) != 0) {
+    printf("FAIL snapshot_timer (%s): can't snapshot %s\n", engines[engine], timer);
+    failed = 1;
+  } else {
+    lc3_snapshot_restore(copy, s);
+    lc3_snapshot_restore(loaded, file);
+    finish(m, &want, &want_count);
+    finish(copy, &got, &got_count);
+    expect("snapshot_timer", engine, "count", got_count, want_count);
+    for (k = 0; k < LC_3_REGS; k++) {
+      sprintf(what, "R%d", k);
+      expect("snapshot_timer", engine, what, got.REGS[k], want.REGS[k]);
+    }
+    finish(loaded, &got, &got_count);
+    expect("snapshot_timer", engine, "count from the file", got_count, want_count);
+    for (k = 0; k < LC_3_REGS; k++) {
+      sprintf(what, "R%d from the file", k);
+      expect("snapshot_timer", engine, what, got.REGS[k], want.REGS[k]);
+    }
+  }
+  lc3_snapshot_free(s);
+  lc3_snapshot_free(file);
+  lc3_destroy(m);
+  lc3_destroy(copy);
+  lc3_destroy(loaded);
+}
+
+/* One memoized routine called from two places returns to each. */
+static void check_memo_calls(int engine) {
+  static const int calls[] = {
+    0x5020,			/* AND R0, R0, #0 */
+    0x0000, 0x0000, 0x0000,	/* NOP */
+    0x4804,			/* JSR #4 */
+    0x0000,			/* NOP */
+    0x4802,			/* JSR #2 */
+    0x0000,			/* NOP */
+    0xF025,			/* HALT */
+    0x1221,			/* ADD R1, R0, #1 */
+    0x0E00,			/* BRnzp #0 */
+    0xC1C0			/* JMP R7 */
+  };
+  lc3_machine *m = machine(engine, calls, 12);
+  System_Latches latches;
+
+  lc3_memo(m, 1);
+  lc3_run(m, 13);	/* to just after the second call */
+  lc3_get_regs(m, &latches);
+  expect("memo_calls", engine, "PC", latches.PC, 0x3007);
+  expect("memo_calls", engine, "R7", latches.REGS[7], 0x3007);
+  expect("memo_calls", engine, "count", lc3_count(m), 13);
+  lc3_destroy(m);
+}
+
+/* A GETC already run from a stream, then from a queue and back. */
+static void check_console_queue(int engine) {
+  static const int getc_loop[] = { 0xF020, 0x0FFE };	/* GETC; BRnzp #-2 */
+  lc3_machine *m = machine(engine, getc_loop, 2);
+  System_Latches latches;
+
+  lc3_run(m, 4);	/* decoded with no queue; reads 0 */
+  lc3_console_queue(m);
+  lc3_run(m, 4);
+  expect("console_queue", engine, "waiting", lc3_waiting(m), 1);
+  expect("console_queue", engine, "count", lc3_count(m), 4);
+  lc3_console_feed(m, "A", 1);
+  lc3_run(m, 1);
+  lc3_get_regs(m, &latches);
+  expect("console_queue", engine, "R0", latches.REGS[0], 'A');
+  lc3_console(m, NULL, NULL);
+  lc3_run(m, 3);
+  lc3_get_regs(m, &latches);
+  expect("console_queue", engine, "R0", latches.REGS[0], 0);
+  expect("console_queue", engine, "count", lc3_count(m), 8);
+  lc3_destroy(m);
+}
+
+/* The profile of a counted loop that loop skipping jumps over. */
+static void check_profile_loop(void) {
+  static const int loop[] = {
+    0x5020,			/* AND R0, R0, #0 */
+    0x5260,			/* AND R1, R1, #0 */
+    0x126A,			/* ADD R1, R1, #10 */
+    0x1022,			/* ADD R0, R0, #2 */
+    0x127F,			/* ADD R1, R1, #-1 */
+    0x03FD,			/* BRp #-3 */
+    0xF025			/* HALT */
+  };
+  static const char *lines[] = {
+    "Profile : 34 intructions",
+    "  ADD            21",
+    "0x3003..0x3005 : 9 iterations, 30 intructions",
+    "0x3005 : taken 9, not taken 1"
+  };
+  lc3_machine *m = machine(LC3_ENGINE_PROFILE, loop, 7);
+  FILE *report = tmpfile();
+  char text[4096];
+  size_t length;
+  int i;
+
+  lc3_run(m, 100);
+  lc3_profile_report(m, report);
+  rewind(report);
+  length = fread(text, 1, sizeof(text) - 1, report);
+  text[length] = '\0';
+  for (i = 0; i < (int) (sizeof(lines) / sizeof(lines[0])); i++)
+    if (strstr(text, lines[i]) == NULL) {
+      printf("FAIL profile_loop: no \"%s\" in\n%s", lines[i], text);
+      failed = 1;
+    }
+  fclose(report);
+  lc3_destroy(m);
+}
+
+/*
+ * The check.sh programs in lanes, each lane starting from its own R0,
+ * against a switch machine started the same way.
+ */
+static void check_lanes(const char *program) {
+  lc3_lanes *l = lc3_lanes_create(LC3_LANES);
+  lc3_machine *m;
+  const char *top = getenv("TOP");
+  char path[4096];
+  System_Latches want, got;
+  int lane, k, address;
+
+  snprintf(path, sizeof(path), "%s/%s", top != NULL ? top : ".", program);
+  if (lc3_lanes_load(l, path) < 0) {
+    printf("FAIL lanes (%s): can't load it\n", program);
+    failed = 1;
+    lc3_lanes_destroy(l);
+    return;
+  }
+  for (lane = 0; lane < LC3_LANES; lane++) {
+    lc3_lanes_get_regs(l, lane, &got);
+    got.REGS[0] = lane * 5;
+    lc3_lanes_set_regs(l, lane, &got);
+  }
+  lc3_lanes_run(l, 100000);
+
+  for (lane = 0; lane < LC3_LANES; lane++) {
+    m = lc3_create(LC3_ENGINE_SWITCH);
+    lc3_console(m, NULL, NULL);
+    lc3_load(m, path);
+    lc3_get_regs(m, &want);
+    want.REGS[0] = lane * 5;
+    lc3_set_regs(m, &want);
+    lc3_run(m, 100000);
+    lc3_get_regs(m, &want);
+    lc3_lanes_get_regs(l, lane, &got);
+
+    if (lc3_lanes_count(l, lane) != lc3_count(m) || got.PC != want.PC ||
+        got.N != want.N || got.Z != want.Z || got.P != want.P ||
+        lc3_lanes_halted(l, lane) != lc3_halted(m)) {
+      printf("FAIL lanes (%s, lane %d): count %lld PC 0x%.4x, not %lld PC 0x%.4x\n",
+             program, lane, lc3_lanes_count(l, lane), got.PC, lc3_count(m), want.PC);
+      failed = 1;
+    }
+    for (k = 0; k < LC_3_REGS; k++)
+      if (got.REGS[k] != want.REGS[k]) {
+        printf("FAIL lanes (%s, lane %d): R%d is 0x%.4x, not 0x%.4x\n",
+               program, lane, k, got.REGS[k], want.REGS[k]);
+        failed = 1;
+      }
+    for (address = 0; address < 0xFE00; address++)
+      if (lc3_lanes_read_mem(l, lane, address) != lc3_read_mem(m, address)) {
+        printf("FAIL lanes (%s, lane %d): MEMORY[0x%.4x] is 0x%.4x, not 0x%.4x\n", program,
+               lane, address, lc3_lanes_read_mem(l, lane, address), lc3_read_mem(m, address));
+        failed = 1;
+        break;
+      }
+    lc3_destroy(m);
+  }
+  lc3_lanes_destroy(l);
+}
+
+int main(void) {
+  int engine;
+
+  for (engine = 0; engine < ENGINES; engine++) {
+    check_write_mem(engine);
+    check_short_runs(engine);
+    check_no_flags(engine);
+    check_load_image(engine);
+    check_snapshot_timer(engine);
+    check_memo_calls(engine);
+    check_console_queue(engine);
+  }
+  check_profile_loop();
+  check_lanes_image();
+  check_lanes("Fibonacci.hex");
+  check_lanes("Fibon.hex");
+  check_lanes("test_other.hex");
+  check_lanes("shifit_to_right.hex");
+  check_lanes("tests/loops.hex");
+  check_lanes("tests/smc.hex");
+  return failed;
+}
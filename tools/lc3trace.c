@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc3.h"
+
+/***************************************************************/
+/*                                                             */
+/* lc3trace : print an execution trace                         */
+/*                                                             */
+/*   Reads a trace written by lc3_trace() (shell: trace file)  */
+/*   and prints one line per entry, as text or with -c as CSV: */
+/*                                                             */
+/*     count pc intruction opcode kind where value nzp         */
+/*                                                             */
+/*   count is the intruction count before the intruction ran;  */
+/*   the entries of one intruction share it, and an interrupt  */
+/*   entry has the count of the intruction it came before.     */
+/*                                                             */
+/***************************************************************/
+
+static const char *OPCODES[16] = {
+  "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+  "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP"
+};
+
+static const char *KINDS[4] = { "-", "reg", "mem", "int" };
+
+static void nzp(int cc, char *text) {
+  text[0] = cc & 4 ? 'n' : '-';
+  text[1] = cc & 2 ? 'z' : '-';
+  text[2] = cc & 1 ? 'p' : '-';
+  text[3] = '\0';
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : print_entry                                     */
+/*                                                             */
+/* Purpose   : One line for one entry, text or CSV.            */
+/*                                                             */
+/***************************************************************/
+static void print_entry(FILE *out, long long count, const lc3_trace_entry *e, int csv) {
+  int kind = e->kind & LC3_TRACE_KIND;
+  const char *opcode = kind == LC3_TRACE_INTERRUPT ? "INT" : OPCODES[e->intruction >> 12];
+  char cc[4];
+
+  nzp(e->cc, cc);
+  if (csv) {
+    fprintf(out, "%lld,0x%.4x,0x%.4x,%s,%s,", count, e->pc, e->intruction, opcode, KINDS[kind]);
+    if (kind == LC3_TRACE_NONE)
+      fprintf(out, ",,%s\n", cc);
+    else if (kind == LC3_TRACE_REG)
+      fprintf(out, "R%d,0x%.4x,%s\n", e->where, e->value, cc);
+    else
+      fprintf(out, "0x%.4x,0x%.4x,%s\n", e->where, e->value, cc);
+    return;
+  }
+
+  fprintf(out, "%10lld  x%.4x  x%.4x  %-4s  ", count, e->pc, e->intruction, opcode);
+  switch (kind) {
+  case LC3_TRACE_REG:
+    fprintf(out, "R%d    <- x%.4x", e->where, e->value);
+    break;
+  case LC3_TRACE_MEM:
+    fprintf(out, "x%.4x <- x%.4x", e->where, e->value);
+    break;
+  case LC3_TRACE_INTERRUPT:
+    fprintf(out, "x%.2x   -> x%.4x", e->where, e->value);
+    break;
+  default:
+    fprintf(out, "%15s", "");
+    break;
+  }
+  fprintf(out, "  %s\n", cc);
+}
+
+int main(int argc, char *argv[]) {
+  lc3_trace_reader *r;
+  lc3_trace_entry e;
+  int csv = FALSE, first = 1, status;
+  long long count;
+
+  if (first < argc && strcmp(argv[first], "-c") == 0) {
+    csv = TRUE;
+    first++;
+  }
+  if (first + 1 != argc) {
+    fprintf(stderr, "Error: usage: %s [-c] <trace_file>\n", argv[0]);
+    exit(1);
+  }
+  if ((r = lc3_trace_open(argv[first])) == NULL) {
+    fprintf(stderr, "Error: Can't read trace %s\n", argv[first]);
+    exit(1);
+  }
+
+  if (csv)
+    printf("count,pc,intruction,opcode,kind,where,value,nzp\n");
+  count = lc3_trace_start(r);
+  while ((status = lc3_trace_next(r, &e)) > 0) {
+    print_entry(stdout, count, &e, csv);
+    if (!(e.kind & LC3_TRACE_MORE) && (e.kind & LC3_TRACE_KIND) != LC3_TRACE_INTERRUPT)
+      count++;
+  }
+  lc3_trace_close(r);
+  if (status < 0) {
+    fprintf(stderr, "Error: %s is cut short\n", argv[first]);
+    exit(2);
+  }
+  return 0;
+}